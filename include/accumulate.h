@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef enum {
+    REDUCE_MEAN,
+    REDUCE_MAX,
+    REDUCE_MIN,
+    REDUCE_LAST,
+} Reducer;
+
+// Folds any number of frames into a single row. The inner loops are written
+// so the compiler turns them into packed add/max/min over the whole row.
+typedef struct RowAccumulator {
+    Reducer reducer;
+    uint64_t width;
+    uint64_t count; // frames folded in since the last finish_row()
+    float* acc;
+} RowAccumulator;
+
+// Allocates acc, up to user to free
+RowAccumulator new_row_accumulator(uint64_t width, Reducer reducer);
+void free_row_accumulator(RowAccumulator* r);
+
+void accumulate_row(RowAccumulator* r, const float* frame);
+// Returns the reduced row and starts a new one. Only valid while count > 0,
+// the pointer is good until the next accumulate_row().
+const float* finish_row(RowAccumulator* r);
+
+// Returns 0 on success, -1 for an unknown name
+int parse_reducer(const char* name, Reducer* reducer);
+const char* reducer_name(Reducer reducer);
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef enum {
+    BIN_MAX,
+    BIN_MIN,
+    BIN_MEAN,
+    BIN_ENVELOPE,   // min and max both
+} BinMode;
+
+// Reduces `nbins` consecutive bins to `ncols` pixel columns, so a frame much
+// wider than the window is drawn from the bins in view without narrow peaks
+// falling between pixels. Column c covers bins [c * nbins / ncols,
+// (c + 1) * nbins / ncols), or just the bin under it when there are more
+// columns than bins. `out` gets each column's max, min or mean. For
+// BIN_ENVELOPE `out` gets the max and `lo` the min, otherwise `lo` isn't
+// touched and may be NULL. NaNs are skipped by max, min and envelope.
+void bin_columns(const float* in, uint64_t nbins, uint64_t ncols, BinMode mode, float* out, float* lo);
+// Kernel the reductions run on, "scalar", "avx2" or "avx512"
+const char* binning_isa(void);
+
+// Returns 0 on success, -1 for an unknown name
+int parse_bin_mode(const char* name, BinMode* mode);
+const char* bin_mode_name(BinMode mode);
+
+#define BIN_PYRAMID_MAX_LEVELS 24
+// Entries per column binning from a pyramid reads at the least
+#define BIN_PYRAMID_MIN_ENTRIES 4
+
+// Rows of bins kept at successively halved resolutions, each level's entry
+// the max, min or mean of the two under it. Binning a range of bins to
+// columns starts from the coarsest level that still has
+// BIN_PYRAMID_MIN_ENTRIES entries per column, so it costs a handful of reads
+// per column however many bins are in view. Blocks at a level don't line up
+// with column edges, so a column can pick up a peak from under a quarter of
+// a column past its edge, but never misses one of its own. Level 0 is the
+// caller's own rows and isn't stored.
+typedef struct BinPyramid {
+    BinMode mode;           // not BIN_ENVELOPE
+    uint64_t width;         // bins at level 0
+    uint64_t nrows;
+    int nlevels;            // including level 0
+    uint64_t widths[BIN_PYRAMID_MAX_LEVELS];
+    float* levels[BIN_PYRAMID_MAX_LEVELS]; // nrows * widths[k] each, from 1
+} BinPyramid;
+
+// Keeps halving the rows while that leaves at least `min_width` entries.
+// Allocates, up to user to free.
+BinPyramid new_bin_pyramid(uint64_t width, uint64_t nrows, uint64_t min_width, BinMode mode);
+void free_bin_pyramid(BinPyramid* p);
+// Works out row `r`'s levels from its `width` bins, `in`. The caller keeps
+// `in` as the row's level 0.
+void build_pyramid_row(BinPyramid* p, uint64_t r, const float* in);
+// bin_columns() on bins [first, first + nbins) of row `r`, whose level 0 is
+// `in`, in the pyramid's mode
+void bin_pyramid_row(const BinPyramid* p, uint64_t r, const float* in, uint64_t first, uint64_t nbins,
+        uint64_t ncols, float* out);
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "datatype.h"
+
+#define CAPTURE_MIN_RING_BYTES (16 << 20)
+
+// Triggered capture, given as a comma separated list:
+//   pre=<len>    Input kept from before the trigger (default 1s)
+//   post=<len>   Input written after it (default 1s)
+//   level=<x>    Trigger when a frame's peak rises through x
+//   fifo=<path>  Trigger on anything written to the FIFO, made if missing
+//   dir=<path>   Where captures go (default the working directory)
+// Lengths are seconds with an "s" suffix, e.g. "2.5s", or else bytes with an
+// optional k, M or G suffix.
+typedef struct CaptureOptions {
+    double pre_seconds;     // 0 when given in bytes
+    uint64_t pre_bytes;
+    double post_seconds;
+    uint64_t post_bytes;
+    int level_enabled;
+    float level;
+    char fifo[256];         // empty for none
+    char dir[256];
+} CaptureOptions;
+
+CaptureOptions default_capture_options(void);
+// Returns 0 on success, -1 for a bad spec
+int parse_capture_options(const char* spec, CaptureOptions* opts);
+
+// Keeps the raw input in a ring in memory, backed by huge pages where the
+// system has them, and on a trigger writes the pre-trigger part of it and
+// the post-trigger input that follows to one DSP_DATA file. The ring holds
+// twice the pre-trigger length, so the writer thread has as long again to
+// get the old input out before the producer comes round to it.
+//
+// The producer never waits for the writer. Input goes out with write()
+// straight from the ring, and anything the producer overwrote while it was
+// being written is counted in `overruns`. Triggers that come in while a
+// capture is being written are ignored.
+typedef struct Capture {
+    DataType type;
+    double sample_rate;
+    uint64_t frame_bytes;
+    char* ring;
+    size_t capacity;
+    size_t map_bytes;
+    int huge;               // ring is on explicit huge pages
+    uint64_t pre_bytes;
+    uint64_t post_bytes;
+    char dir[256];
+    int fifo_fd;            // -1 for none
+    int fifo_keepalive;     // our own writer, so the FIFO never hangs up
+
+    // Producer side
+    int level_enabled;
+    float level;
+    int armed;              // peak was below level last frame
+
+    atomic_uint_fast64_t written;   // bytes ever put in the ring
+    atomic_uint_fast64_t trigger;   // ring position of a pending trigger + 1
+    atomic_uint_fast64_t captures;  // files written
+    atomic_uint_fast64_t overruns;  // bytes overwritten before they were saved
+    atomic_int busy;                // a capture is being written
+    atomic_int quit;
+    pthread_t thread;
+} Capture;
+
+// Sizes the ring from `opts`, lengths in seconds needing `sample_rate`, maps
+// it, opens any FIFO and spawns the writer. `cap` must stay put until
+// stop_capture(). Returns 0 on success, -1 (with errno) on failure.
+int start_capture(Capture* cap, const CaptureOptions* opts, DataType type, double sample_rate, uint64_t frame_bytes);
+// Finishes a capture in progress with what has arrived so far
+void stop_capture(Capture* cap);
+
+// Producer side, one thread only. Takes whole raw frames as they arrive.
+void capture_frames(Capture* cap, const void* data, size_t nbytes);
+// Ring position the next frame will go to
+uint64_t capture_position(const Capture* cap);
+// Checks a converted frame for the level trigger, `at` is the ring position
+// of its raw frame
+void capture_check_level(Capture* cap, const float* frame, uint64_t n, uint64_t at);
+
+// Fires the trigger at the newest input, from any thread
+void trigger_capture(Capture* cap);
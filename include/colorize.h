@@ -0,0 +1,62 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+
+// Entries in a colormap
+#define COLORMAP_SIZE 256
+
+// Packs a colormap header's 256 sRGB float triples into opaque RGBA8, each
+// entry laid out in memory as r, g, b, a bytes like raylib's Color
+void build_colormap_lut(float (*table)[3], uint32_t lut[COLORMAP_SIZE]);
+
+// Splits [lo, hi) evenly across the colormap and maps each value to its
+// index, clamping anything outside. NaNs go to 0. hi must be above lo.
+void quantize_row(const float* in, uint8_t* out, uint64_t n, float lo, float hi);
+// Same, then looks each index up in `lut`, all in one pass
+void colorize_row(const float* in, uint32_t* out, uint64_t n, float lo, float hi, const uint32_t* lut);
+// Kernel the above run on, "scalar", "avx2" or "avx512"
+const char* colorize_isa(void);
+
+typedef struct Quantizer Quantizer;
+
+typedef struct QuantizeWorker {
+    Quantizer* q;
+    int index;
+    pthread_t thread;
+} QuantizeWorker;
+
+// Fork/join pool for quantizing or colorizing a whole history at once, e.g.
+// after the color limits change. Rows are split evenly across the workers
+// and the caller takes the first share.
+struct Quantizer {
+    int nthreads;
+
+    // Current job, colors with a lut and indices without
+    const float* in;
+    void* out;
+    uint64_t nrows;
+    uint64_t width;
+    float lo;
+    float hi;
+    const uint32_t* lut;
+
+    QuantizeWorker* workers;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t generation;
+    int pending;
+    int quit;
+};
+
+// Spawns nthreads - 1 workers, or one per CPU up to 8 for nthreads of 0.
+// `q` must stay put until stop_quantizer().
+void start_quantizer(Quantizer* q, int nthreads);
+void stop_quantizer(Quantizer* q);
+
+// quantize_row() over `nrows` rows of `width`, returns once they're all done
+void quantize_rows(Quantizer* q, const float* in, uint8_t* out, uint64_t nrows, uint64_t width, float lo, float hi);
+// colorize_row() likewise
+void colorize_rows(Quantizer* q, const float* in, uint32_t* out, uint64_t nrows, uint64_t width,
+        float lo, float hi, const uint32_t* lut);
@@ -4,6 +4,8 @@
 #include <stdint.h>
 
 #include "raylib.h"
+#include "datatype.h"
+#include "ingest.h"
 
 typedef struct VecF32 {
     uint64_t npoints;
@@ -49,23 +51,6 @@ typedef struct Tag {
 } Tag;
 
 
-typedef enum {
-    U8,
-    I8,
-    I16,
-    I32,
-    I64,
-    F32,
-    F64,
-    Ci8,
-    Ci16,
-    Ci32,
-    Ci64,
-    Cf32,
-    Cf64,
-} DataType;
-
-
 float min(float x, float y);
 float max(float x, float y);
 float randn();
@@ -73,11 +58,22 @@ void get_path(const char* filename, char* pathname);
 Vector2 to_pixels(Vector2 logical, Screen* screen);
 Vector2 to_logical(Vector2 pixels, Screen* screen);
 ByteVec load_file_bytes(const char* filename);
-VecF32 load_file_real(const char* filename, DataType type);
-VecCf32 load_file_complex(const char* filename, DataType type);
+// Called on the loading thread as the file comes in, with the bytes read so
+// far. Returning nonzero cancels the load.
+typedef int (*LoadProgress)(uint64_t nbytes_done, uint64_t nbytes_total, void* user);
+
+// Whole file loaders. Chunks of the file are read and converted straight into
+// the result on up to 8 threads, so memory peaks at the result plus 4 MiB a
+// thread. `progress` may be NULL. A cancelled load frees everything and
+// returns an empty vector with NULL points.
+VecF32 load_file_real(const char* filename, DataType type, LoadProgress progress, void* user);
+VecCf32 load_file_complex(const char* filename, DataType type, LoadProgress progress, void* user);
 
 void draw_mouse_crosshair(Vector2 mouse_pos, Screen* screen);
 void draw_mouse_drag_rectangle(Vector2 click_start, Vector2 mouse_pos, Screen* screen);
 void draw_info_panel(Screen* screen);
+void draw_ingest_info(Ingest* ingest, Screen* screen);
+int draw_ingest_help(Ingest* ingest, int y);
+void handle_ingest_keys(Ingest* ingest);
 void draw_tags(Tag* tags, size_t ntags, Screen* screen);
 void push_zoom_stack(Screen* screen, Vector2 click_start, Vector2 click_end);
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "datatype.h"
+
+// All conversions go through SIMD kernels picked once at runtime from what
+// the CPU supports (SSE2, AVX2+FMA or AVX-512), with a portable fallback.
+const char* convert_isa(void);
+
+void convert_u8_f32(const uint8_t* in, float* out, size_t nelements);
+void convert_i8_f32(const int8_t* in, float* out, size_t nelements);
+void convert_i16_f32(const int16_t* in, float* out, size_t nelements);
+void convert_i32_f32(const int32_t* in, float* out, size_t nelements);
+void convert_i64_f32(const int64_t* in, float* out, size_t nelements);
+void convert_f64_f32(const double* in, float* out, size_t nelements);
+
+// Converts `nelements` scalars of `type` to floats as in * scale + offset in
+// the same pass. Complex samples are two elements each and come out
+// interleaved.
+void convert_to_f32(DataType type, const void* in, float* out, size_t nelements, float scale, float offset);
+
+// Converts one frame of `nsamples` raw samples to the floats the viewers
+// draw. Complex samples are reduced to their magnitude, `scratch` needs room
+// for 2 * nsamples floats in that case.
+void convert_frame(DataType type, const void* in, float* out, size_t nsamples, float scale, float offset, float* scratch);
+
+// As convert_to_f32() and convert_frame(), for samples stored in the other
+// byte order to the host. Swapping happens in the same pass.
+void convert_to_f32_swapped(DataType type, const void* in, float* out, size_t nelements, float scale, float offset);
+void convert_frame_swapped(DataType type, const void* in, float* out, size_t nsamples, float scale, float offset, float* scratch);
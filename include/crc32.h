@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32 as used by zlib, gzip and Ethernet (reflected 0x04C11DB7). Runs on
+// PCLMULQDQ folding when the CPU has it, slice-by-8 tables otherwise.
+const char* crc32_isa(void);
+
+// Extends `crc` over `n` more bytes, start from 0. Chunks can be any size,
+// crc32_update(crc32_update(0, a, n), b, m) matches one pass over a then b.
+uint32_t crc32_update(uint32_t crc, const void* data, size_t n);
+
+// CRC of A followed by B from crc(A), crc(B) and B's length, so a file's CRC
+// can cover a header that's only written at the end.
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
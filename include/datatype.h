@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+
+typedef enum {
+    U8,
+    I8,
+    I16,
+    I32,
+    I64,
+    F32,
+    F64,
+    Ci8,
+    Ci16,
+    Ci32,
+    Ci64,
+    Cf32,
+    Cf64,
+} DataType;
+
+// Bytes per sample, complex types count both parts
+size_t datatype_size(DataType type);
+int datatype_is_complex(DataType type);
+// Accepts the enum names, any case (e.g. "i16", "Ci16", "cf32"). Returns 0 on
+// success, -1 for an unknown name.
+int parse_datatype(const char* name, DataType* type);
+const char* datatype_name(DataType type);
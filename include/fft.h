@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+
+// Radix-2 complex FFT on split real/imaginary arrays, which keeps every
+// butterfly stage a straight run of packed float math. Sizes must be a power
+// of 2.
+typedef struct Fft {
+    uint64_t n;
+    uint32_t* bitrev;  // bitrev[k] is where input sample k goes
+    float* twiddle_re; // per stage tables, stage of length L starts at L/2 - 1
+    float* twiddle_im;
+} Fft;
+
+// Allocates tables, up to user to free
+Fft new_fft(uint64_t n);
+void free_fft(Fft* fft);
+
+// In place forward transform. The input must already be in bit reversed
+// order (see Fft.bitrev), so callers can fold the permutation into whatever
+// pass fills the buffers.
+void fft_bitrev_input(const Fft* fft, float* re, float* im);
@@ -1,9 +1,32 @@
 #pragma once
 
+#include <stdint.h>
+#include <stdio.h>
+
+#include "datatype.h"
+
+// BLUE (Midas) file, a 512 byte header control block then the data. Parsed
+// from the fixed fields and the type 1000/2000 adjunct, keywords and
+// extended headers are skipped.
+#define BLUE_HEADER_SIZE 512
+
 typedef struct BlueFile {
     char magic[4];
     char header[508];
     char* data;
+    int head_swapped;  // header fields in the other byte order to the host
+    int data_swapped;  // samples in the other byte order to the host
+    int32_t type;      // 1000 for a 1D stream, 2000 for frames of subsize
+    char format[2];    // mode (S scalar, C complex) then element type
+    double data_start; // bytes
+    double data_size;
+    double xstart;
+    double xdelta;
+    int32_t xunits;    // 1 for seconds, 3 for Hz
+    int32_t subsize;   // type 2000 frame size
+    double ystart;
+    double ydelta;
+    int32_t yunits;
 } BlueFile;
 
 typedef struct DspDataFile {
@@ -17,5 +40,86 @@ typedef struct DspDataFile {
     uint32_t crc32;
 } DspDataFile;
 
+// DSP_DATA layout, integers little endian:
+//   char[8]  "DSP_DATA"
+//   u64      data_type, a DataType
+//   u64      data_format, reserved
+//   u64      nbytes_data
+//   u64      nbytes_meta
+//   data, then metadata
+//   u32      CRC-32 of everything before it
+// Streams may carry any number of records back to back.
+#define DSP_DATA_HEADER_SIZE 40
+#define DSP_DATA_MAX_META (16 << 20) // larger metadata is checked but not kept
+
+typedef enum {
+    FORMAT_RAW,
+    FORMAT_DSP_DATA,
+    FORMAT_BLUE,
+} FileFormat;
+
+// Returns 0 on success, -1 for an unknown name
+int parse_file_format(const char* name, FileFormat* format);
+
+typedef enum {
+    DSP_PARSE_HEADER,
+    DSP_PARSE_DATA,
+    DSP_PARSE_META,
+    DSP_PARSE_CRC,
+    DSP_PARSE_ERROR,
+} DspParseState;
+
+// Push parser for DSP_DATA streams, takes bytes in whatever chunks they
+// arrive and hands back the sample payload. The CRC is computed on the fly.
+typedef struct DspDataParser {
+    DspParseState state;
+    DspDataFile file;     // current record, metadata once it's all in
+    uint8_t header[DSP_DATA_HEADER_SIZE];
+    uint8_t crc_bytes[4];
+    uint64_t have;        // bytes of the current section so far
+    uint32_t crc;
+    int typed;            // records after the first must share its type
+    DataType type;
+    uint64_t records;     // records whose CRC has been checked
+    uint64_t crc_errors;
+    const char* error;
+} DspDataParser;
+
+// Lays out a DSP_DATA header in `header`, which has DSP_DATA_HEADER_SIZE bytes
+void format_dsp_data_header(uint8_t* header, DataType type, uint64_t nbytes_data, uint64_t nbytes_meta);
+
+DspDataParser new_dsp_data_parser(void);
+void free_dsp_data_parser(DspDataParser* parser);
+// Parses `n` bytes of stream in place, leaving just the sample payload at the
+// front of `buf`. Returns the number of payload bytes.
+size_t dsp_data_filter(DspDataParser* parser, char* buf, size_t n);
+
 void read_file(const char* filename, char* buffer);
 void read_nbytes(FILE* fid, const uint64_t byte_pos, const uint64_t nbytes, char* output);
+
+// Read-only view of a whole file. Nothing is read up front, pages fault in as
+// frames are touched so opening is O(1) regardless of file size. DSP_DATA
+// and BLUE headers are recognized and narrow the view to the sample payload.
+typedef struct MappedFile {
+    uint64_t nbytes;
+    const char* bytes;
+    uint64_t data_offset; // start of the sample payload
+    uint64_t data_nbytes;
+    FileFormat format;
+    int typed;            // the header gave the sample type
+    DataType type;
+    int swapped;          // samples in the other byte order to the host
+    uint64_t frame_size;  // samples per frame if the header says, else 0
+    double sample_rate;   // if the header says, else 0
+    int has_crc;
+    uint64_t crc_nbytes;  // bytes from the start of the file the CRC covers
+    uint32_t crc32;
+    BlueFile blue;        // FORMAT_BLUE only
+} MappedFile;
+
+// Peeks at the header of `filename` without mapping it, returns -1 if the
+// file can't be read.
+int probe_file(const char* filename, MappedFile* info);
+
+MappedFile map_file(const char* filename);
+void unmap_file(MappedFile* file);
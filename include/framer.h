@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Optional header in front of every frame of a stream, big endian on the
+// wire: a sync word of 2, 4 or 8 bytes then a sequence number of 0, 2, 4 or
+// 8 bytes. Given as e.g. "0x1acffc1d" or "0x1acffc1d,seq=u32", the number of
+// hex digits sets the sync word's size.
+typedef struct FramerOptions {
+    uint64_t sync;
+    int sync_bytes; // 0 for bare frames
+    int seq_bytes;
+} FramerOptions;
+
+FramerOptions default_framer_options(void);
+// Returns 0 on success, -1 for a bad spec
+int parse_framer_options(const char* spec, FramerOptions* opts);
+
+// Cuts a byte stream into whole frames however the bytes arrive, carrying
+// partial frames over from one read to the next. Reads go into the free
+// space at framer_write_ptr(), and framer_commit() turns whatever is complete
+// into frames packed at the front of `buf`, headers stripped.
+//
+// With a sync word the framer has to see it in front of two frames in a row
+// before it trusts it. Once locked a frame without it drops the lock and the
+// framer hunts forward byte by byte, so corruption costs the frames it hit
+// rather than shifting everything after it. Sequence numbers that skip ahead
+// are counted as missing frames.
+typedef struct Framer {
+    FramerOptions opts;
+    uint64_t frame_bytes;  // payload per frame
+    uint64_t header_bytes; // sync word plus sequence number
+    char* buf;
+    size_t capacity;
+    uint64_t nready;       // whole frames at the front of buf, unparsed bytes follow
+    size_t have;           // end of the bytes so far
+    int locked;
+    int have_seq;
+    uint64_t expected;     // next sequence number
+    int suspect;           // suspect_seq didn't follow on, waiting for the next
+    uint64_t suspect_seq;
+
+    // Running totals
+    uint64_t resyncs;      // times the lock was lost
+    uint64_t gaps;         // frames missing from the sequence
+    uint64_t skipped;      // bytes thrown away hunting for a sync word
+} Framer;
+
+// Room for `nframes` framed frames plus `extra` bytes of headroom. Allocates
+// buf, up to user to free.
+Framer new_framer(uint64_t frame_bytes, uint64_t nframes, size_t extra, const FramerOptions* opts);
+void free_framer(Framer* framer);
+
+// Where the next read goes and how much it may take
+char* framer_write_ptr(Framer* framer);
+size_t framer_room(const Framer* framer);
+
+// Takes `n` bytes written at framer_write_ptr(), returns the frames ready
+uint64_t framer_commit(Framer* framer, size_t n);
+// Drops the first `nframes` ready frames
+void framer_consume(Framer* framer, uint64_t nframes);
+// The input is known to have skipped, so throw away any partial frame rather
+// than finish it with the wrong bytes
+void framer_break(Framer* framer);
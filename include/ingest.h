@@ -0,0 +1,238 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "capture.h"
+#include "datatype.h"
+#include "filetypes.h"
+#include "framer.h"
+#include "net.h"
+#include "plugin.h"
+#include "psd.h"
+#include "record.h"
+#include "resample.h"
+#include "ring.h"
+#include "shmring.h"
+
+#define INGEST_RING_SLOTS 128
+#define INGEST_STAGE_FRAMES 64
+#define DEFAULT_PLAYBACK_FPS 60.0
+// Range scale_ingest_rate() keeps playback in, as multiples of real time
+#define MIN_PLAYBACK_SPEED (1.0 / 1024.0)
+#define MAX_PLAYBACK_SPEED 1024.0
+
+// Options every viewer takes for its input, see INGEST_OPTSTRING.
+//   -f <n>     Samples per frame
+//   -t <type>  DataType of the raw samples
+//   -g <k>     Scale applied while converting
+//   -b <x>     Offset added after scaling
+//   -s <hz>    Sample rate, for real time file playback
+//   -x <n>     Playback speed as a multiple of real time, 0 for flat out
+//   -P <spec>  Compute power spectra from raw samples, see parse_psd_options()
+//   -i <uri>   Input, a file to play back, udp:// or tcp:// (see net.h),
+//              shm://<name> (see shmring.h) or - for stdin, which is also the
+//              default. A trailing positional argument sets it too.
+//   -F <fmt>   Container of a stream input, raw (default) or dsp for DSP_DATA
+//              records. Files are recognized by their header.
+//   -w <path>  Record the raw input to a DSP_DATA file from the start
+//   -q <pol>   What to do when the viewer falls behind, see OverloadPolicy
+//   -y <spec>  Frames of a stream each start with a sync word and optional
+//              sequence number, see FramerOptions
+//   -u         Read files and pipes through io_uring, files with O_DIRECT,
+//              falling back to read() and mmap() where it isn't available
+//   -T <spec>  Keep the recent raw input in memory and write it out around a
+//              trigger, see CaptureOptions
+//   -R <spec>  Resample the raw input before anything else, see
+//              ResampleOptions. Frame sizes are in resampled samples.
+//   -L <spec>  Run frames through a plugin, "<path>[,<args>]", see plugin.h.
+//              Given more than once the plugins chain in order.
+// How the reader copes with a full ring. Recording always sees every frame.
+//   block       Wait for the viewer, so the source backs up (the default)
+//   drop        Keep reading and throw away the oldest frames, the viewer
+//               skips ahead to the newest at its next draw
+//   decimate:N  Only queue every Nth frame, then wait like block
+typedef enum {
+    OVERLOAD_BLOCK,
+    OVERLOAD_DROP,
+    OVERLOAD_DECIMATE,
+} OverloadPolicy;
+
+// Returns 0 on success, -1 for a bad spec
+int parse_overload_policy(const char* spec, OverloadPolicy* policy, uint64_t* decimate);
+
+typedef struct IngestOptions {
+    const char* input;
+    FileFormat format;
+    int swapped;        // set from a file header, samples in the other byte order
+    uint64_t frame_size;
+    DataType type;
+    float scale;
+    float offset;
+    double sample_rate;
+    double speed;
+    int psd;
+    PsdOptions psd_opts;
+    const char* record_path;
+    OverloadPolicy policy;
+    uint64_t decimate;  // N for OVERLOAD_DECIMATE, 1 otherwise
+    FramerOptions framing;
+    int uring;
+    int capture;
+    CaptureOptions capture_opts;
+    int resample;
+    ResampleOptions resample_opts;
+    const char* plugin_specs[PLUGIN_MAX_STAGES];
+    int nplugins;
+    PluginChain plugins;    // loaded by resolve_ingest_input()
+} IngestOptions;
+
+#define INGEST_OPTSTRING "f:t:g:b:s:x:P:i:F:w:q:y:uT:L:R:"
+
+IngestOptions default_ingest_options(uint64_t frame_size);
+// Floats per frame the viewer gets, which is the spectrum size with -P
+uint64_t ingest_frame_size(const IngestOptions* opts);
+// Sample rate after -R, 0 if not known
+double ingest_sample_rate(const IngestOptions* opts);
+// Returns 1 if `c` was one of the INGEST_OPTSTRING options, 0 otherwise
+int parse_ingest_option(int c, const char* arg, IngestOptions* opts);
+// Takes the data type, byte order and for BLUE files the frame size and
+// sample rate from the header of a file input, if it has one, then loads
+// any plugins for the frames that come out of that. The Ingest started with
+// these options owns the plugins from then on.
+void resolve_ingest_input(IngestOptions* opts);
+void print_ingest_options(const IngestOptions* opts);
+
+typedef enum {
+    SOURCE_FD,
+    SOURCE_FILE,
+    SOURCE_UDP,
+    SOURCE_TCP,
+    SOURCE_SHM,
+} SourceKind;
+
+// Socket, container and frame counters. Only the reader thread writes them,
+// apart from displayed and the viewer's share of dropped.
+typedef struct IngestStats {
+    atomic_uint_fast64_t received;     // frames read from the source
+    atomic_uint_fast64_t displayed;    // frames the viewer took
+    atomic_uint_fast64_t dropped;      // frames thrown away by the overload policy
+    atomic_uint_fast64_t packets;
+    atomic_uint_fast64_t bytes;
+    atomic_uint_fast64_t lost;         // datagrams missing from the sequence
+    atomic_uint_fast64_t reordered;    // late or duplicate datagrams, discarded
+    atomic_uint_fast64_t overflows;    // datagrams the kernel dropped, SO_RXQ_OVFL
+    atomic_uint_fast64_t truncated;    // datagrams over the mtu, discarded
+    atomic_uint_fast64_t records;      // DSP_DATA records with a checked CRC
+    atomic_uint_fast64_t crc_errors;
+    atomic_uint_fast64_t resyncs;      // times frame sync was lost
+    atomic_uint_fast64_t gaps;         // frames missing from the sequence
+    atomic_uint_fast64_t skipped;      // bytes thrown away finding sync again
+} IngestStats;
+
+// Reader thread that drains a file descriptor or socket, or plays back a
+// memory mapped file, into a FrameRing. Raw samples of `type` are converted
+// to floats on the reader thread, so the render loop only ever sees whole
+// float frames and never touches the source itself.
+typedef struct Ingest {
+    SourceKind kind;
+    DataType type;
+    int swapped;
+    float scale;
+    float offset;
+    uint64_t raw_frame_bytes;
+    uint64_t convert_size;      // floats per frame out of conversion or -P
+    OverloadPolicy policy;
+    uint64_t decimate;
+    uint64_t decimate_phase;    // frames since the last one queued, reader only
+    FramerOptions framing;
+    int uring;                  // read through io_uring if the kernel can
+    int psd_enabled;
+    Psd psd;
+    int resample_enabled;
+    Resampler resampler;
+    PluginChain plugins;        // n is 0 for none
+    float* staging;             // converted frames waiting for plugins that
+                                // change the frame size, NULL otherwise
+    int fd;                     // also a file's own descriptor with -u
+    FileFormat format;
+    DspDataParser dsp;
+    SocketUri net;
+    ShmRing shm;
+    int direct;                 // frames are copied straight out of shm, no thread
+    float* shm_copy;            // the last frame copied out, direct only
+    uint64_t shm_cursor;        // next shm frame for whoever reads it
+    uint64_t shm_seen;          // write index at the last look, direct only
+    IngestStats stats;
+    MappedFile file;
+    uint64_t nframes;           // frames in the file, 0 for streams
+    _Atomic double frame_rate;  // playback frames/sec, 0 for as fast as possible
+    double nominal_rate;        // frames/sec at real time
+    atomic_int paused;
+    atomic_int_fast64_t seek;   // requested frame, -1 if none pending
+    atomic_uint_fast64_t position; // next file frame to be queued
+    double sample_rate;
+    pthread_mutex_t record_lock; // guards recorder against the reader thread
+    Recorder* recorder;          // NULL when not recording
+    int capture_enabled;
+    Capture capture;
+    FrameRing ring;
+    pthread_t thread;
+    atomic_int running;
+    atomic_int eof;
+    atomic_int connected;       // 0 while a socket waits for its peer
+} Ingest;
+
+// Spawns the reader thread, `ingest` must stay put until stop_ingest().
+void start_ingest(Ingest* ingest, int fd, const IngestOptions* opts);
+void start_playback(Ingest* ingest, const char* filename, const IngestOptions* opts);
+// Sockets are opened on the reader thread, so a TCP input can wait for its
+// peer without holding up the window
+void start_socket(Ingest* ingest, const SocketUri* uri, const IngestOptions* opts);
+// Follows a shared memory ring, taking the frame size, type and sample rate
+// from its header. Plain floats are copied straight from the mapping as the
+// viewer takes them, anything else is converted into the ingest ring by a
+// reader thread. The producer never waits, so a viewer that falls over half
+// the ring behind skips ahead whatever the overload policy, and frames it
+// overwrites while they're being copied are dropped.
+void start_shm(Ingest* ingest, const char* name, const IngestOptions* opts);
+// Starts whichever of the above opts->input names
+void start_source(Ingest* ingest, const IngestOptions* opts);
+void stop_ingest(Ingest* ingest);
+
+// Viewer side of the ring. ingest_ready() carries out any skip the reader
+// asked for under OVERLOAD_DROP and returns the frames waiting, which are
+// then read with ingest_frame(). ingest_consume() hands back frames that
+// were shown and ingest_drop() ones the viewer chose not to show.
+// ingest_frame() returns NULL for a frame read straight out of shm that the
+// producer overwrote before it could be copied, which the viewer skips and
+// which counts as dropped. Such frames are only valid until the next call.
+uint64_t ingest_ready(Ingest* ingest);
+const float* ingest_frame(Ingest* ingest, uint64_t offset);
+// Frames waiting and, in `capacity`, how many could be
+uint64_t ingest_queued(Ingest* ingest, uint64_t* capacity);
+void ingest_consume(Ingest* ingest, uint64_t nframes);
+void ingest_drop(Ingest* ingest, uint64_t nframes);
+
+// Frames/sec for playing a file back at `speed` times real time. Without a
+// sample rate real time is taken to be DEFAULT_PLAYBACK_FPS, and a speed of 0
+// means as fast as possible.
+double playback_frame_rate(double sample_rate, double speed, uint64_t frame_size);
+
+// Playback controls, no-ops on streams. Seeks are clamped to the file.
+void seek_ingest(Ingest* ingest, int64_t frame);
+void set_ingest_rate(Ingest* ingest, double frame_rate);
+// Multiplies the playback rate by `factor`, from real time when playing flat
+// out, within MIN_PLAYBACK_SPEED..MAX_PLAYBACK_SPEED
+void scale_ingest_rate(Ingest* ingest, double factor);
+void toggle_ingest_pause(Ingest* ingest);
+
+// Fires a triggered capture now, a no-op without -T
+void trigger_ingest_capture(Ingest* ingest);
+
+// Recording of the raw input, as it arrives, to a DSP_DATA file. A NULL path
+// picks a timestamped name in the working directory. Returns 0 on success.
+int start_recording(Ingest* ingest, const char* path);
+void stop_recording(Ingest* ingest);
+void toggle_recording(Ingest* ingest);
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdatomic.h>
+
+// Socket inputs, given as
+//   udp://<host>:<port>[?rcvbuf=<bytes>&seq=<u32|u64>&batch=<n>&mtu=<bytes>]
+//   tcp://<host>:<port>[?rcvbuf=<bytes>]
+// UDP binds to host:port. TCP connects to host:port, or listens there and
+// takes the first connection when host is empty, 0.0.0.0 or ::. Host and
+// port have to fit their fields.
+typedef struct SocketUri {
+    int udp;
+    char host[256];
+    char port[16];
+    int rcvbuf;       // SO_RCVBUF bytes, 0 to leave the kernel default
+    int seq_bytes;    // big endian sequence number leading each datagram, 0 for none
+    int batch;        // datagrams per recvmmsg()
+    int max_datagram; // largest datagram expected
+} SocketUri;
+
+// Returns 0 on success, -1 if `uri` isn't a well formed socket URI
+int parse_socket_uri(const char* uri, SocketUri* out);
+// Returns the bound UDP socket or connected TCP socket, exits on failure.
+// Waiting on a TCP connection can take as long as the peer likes, so it
+// gives up and returns -1 once `running` is cleared.
+int open_socket(const SocketUri* uri, const atomic_int* running);
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+
+// C ABI for frame processors loaded with -L. A plugin is a shared object
+// exporting one `const RasterPlugin raster_plugin`, and only needs this
+// first half of the header:
+//
+//   static void* init(RasterPluginConfig* config) { ... }
+//   static void process(void* state, const float* in, float* out) { ... }
+//   static void destroy(void* state) { ... }
+//   const RasterPlugin raster_plugin = {
+//       RASTER_PLUGIN_ABI, "name", init, process, destroy,
+//   };
+//
+// Plugins run on the reader thread, on converted float frames (or spectra
+// with -P) just before they're queued for the viewer, so they see every
+// frame the viewer does and none that the overload policy throws away.
+
+#define RASTER_PLUGIN_ABI 1
+
+typedef struct RasterPluginConfig {
+    // Set by the host
+    uint32_t abi;               // RASTER_PLUGIN_ABI the host was built with
+    uint64_t frame_size;        // floats per input frame
+    double sample_rate;         // of the samples in the frames, after -R, 0 if
+                                // not known
+    int spectrum;               // frames are power spectra from -P
+    const char* args;           // whatever followed the path in the spec, "" for none
+
+    // Set by init() if it needs to, already holding the defaults
+    uint64_t out_frame_size;    // floats per output frame, frame_size
+    int in_place;               // process() copes with in == out, 0. Ignored
+                                // if out_frame_size > frame_size.
+} RasterPluginConfig;
+
+typedef struct RasterPlugin {
+    uint32_t abi;               // RASTER_PLUGIN_ABI
+    const char* name;
+    // Returns the plugin's state, or NULL if it can't run with this config,
+    // having said why on stderr
+    void* (*init)(RasterPluginConfig* config);
+    // Turns one frame of frame_size floats into out_frame_size floats. `in`
+    // and `out` never overlap unless in_place was set, when they may be the
+    // same buffer.
+    void (*process)(void* state, const float* in, float* out);
+    void (*destroy)(void* state);
+} RasterPlugin;
+
+// Host side
+
+#define PLUGIN_MAX_STAGES 8
+
+typedef struct PluginStage {
+    void* handle;               // from dlopen()
+    const RasterPlugin* api;
+    void* state;
+    uint64_t in_size;
+    uint64_t out_size;
+    int in_place;
+} PluginStage;
+
+// Plugins run one after the other on each frame. Frames go through the
+// chain in place wherever the plugins allow it, otherwise they bounce
+// between two work frames allocated once when the chain is loaded, so
+// nothing is allocated or copied per frame beyond what the plugins ask for.
+typedef struct PluginChain {
+    int n;
+    PluginStage stages[PLUGIN_MAX_STAGES];
+    uint64_t in_size;           // floats per frame into the first plugin
+    uint64_t out_size;          // and out of the last
+    float* work[2];             // each as big as the biggest frame in the chain
+} PluginChain;
+
+// Loads "<path>[,<args>]" specs in order, each plugin taking the frames the
+// one before it makes, and inits them. Says what went wrong on stderr and
+// returns -1 if any of them can't be loaded, 0 on success.
+int load_plugin_chain(PluginChain* chain, const char* const* specs, int nspecs,
+        uint64_t frame_size, double sample_rate, int spectrum);
+// Destroys the plugins and unloads them
+void close_plugin_chain(PluginChain* chain);
+
+// Runs a frame of in_size floats through the chain into `out`, which holds
+// out_size. `in` may be overwritten and may be `out` itself.
+void run_plugin_chain(PluginChain* chain, float* in, float* out);
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "datatype.h"
+#include "fft.h"
+
+typedef enum {
+    WINDOW_RECT,
+    WINDOW_HANN,
+    WINDOW_BLACKMAN_HARRIS,
+    WINDOW_FLAT_TOP,
+} WindowType;
+
+typedef struct PsdOptions {
+    uint64_t nfft;
+    WindowType window;
+    float overlap;   // fraction of nfft shared by consecutive segments, [0, 1)
+    uint64_t navg;   // Welch segments averaged into each output frame
+    float alpha;     // exponential averaging weight of the newest frame, 1 for none
+    int db;          // 1 for dB output, 0 for linear power
+    int nthreads;    // workers, including the calling thread
+} PsdOptions;
+
+PsdOptions default_psd_options(void);
+// Parses e.g. "4096" or "nfft=4096,window=bh,overlap=0.5,avg=4,alpha=0.2,lin,threads=4".
+// Returns 0 on success, -1 on a bad spec.
+int parse_psd_options(const char* spec, PsdOptions* opts);
+
+typedef struct Psd Psd;
+
+// Fork/join pool, the calling thread works as worker 0
+typedef struct PsdWorker {
+    Psd* psd;
+    int index;
+    pthread_t thread;
+    float* re; // nfft scratch
+    float* im;
+} PsdWorker;
+
+// Turns a stream of raw samples into power spectrum frames. Every output frame
+// consumes `unit` new samples (navg segments, `hop` apart) and overlaps the
+// previous one by nfft - hop samples of history. Batches of frames are spread
+// across the worker pool, one FFT frame per worker, then the exponential
+// average and dB conversion are spread across bins.
+struct Psd {
+    PsdOptions opts;
+    DataType type;
+    int swapped;       // samples are in the other byte order to the host
+    int complex_input;
+    uint64_t hop;
+    uint64_t unit;
+    uint64_t history;  // samples carried between batches
+    uint64_t nout;     // bins per output frame
+    uint64_t max_batch;
+    Fft fft;
+    float* window;
+    float norm;        // 1 / (navg * sum(window^2))
+    float* samples;    // history then the batch, interleaved if complex
+    float* power;      // max_batch * nout
+    float* avg;        // nout, running exponential average
+    int have_avg;
+
+    // Current job
+    float** outputs;
+    uint64_t batch;
+    int phase;
+
+    PsdWorker* workers;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t generation;
+    int pending;
+    int quit;
+};
+
+// Spawns the workers, `psd` must stay put until stop_psd().
+void start_psd(Psd* psd, const PsdOptions* opts, DataType type, int swapped, uint64_t max_batch);
+void stop_psd(Psd* psd);
+// Forget history and averages, e.g. after a seek
+void reset_psd(Psd* psd);
+
+// Bins per output frame, nfft for complex input or nfft/2 for real input
+uint64_t psd_output_size(const PsdOptions* opts, DataType type);
+// New samples consumed per output frame
+uint64_t psd_input_size(const PsdOptions* opts);
+
+// Converts `nframes` units of raw `type` samples and writes one spectrum to
+// each of outputs[0..nframes).
+void process_psd(Psd* psd, const void* raw, float scale, float offset, uint64_t nframes, float** outputs);
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "datatype.h"
+
+#define RECORD_BUFFER_BYTES (16 << 20)
+
+// Writes a raw sample stream to a DSP_DATA file from a background thread.
+// The producer fills one buffer while the writer thread flushes the other,
+// so disk latency is hidden as long as the disk keeps up on average. If the
+// producer fills its buffer before the writer is done the producer waits,
+// nothing is ever dropped, and the wait is counted in `stalls`.
+//
+// The header goes in last, once the sizes are known, and the CRC is stitched
+// together from the header, data and metadata CRCs so the data never needs
+// reading back.
+typedef struct Recorder {
+    int fd;
+    char path[256];
+    DataType type;
+    double sample_rate;
+
+    // Producer side
+    char* buffers[2];
+    size_t capacity;
+    size_t fill;     // bytes in buffers[active]
+    int active;
+
+    // Hand over to the writer
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int pending;     // buffer waiting to be written, -1 for none
+    size_t pending_nbytes;
+    int quit;
+    pthread_t thread;
+
+    // Writer side
+    uint64_t nbytes_data;
+    uint32_t crc;    // of the data alone
+
+    atomic_uint_fast64_t queued;   // bytes handed to record()
+    atomic_uint_fast64_t written;  // bytes on disk
+    atomic_uint_fast64_t stalls;
+    atomic_int failed;
+} Recorder;
+
+// Creates `path` and spawns the writer, `rec` must stay put until
+// stop_recorder(). Returns 0 on success, -1 (with errno) if the file can't
+// be created.
+int start_recorder(Recorder* rec, const char* path, DataType type, double sample_rate);
+// Flushes what's buffered, writes the header, metadata and CRC and closes.
+void stop_recorder(Recorder* rec);
+
+// Producer side, one thread only
+void record(Recorder* rec, const void* data, size_t nbytes);
+
+// Bytes accepted but not yet written
+uint64_t recorder_backlog(Recorder* rec);
+
+// Finishes off a DSP_DATA file whose `nbytes_data` bytes of samples, with CRC
+// `data_crc`, follow a zeroed header: writes the metadata (plus any
+// `extra_meta` lines) and CRC after them and fills in the header. Returns 0
+// on success, -1 (with errno) on a failed write.
+int finish_dsp_data_file(int fd, DataType type, double sample_rate, uint64_t nbytes_data, uint32_t data_crc, const char* extra_meta);
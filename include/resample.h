@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "datatype.h"
+
+// Rational resampling of the raw input, given as "<down>" or "<up>/<down>"
+// then optionally ",atten=<dB>". -R 100 keeps 1 sample in 100, -R 3/8 goes
+// to 3/8 of the input rate.
+typedef struct ResampleOptions {
+    uint32_t up;
+    uint32_t down;
+    float atten;    // stopband attenuation in dB (default 80)
+} ResampleOptions;
+
+ResampleOptions default_resample_options(void);
+// Returns 0 on success, -1 for a bad spec
+int parse_resample_options(const char* spec, ResampleOptions* opts);
+// Taps in each polyphase branch
+uint32_t resample_taps(const ResampleOptions* opts);
+// Kernel the dot products run on, "scalar", "avx2" or "avx512"
+const char* resample_isa(void);
+
+// Polyphase FIR resampler. The prototype lowpass is a Kaiser windowed sinc
+// at the lower of the input and output Nyquist rates, flat to 80% of it and
+// down by `atten` at it, so nothing aliases into the band that comes out.
+// Only the outputs that are kept get computed, each as one dot product of
+// `ntaps` taps against the input, so the cost per input sample goes as
+// ntaps * up / down however big `down` gets.
+//
+// Works a block of raw samples at a time, each turning into exactly
+// out_samples float samples (interleaved pairs for complex input), carrying
+// the filter's history from one block to the next.
+typedef struct Resampler {
+    ResampleOptions opts;
+    DataType type;
+    int swapped;
+    int nchannels;          // 2 for complex input, filtered as I and Q planes
+    uint64_t in_samples;    // raw samples per block
+    uint64_t out_samples;
+    uint64_t max_blocks;
+    uint32_t ntaps;         // per phase, a multiple of 16
+    float* taps;            // up phases of ntaps, each reversed
+    float* planes[2];       // ntaps - 1 samples of history then a block
+    float* iq;              // 2 * in_samples, a block converted
+    float* out;             // max_blocks * out_samples * nchannels
+} Resampler;
+
+// `out_samples` times down must be a multiple of up. Allocates, up to user
+// to free.
+Resampler new_resampler(const ResampleOptions* opts, DataType type, int swapped, uint64_t out_samples, uint64_t max_blocks);
+void free_resampler(Resampler* r);
+// Forgets the history, e.g. after a seek or a gap
+void reset_resampler(Resampler* r);
+
+// What the output samples are, F32 or Cf32
+DataType resampled_type(DataType type);
+// Converts `nblocks` consecutive blocks of raw samples as in * scale + offset
+// and resamples them into r->out, which is returned
+const float* resample_blocks(Resampler* r, const void* raw, uint64_t nblocks, float scale, float offset);
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define CACHE_LINE_SIZE 64
+
+// Lock-free single-producer/single-consumer ring of fixed size float frames.
+//
+// `head` is only written by the producer and `tail` only by the consumer. Each
+// lives on its own cache line next to a cached copy of the other index, so in
+// steady state neither side touches the other's line unless it thinks the
+// ring is full/empty.
+typedef struct FrameRing {
+    _Alignas(CACHE_LINE_SIZE) atomic_uint_fast64_t head;
+    uint64_t cached_tail;
+    _Alignas(CACHE_LINE_SIZE) atomic_uint_fast64_t tail;
+    uint64_t cached_head;
+    // Set by the producer when it would rather the consumer threw away its
+    // oldest frames than wait for them to be read
+    _Alignas(CACHE_LINE_SIZE) atomic_uint_fast64_t skip;
+    _Alignas(CACHE_LINE_SIZE) uint64_t nslots; // Always a power of 2
+    uint64_t mask;
+    uint64_t frame_size; // floats per frame
+    uint64_t stride;     // floats between slots, keeps slots cache aligned
+    float* frames;
+} FrameRing;
+
+// Allocates frames, up to user to free. `nslots` gets rounded up to a power
+// of 2.
+FrameRing new_frame_ring(uint64_t nslots, uint64_t frame_size);
+void free_frame_ring(FrameRing* ring);
+
+// Producer side
+uint64_t frame_ring_writable(FrameRing* ring);
+float* frame_ring_write_ptr(FrameRing* ring, uint64_t offset);
+void frame_ring_publish(FrameRing* ring, uint64_t nframes);
+// Asks the consumer to drop up to `nframes` of the oldest frames next time
+// it calls frame_ring_skip(). Only the producer's latest request counts.
+void frame_ring_request_skip(FrameRing* ring, uint64_t nframes);
+
+// Consumer side
+uint64_t frame_ring_readable(FrameRing* ring);
+const float* frame_ring_read_ptr(FrameRing* ring, uint64_t offset);
+void frame_ring_consume(FrameRing* ring, uint64_t nframes);
+// Honours a pending skip request before reading, returns the frames dropped
+uint64_t frame_ring_skip(FrameRing* ring);
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "datatype.h"
+
+// Shared memory ring of raw frames between a producer process and any number
+// of viewers, in a POSIX shm object named e.g. "/spectra" (shm://spectra on
+// the viewer's command line). Layout, native byte order:
+//
+//   offset 0    ShmRingHeader, padded to a page
+//   offset 4096 SHM_RING_MAX_READERS ShmReader entries, one page
+//   offset 8192 nslots slots of slot_bytes each, frame i lives in slot
+//               i & (nslots - 1)
+//
+// The producer fills the slot at write_index, then bumps write_index with
+// release ordering, one frame at a time. It never waits for anybody, so
+// readers map the ring read-only and have to keep up. Nothing stops the
+// producer lapping a reader mid-copy either, so readers copy a frame out
+// and then check, seqlock style, that its slot can't have been reused in
+// the meantime (shm_ring_oldest_intact()). `closed` is set once the
+// producer is done.
+//
+// Readers that can open the object read-write also claim an entry in the
+// reader table, by swapping their pid into a zero `pid`, and keep their
+// cursor and drop count there. Only the reader table page is mapped
+// writable. The producer only ever looks at it, to report on readers and
+// free the entries of ones that died.
+#define SHM_RING_MAGIC "RASTSHM1"
+#define SHM_RING_VERSION 2
+#define SHM_RING_PAGE 4096
+#define SHM_RING_MAX_READERS 64
+// Slot counts a ring can be made with. Viewers only read the newest half in
+// place, so one slot would leave them nothing.
+#define SHM_RING_MIN_SLOTS 2
+#define SHM_RING_MAX_SLOTS (1ull << 30)
+// Frames the producer writes past write_index before publishing them
+#define SHM_RING_WRITE_AHEAD 1
+
+typedef struct ShmRingHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_bytes;  // offset of slot 0
+    uint64_t frame_size;    // samples per frame
+    uint64_t data_type;     // a DataType
+    uint64_t nslots;        // always a power of 2
+    uint64_t slot_bytes;    // frame bytes rounded up to a cache line
+    double sample_rate;     // 0 if unknown
+    _Alignas(64) atomic_uint_fast64_t write_index; // frames published so far
+    _Alignas(64) atomic_uint_fast64_t closed;
+    uint32_t readers_offset; // of the reader table
+    uint32_t max_readers;
+} ShmRingHeader;
+
+typedef struct ShmReader {
+    _Alignas(64) atomic_uint_fast64_t pid; // 0 for a free entry
+    atomic_uint_fast64_t cursor;           // next frame the reader will take
+    atomic_uint_fast64_t dropped;          // frames it skipped to keep up
+} ShmReader;
+
+typedef struct ShmRing {
+    int fd;
+    int writable;
+    char name[256];
+    size_t nbytes;          // whole mapping
+    ShmRingHeader* header;
+    char* slots;
+    uint64_t mask;
+    uint64_t frame_bytes;
+    ShmReader* readers;     // the reader table, NULL if it isn't mapped
+    ShmReader* self;        // this reader's entry once registered
+} ShmRing;
+
+// Producer side. Creates (or replaces) the shm object `name` and maps it
+// read-write. `nslots` gets rounded up to a power of 2, and outside
+// SHM_RING_MIN_SLOTS..SHM_RING_MAX_SLOTS fails with EINVAL. Returns 0 on
+// success, -1 with errno set on failure.
+int create_shm_ring(ShmRing* ring, const char* name, uint64_t frame_size, DataType type, uint64_t nslots, double sample_rate);
+// Returns 0 on success, -1 unless `arg` is a slot count create_shm_ring()
+// takes
+int parse_shm_slots(const char* arg, uint64_t* nslots);
+// Slot of frame `index`, for the producer to fill before publishing
+void* shm_ring_slot(ShmRing* ring, uint64_t index);
+// Slot the next frame goes in
+void* shm_ring_next(ShmRing* ring);
+// Readers count on no more than SHM_RING_WRITE_AHEAD frames being written
+// ahead of what's published
+void shm_ring_publish(ShmRing* ring, uint64_t nframes);
+// Marks the ring closed, unmaps it and removes the name
+void destroy_shm_ring(ShmRing* ring);
+// Frees the reader table entries of processes that have gone away, returns
+// the number of readers left
+int reap_shm_readers(ShmRing* ring);
+
+// Viewer side. Maps an existing ring read-only. Returns 0 on success, -1
+// with errno set (EPROTO for something that isn't a ring) on failure.
+int open_shm_ring(ShmRing* ring, const char* name);
+// Claims a reader table entry starting at `cursor`. Returns 0 on success, -1
+// if the table couldn't be mapped writable or is full, in which case the
+// reader still works but the producer can't see it.
+int register_shm_reader(ShmRing* ring, uint64_t cursor);
+// Publishes this reader's progress, a no-op if it isn't registered
+void shm_reader_update(ShmRing* ring, uint64_t cursor, uint64_t dropped);
+const void* shm_ring_frame(const ShmRing* ring, uint64_t index);
+uint64_t shm_ring_write_index(const ShmRing* ring);
+// Oldest frame whose slot the producer can't have started reusing yet. A
+// frame copied out of the ring before this is called is whole if its index
+// is at least this, and may be torn otherwise.
+uint64_t shm_ring_oldest_intact(const ShmRing* ring);
+int shm_ring_closed(const ShmRing* ring);
+// Also gives up the reader table entry
+void close_shm_ring(ShmRing* ring);
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define URING_BLOCK_BYTES (1 << 20)
+#define URING_DEPTH 8
+// O_DIRECT wants offsets, lengths and buffers aligned to the logical block
+// size, a page covers every device worth having
+#define URING_ALIGN 4096
+
+// Sequential reader over io_uring, driven through the raw syscalls so it
+// needs nothing beyond the kernel headers. Keeps up to `depth` reads of
+// `block_bytes` in flight into buffers registered with the kernel, and hands
+// the blocks out in file order however they complete.
+//
+// A file keeps every buffer busy at successive offsets, which is what it
+// takes to get near NVMe bandwidth from one thread, and works with an O_DIRECT
+// descriptor. Reads from a pipe or socket have no offset to keep them in
+// order, so only one of those is in flight at a time, but the next one is
+// already running while the caller works on the last.
+typedef struct UringReader {
+    int ring_fd;
+    int fd;
+    int seekable;
+    int fixed;                  // buffers registered, reads use READ_FIXED
+    uint64_t size;              // of a file, reads stop there
+    size_t block_bytes;
+    unsigned nbuf;
+    char* blocks;               // nbuf * block_bytes, page aligned
+
+    // Rings shared with the kernel
+    void* sq_map;
+    size_t sq_map_bytes;
+    void* cq_map;
+    size_t cq_map_bytes;
+    void* sqes;
+    size_t sqes_bytes;
+    _Atomic unsigned* sq_head;
+    _Atomic unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned* sq_array;
+    _Atomic unsigned* cq_head;
+    _Atomic unsigned* cq_tail;
+    unsigned cq_mask;
+    void* cqes;
+
+    // Block i lives in buffer i % nbuf
+    int32_t* results;           // bytes read, or -errno
+    uint8_t* done;
+    uint64_t submitted;         // blocks asked for since the last seek
+    uint64_t completed;
+    uint64_t delivered;         // next block to hand out
+    unsigned queued;            // reads not yet passed to the kernel
+    int holding;                // the caller has block `delivered`
+    uint64_t base_offset;       // file offset of block 0, aligned
+    size_t lead;                // bytes before the seek target in block 0
+    int ended;                  // a stream hit eof or an error
+} UringReader;
+
+// Returns 1 if this kernel (and build) can do io_uring at all
+int uring_available(void);
+
+// Sets up a ring reading `fd`, from `offset` for a file. Returns 0 on
+// success, -1 with errno set when io_uring can't be used, in which case
+// the caller goes on with read() or mmap().
+int open_uring_reader(UringReader* r, int fd, uint64_t offset, size_t block_bytes, unsigned depth);
+// Restarts a file reader at `offset`, after whatever is in flight lands
+void uring_reader_seek(UringReader* r, uint64_t offset);
+// Waits up to `timeout_ms` (-1 for ever) for the next block and points
+// `data` at it, valid until the next call. Returns its length, 0 at the end,
+// or -1 with errno set, ETIME if it timed out.
+ssize_t uring_reader_next(UringReader* r, const char** data, int timeout_ms);
+void close_uring_reader(UringReader* r);
+
+// Reads `nbytes` of a file at `offset` straight into `dst` with several reads
+// in flight. Returns 0 on success, -1 with errno set, including when
+// io_uring isn't available. Either way nothing is still reading into `dst`
+// by the time it returns.
+int uring_read_all(int fd, void* dst, uint64_t nbytes, uint64_t offset);
+// Sets `r` up as a bare ring for uring_read_into(), for a thread reading many
+// pieces of files to keep rather than making one per read. Returns 0 on
+// success, -1 with errno set when io_uring can't be used. Freed with
+// close_uring_reader().
+int open_uring_batch(UringReader* r);
+// uring_read_all() on a ring from open_uring_batch()
+int uring_read_into(UringReader* r, int fd, void* dst, uint64_t nbytes, uint64_t offset);
@@ -16,11 +16,16 @@ if __name__ == "__main__":
     n = 1024
     if len(sys.argv) >= 2:
         n = int(sys.argv[1])
+    # "iq" writes the raw Cf32 samples instead, for the viewers' -P option
+    raw_iq = len(sys.argv) >= 3 and sys.argv[2] == "iq"
 
     while True:
-        x = psd(noise(n) + tone(0.01, n))
+        if raw_iq:
+            x = (noise(n) + tone(0.01, n)).astype(np.complex64)
+        else:
+            x = np.real(psd(noise(n) + tone(0.01, n))).astype(np.float32)
         try:
-            sys.stdout.buffer.write(np.real(x).astype(np.float32))
+            sys.stdout.buffer.write(x)
             sys.stdout.flush()
         except:
             break
@@ -0,0 +1,126 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "accumulate.h"
+#include "ring.h"
+
+
+RowAccumulator new_row_accumulator(uint64_t width, Reducer reducer)
+{
+    uint64_t floats_per_line = CACHE_LINE_SIZE / sizeof(float);
+    uint64_t padded = (width + floats_per_line - 1) / floats_per_line * floats_per_line;
+    float* acc = (float*)aligned_alloc(CACHE_LINE_SIZE, padded * sizeof(float));
+    if (!acc)
+    {
+        perror("aligned_alloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(acc, 0, padded * sizeof(float));
+
+    RowAccumulator r = {
+        .reducer = reducer,
+        .width = width,
+        .count = 0,
+        .acc = acc,
+    };
+    return r;
+}
+
+void free_row_accumulator(RowAccumulator* r)
+{
+    if (r->acc)
+    {
+        free(r->acc);
+        r->acc = NULL;
+    }
+}
+
+static void add_f32(float* restrict acc, const float* restrict x, uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+    {
+        acc[i] += x[i];
+    }
+}
+
+static void max_f32(float* restrict acc, const float* restrict x, uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+    {
+        acc[i] = x[i] > acc[i] ? x[i] : acc[i];
+    }
+}
+
+static void min_f32(float* restrict acc, const float* restrict x, uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+    {
+        acc[i] = x[i] < acc[i] ? x[i] : acc[i];
+    }
+}
+
+static void scale_f32(float* restrict acc, float k, uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+    {
+        acc[i] *= k;
+    }
+}
+
+void accumulate_row(RowAccumulator* r, const float* frame)
+{
+    if (r->count == 0 || r->reducer == REDUCE_LAST)
+    {
+        // First frame of a row seeds every reducer
+        memcpy(r->acc, frame, r->width * sizeof(float));
+    } else {
+        switch (r->reducer)
+        {
+            case REDUCE_MEAN: add_f32(r->acc, frame, r->width); break;
+            case REDUCE_MAX: max_f32(r->acc, frame, r->width); break;
+            case REDUCE_MIN: min_f32(r->acc, frame, r->width); break;
+            default: break;
+        }
+    }
+    r->count++;
+}
+
+const float* finish_row(RowAccumulator* r)
+{
+    if (r->reducer == REDUCE_MEAN && r->count > 1)
+    {
+        scale_f32(r->acc, 1.0f / r->count, r->width);
+    }
+    r->count = 0;
+    return r->acc;
+}
+
+int parse_reducer(const char* name, Reducer* reducer)
+{
+    if (strncmp(name, "mean", 4) == 0) {
+        *reducer = REDUCE_MEAN;
+    } else if (strncmp(name, "max", 3) == 0) {
+        *reducer = REDUCE_MAX;
+    } else if (strncmp(name, "min", 3) == 0) {
+        *reducer = REDUCE_MIN;
+    } else if (strncmp(name, "last", 4) == 0) {
+        *reducer = REDUCE_LAST;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+const char* reducer_name(Reducer reducer)
+{
+    switch (reducer)
+    {
+        case REDUCE_MEAN: return "mean";
+        case REDUCE_MAX: return "max";
+        case REDUCE_MIN: return "min";
+        case REDUCE_LAST: return "last";
+    }
+    return "unknown";
+}
@@ -0,0 +1,157 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "colorize.h"
+#include "inferno_colormap.h"
+
+// Times turning a row of floats into colors, the old per pixel loop against
+// the quantize and colorize kernels.
+//
+//   bench_colorize [bins] [rows]
+//
+// Defaults to 65536 bins and 2000 rows. RASTER_CONVERT_ISA=scalar|avx2 caps
+// the kernels, to compare them on one machine.
+
+// The color the waterfall used to store, before the LUTs
+typedef struct Rgba {
+    unsigned char r, g, b, a;
+} Rgba;
+
+// xorshift64*, same as gen_noise_shm
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static float uniform(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    uint64_t x = rng_state * 0x2545f4914f6cdd1dull;
+    return ((x >> 40) + 0.5f) * (1.0f / 16777216.0f);
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// What push_line() did per row: widen the limits, then a double divide,
+// a cast and three multiplies into the float colormap for every pixel
+static void old_push_line(const float* line, Rgba* out, int width, float* min_value, float* max_value)
+{
+    for (int x = 0; x < width; x++)
+    {
+        float value = line[x];
+        if (value > *max_value)
+        {
+            *max_value = value;
+        }
+        if (value < *min_value)
+        {
+            *min_value = value;
+        }
+    }
+
+    float* colormap = (float*)inferno_srgb_floats;
+    float range = *max_value - *min_value;
+    for (int x = 0; x < width; x++)
+    {
+        float value = line[x];
+        int idx = (int)(230.0 * ((value - *min_value) / (range + 1e-6)));
+        Rgba c = {
+            255 * colormap[3 * idx],
+            255 * colormap[3 * idx + 1],
+            255 * colormap[3 * idx + 2],
+            255
+        };
+        out[x] = c;
+    }
+}
+
+static void report(const char* name, double seconds, int rows, int width)
+{
+    double per_row = seconds / rows;
+    printf("%-10s %9.2f us/row %8.1f Mpixel/s\n", name, 1e6 * per_row, width / per_row / 1e6);
+}
+
+int main(int argc, char* argv[])
+{
+    int width = argc > 1 ? atoi(argv[1]) : 65536;
+    int rows = argc > 2 ? atoi(argv[2]) : 2000;
+    if (width < 1 || rows < 1)
+    {
+        fprintf(stderr, "usage: %s [bins] [rows]\n", argv[0]);
+        return 1;
+    }
+
+    // A noise floor around -90 dB with a few strong bins, in 16 rows cycled
+    // so the input stays in cache like one row does in the viewer
+    const int nlines = 16;
+    float* lines = (float*)malloc((size_t)nlines * width * sizeof(float));
+    Rgba* old_out = (Rgba*)malloc((size_t)width * sizeof(Rgba));
+    uint8_t* indices = (uint8_t*)malloc(width);
+    uint32_t* colors = (uint32_t*)malloc((size_t)width * sizeof(uint32_t));
+    if (!lines || !old_out || !indices || !colors)
+    {
+        perror("malloc");
+        return 1;
+    }
+    for (int i = 0; i < nlines * width; i++)
+    {
+        lines[i] = -90.0f + 10.0f * log10f(uniform()) + (uniform() < 0.001f ? 60.0f : 0.0f);
+    }
+    uint32_t lut[COLORMAP_SIZE];
+    build_colormap_lut(inferno_srgb_floats, lut);
+    float lo = -130.0f;
+    float hi = -20.0f;
+
+    printf("%d bins, %d rows, kernels %s\n", width, rows, colorize_isa());
+
+    float min_value = INFINITY;
+    float max_value = -INFINITY;
+    double t0 = now_seconds();
+    for (int r = 0; r < rows; r++)
+    {
+        old_push_line(lines + (size_t)(r % nlines) * width, old_out, width, &min_value, &max_value);
+    }
+    report("old loop", now_seconds() - t0, rows, width);
+
+    t0 = now_seconds();
+    for (int r = 0; r < rows; r++)
+    {
+        quantize_row(lines + (size_t)(r % nlines) * width, indices, width, lo, hi);
+    }
+    report("quantize", now_seconds() - t0, rows, width);
+
+    t0 = now_seconds();
+    for (int r = 0; r < rows; r++)
+    {
+        colorize_row(lines + (size_t)(r % nlines) * width, colors, width, lo, hi, lut);
+    }
+    report("colorize", now_seconds() - t0, rows, width);
+
+    // The fused kernel has to agree with quantizing then looking up
+    const float* last = lines + (size_t)((rows - 1) % nlines) * width;
+    quantize_row(last, indices, width, lo, hi);
+    int mismatches = 0;
+    for (int x = 0; x < width; x++)
+    {
+        mismatches += colors[x] != lut[indices[x]];
+    }
+    if (mismatches > 0)
+    {
+        fprintf(stderr, "colorize and quantize disagree on %d of %d bins\n", mismatches, width);
+        return 1;
+    }
+
+    free(lines);
+    free(old_out);
+    free(indices);
+    free(colors);
+    return 0;
+}
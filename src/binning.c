@@ -0,0 +1,451 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "binning.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BINNING_X86 1
+#endif
+
+// Kernels reduce bins [first, first + nbins) to ncols columns, reading the
+// entries of a row `shift` halvings down a pyramid, 0 for the bins
+// themselves. `hi` and `lo` may each be NULL.
+typedef void (*MinMaxKernel)(const float* in, uint64_t first, uint64_t nbins, uint64_t ncols, int shift,
+        float* hi, float* lo);
+typedef void (*MeanKernel)(const float* in, uint64_t first, uint64_t nbins, uint64_t ncols, int shift,
+        float* out);
+
+typedef struct BinningKernels {
+    const char* isa;
+    MinMaxKernel minmax;
+    MeanKernel mean;
+} BinningKernels;
+
+
+// Walks the column edges first + c * nbins / ncols without dividing for
+// each one, which would cost more than reducing a short column
+typedef struct ColumnWalk {
+    uint64_t bin;
+    uint64_t step;
+    uint64_t rem;
+    uint64_t err;
+    uint64_t ncols;
+    int shift;
+} ColumnWalk;
+
+static inline ColumnWalk start_columns(uint64_t first, uint64_t nbins, uint64_t ncols, int shift)
+{
+    ColumnWalk w = { first, nbins / ncols, nbins % ncols, 0, ncols, shift };
+    return w;
+}
+
+// Entries [e0, e1) covering every bin under the next column, never empty
+static inline void next_column(ColumnWalk* w, uint64_t* e0, uint64_t* e1)
+{
+    uint64_t b0 = w->bin;
+    w->bin += w->step;
+    w->err += w->rem;
+    if (w->err >= w->ncols)
+    {
+        w->err -= w->ncols;
+        w->bin++;
+    }
+    uint64_t b1 = w->bin > b0 ? w->bin : b0 + 1;
+    *e0 = b0 >> w->shift;
+    *e1 = ((b1 - 1) >> w->shift) + 1;
+}
+
+// Portable fallback, also used for the tails of the AVX2 kernels. The
+// comparisons are ordered so NaNs lose.
+static inline void minmax_tail(const float* x, uint64_t n, float* mx, float* mn)
+{
+    for (uint64_t i = 0; i < n; i++)
+    {
+        *mx = x[i] > *mx ? x[i] : *mx;
+        *mn = x[i] < *mn ? x[i] : *mn;
+    }
+}
+
+static void minmax_scalar(const float* in, uint64_t first, uint64_t nbins, uint64_t ncols, int shift,
+        float* hi, float* lo)
+{
+    ColumnWalk walk = start_columns(first, nbins, ncols, shift);
+    for (uint64_t c = 0; c < ncols; c++)
+    {
+        uint64_t b0, b1;
+        next_column(&walk, &b0, &b1);
+        float mx = -INFINITY;
+        float mn = INFINITY;
+        minmax_tail(in + b0, b1 - b0, &mx, &mn);
+        if (hi) hi[c] = mx;
+        if (lo) lo[c] = mn;
+    }
+}
+
+static void mean_scalar(const float* in, uint64_t first, uint64_t nbins, uint64_t ncols, int shift,
+        float* out)
+{
+    ColumnWalk walk = start_columns(first, nbins, ncols, shift);
+    for (uint64_t c = 0; c < ncols; c++)
+    {
+        uint64_t b0, b1;
+        next_column(&walk, &b0, &b1);
+        float sum = 0.0f;
+        for (uint64_t i = b0; i < b1; i++)
+        {
+            sum += in[i];
+        }
+        out[c] = sum / (b1 - b0);
+    }
+}
+
+#ifdef BINNING_X86
+
+// maxps and minps hand back their second operand when either is NaN, so
+// with the running value second NaNs never get in
+__attribute__((target("avx2")))
+static void minmax_avx2(const float* in, uint64_t first, uint64_t nbins, uint64_t ncols, int shift,
+        float* hi, float* lo)
+{
+    ColumnWalk walk = start_columns(first, nbins, ncols, shift);
+    for (uint64_t c = 0; c < ncols; c++)
+    {
+        uint64_t b0, b1;
+        next_column(&walk, &b0, &b1);
+        const float* x = in + b0;
+        uint64_t n = b1 - b0;
+        uint64_t i = 0;
+        float mx = -INFINITY;
+        float mn = INFINITY;
+        if (n >= 8)
+        {
+            __m256 vmax = _mm256_set1_ps(-INFINITY);
+            __m256 vmin = _mm256_set1_ps(INFINITY);
+            for (; i + 8 <= n; i += 8)
+            {
+                __m256 v = _mm256_loadu_ps(x + i);
+                vmax = _mm256_max_ps(v, vmax);
+                vmin = _mm256_min_ps(v, vmin);
+            }
+            __m128 h = _mm_max_ps(_mm256_castps256_ps128(vmax), _mm256_extractf128_ps(vmax, 1));
+            h = _mm_max_ps(h, _mm_movehl_ps(h, h));
+            h = _mm_max_ss(h, _mm_movehdup_ps(h));
+            mx = _mm_cvtss_f32(h);
+            __m128 l = _mm_min_ps(_mm256_castps256_ps128(vmin), _mm256_extractf128_ps(vmin, 1));
+            l = _mm_min_ps(l, _mm_movehl_ps(l, l));
+            l = _mm_min_ss(l, _mm_movehdup_ps(l));
+            mn = _mm_cvtss_f32(l);
+        }
+        minmax_tail(x + i, n - i, &mx, &mn);
+        if (hi) hi[c] = mx;
+        if (lo) lo[c] = mn;
+    }
+}
+
+__attribute__((target("avx2")))
+static void mean_avx2(const float* in, uint64_t first, uint64_t nbins, uint64_t ncols, int shift,
+        float* out)
+{
+    ColumnWalk walk = start_columns(first, nbins, ncols, shift);
+    for (uint64_t c = 0; c < ncols; c++)
+    {
+        uint64_t b0, b1;
+        next_column(&walk, &b0, &b1);
+        const float* x = in + b0;
+        uint64_t n = b1 - b0;
+        uint64_t i = 0;
+        float sum = 0.0f;
+        if (n >= 8)
+        {
+            __m256 s = _mm256_setzero_ps();
+            for (; i + 8 <= n; i += 8)
+            {
+                s = _mm256_add_ps(s, _mm256_loadu_ps(x + i));
+            }
+            __m128 h = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+            h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+            h = _mm_add_ss(h, _mm_movehdup_ps(h));
+            sum = _mm_cvtss_f32(h);
+        }
+        for (; i < n; i++)
+        {
+            sum += x[i];
+        }
+        out[c] = sum / n;
+    }
+}
+
+// The ragged end of each column goes through a masked load, lanes past it
+// filled with whatever can't win. Columns of a few entries, as from a
+// pyramid, are quicker done one at a time than reduced across a vector.
+__attribute__((target("avx512f")))
+static void minmax_avx512(const float* in, uint64_t first, uint64_t nbins, uint64_t ncols, int shift,
+        float* hi, float* lo)
+{
+    const __m512 neg = _mm512_set1_ps(-INFINITY);
+    const __m512 pos = _mm512_set1_ps(INFINITY);
+    ColumnWalk walk = start_columns(first, nbins, ncols, shift);
+    for (uint64_t c = 0; c < ncols; c++)
+    {
+        uint64_t b0, b1;
+        next_column(&walk, &b0, &b1);
+        const float* x = in + b0;
+        uint64_t n = b1 - b0;
+        if (n < 8)
+        {
+            float mx = -INFINITY;
+            float mn = INFINITY;
+            minmax_tail(x, n, &mx, &mn);
+            if (hi) hi[c] = mx;
+            if (lo) lo[c] = mn;
+            continue;
+        }
+        uint64_t i = 0;
+        __m512 vmax = neg;
+        __m512 vmin = pos;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m512 v = _mm512_loadu_ps(x + i);
+            vmax = _mm512_max_ps(v, vmax);
+            vmin = _mm512_min_ps(v, vmin);
+        }
+        if (i < n)
+        {
+            __mmask16 m = (__mmask16)((1u << (n - i)) - 1);
+            vmax = _mm512_max_ps(_mm512_mask_loadu_ps(neg, m, x + i), vmax);
+            vmin = _mm512_min_ps(_mm512_mask_loadu_ps(pos, m, x + i), vmin);
+        }
+        if (hi) hi[c] = _mm512_reduce_max_ps(vmax);
+        if (lo) lo[c] = _mm512_reduce_min_ps(vmin);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void mean_avx512(const float* in, uint64_t first, uint64_t nbins, uint64_t ncols, int shift,
+        float* out)
+{
+    ColumnWalk walk = start_columns(first, nbins, ncols, shift);
+    for (uint64_t c = 0; c < ncols; c++)
+    {
+        uint64_t b0, b1;
+        next_column(&walk, &b0, &b1);
+        const float* x = in + b0;
+        uint64_t n = b1 - b0;
+        if (n < 8)
+        {
+            float sum = 0.0f;
+            for (uint64_t i = 0; i < n; i++)
+            {
+                sum += x[i];
+            }
+            out[c] = sum / n;
+            continue;
+        }
+        uint64_t i = 0;
+        __m512 s = _mm512_setzero_ps();
+        for (; i + 16 <= n; i += 16)
+        {
+            s = _mm512_add_ps(s, _mm512_loadu_ps(x + i));
+        }
+        if (i < n)
+        {
+            __mmask16 m = (__mmask16)((1u << (n - i)) - 1);
+            s = _mm512_add_ps(s, _mm512_maskz_loadu_ps(m, x + i));
+        }
+        out[c] = _mm512_reduce_add_ps(s) / n;
+    }
+}
+
+#endif // BINNING_X86
+
+static BinningKernels kernels = { "scalar", minmax_scalar, mean_scalar };
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+// Same choice as the conversion kernels, RASTER_CONVERT_ISA caps both
+static void init_kernels(void)
+{
+#ifdef BINNING_X86
+    const char* cap = getenv("RASTER_CONVERT_ISA");
+    int level = 3;
+    if (cap) {
+        if (strcmp(cap, "scalar") == 0) level = 0;
+        else if (strcmp(cap, "sse2") == 0) level = 1;
+        else if (strcmp(cap, "avx2") == 0) level = 2;
+    }
+
+    __builtin_cpu_init();
+    if (level >= 2 && __builtin_cpu_supports("avx2"))
+    {
+        kernels = (BinningKernels) { "avx2", minmax_avx2, mean_avx2 };
+    }
+    if (level >= 3 && __builtin_cpu_supports("avx512f"))
+    {
+        kernels = (BinningKernels) { "avx512", minmax_avx512, mean_avx512 };
+    }
+#endif
+}
+
+const char* binning_isa(void)
+{
+    pthread_once(&kernels_once, init_kernels);
+    return kernels.isa;
+}
+
+void bin_columns(const float* in, uint64_t nbins, uint64_t ncols, BinMode mode, float* out, float* lo)
+{
+    pthread_once(&kernels_once, init_kernels);
+    switch (mode)
+    {
+        case BIN_MAX: kernels.minmax(in, 0, nbins, ncols, 0, out, NULL); break;
+        case BIN_MIN: kernels.minmax(in, 0, nbins, ncols, 0, NULL, out); break;
+        case BIN_MEAN: kernels.mean(in, 0, nbins, ncols, 0, out); break;
+        case BIN_ENVELOPE: kernels.minmax(in, 0, nbins, ncols, 0, out, lo); break;
+    }
+}
+
+int parse_bin_mode(const char* name, BinMode* mode)
+{
+    if (strcmp(name, "max") == 0) {
+        *mode = BIN_MAX;
+    } else if (strcmp(name, "min") == 0) {
+        *mode = BIN_MIN;
+    } else if (strcmp(name, "mean") == 0) {
+        *mode = BIN_MEAN;
+    } else if (strcmp(name, "envelope") == 0 || strcmp(name, "minmax") == 0) {
+        *mode = BIN_ENVELOPE;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+const char* bin_mode_name(BinMode mode)
+{
+    switch (mode)
+    {
+        case BIN_MAX: return "max";
+        case BIN_MIN: return "min";
+        case BIN_MEAN: return "mean";
+        case BIN_ENVELOPE: return "envelope";
+    }
+    return "unknown";
+}
+
+// Pairs of entries into one, written so the compiler vectorizes them. The
+// selects are ordered so a NaN loses to a number, like the kernels above.
+static void halve_max(const float* restrict in, float* restrict out, uint64_t n)
+{
+    for (uint64_t i = 0; i < n / 2; i++)
+    {
+        float a = in[2 * i];
+        float b = in[2 * i + 1];
+        float m = a > b ? a : b;
+        out[i] = b != b ? a : m;
+    }
+    if (n & 1)
+    {
+        out[n / 2] = in[n - 1];
+    }
+}
+
+static void halve_min(const float* restrict in, float* restrict out, uint64_t n)
+{
+    for (uint64_t i = 0; i < n / 2; i++)
+    {
+        float a = in[2 * i];
+        float b = in[2 * i + 1];
+        float m = a < b ? a : b;
+        out[i] = b != b ? a : m;
+    }
+    if (n & 1)
+    {
+        out[n / 2] = in[n - 1];
+    }
+}
+
+static void halve_mean(const float* restrict in, float* restrict out, uint64_t n)
+{
+    for (uint64_t i = 0; i < n / 2; i++)
+    {
+        out[i] = 0.5f * (in[2 * i] + in[2 * i + 1]);
+    }
+    if (n & 1)
+    {
+        out[n / 2] = in[n - 1];
+    }
+}
+
+BinPyramid new_bin_pyramid(uint64_t width, uint64_t nrows, uint64_t min_width, BinMode mode)
+{
+    BinPyramid p = {
+        .mode = mode == BIN_ENVELOPE ? BIN_MAX : mode,
+        .width = width,
+        .nrows = nrows,
+        .nlevels = 1,
+    };
+    p.widths[0] = width;
+    p.levels[0] = NULL;
+    while (p.nlevels < BIN_PYRAMID_MAX_LEVELS && p.widths[p.nlevels - 1] / 2 >= min_width
+            && p.widths[p.nlevels - 1] > 1)
+    {
+        uint64_t w = (p.widths[p.nlevels - 1] + 1) / 2;
+        float* level = (float*)calloc(w * nrows, sizeof(float));
+        if (!level)
+        {
+            perror("calloc");
+            exit(EXIT_FAILURE);
+        }
+        p.widths[p.nlevels] = w;
+        p.levels[p.nlevels] = level;
+        p.nlevels++;
+    }
+    return p;
+}
+
+void free_bin_pyramid(BinPyramid* p)
+{
+    for (int k = 1; k < p->nlevels; k++)
+    {
+        free(p->levels[k]);
+        p->levels[k] = NULL;
+    }
+    p->nlevels = 1;
+}
+
+void build_pyramid_row(BinPyramid* p, uint64_t r, const float* in)
+{
+    for (int k = 1; k < p->nlevels; k++)
+    {
+        float* out = p->levels[k] + r * p->widths[k];
+        switch (p->mode)
+        {
+            case BIN_MIN: halve_min(in, out, p->widths[k - 1]); break;
+            case BIN_MEAN: halve_mean(in, out, p->widths[k - 1]); break;
+            default: halve_max(in, out, p->widths[k - 1]); break;
+        }
+        in = out;
+    }
+}
+
+void bin_pyramid_row(const BinPyramid* p, uint64_t r, const float* in, uint64_t first, uint64_t nbins,
+        uint64_t ncols, float* out)
+{
+    int k = 0;
+    while (k + 1 < p->nlevels && (nbins >> (k + 1)) >= BIN_PYRAMID_MIN_ENTRIES * ncols)
+    {
+        k++;
+    }
+    const float* row = k == 0 ? in : p->levels[k] + r * p->widths[k];
+    pthread_once(&kernels_once, init_kernels);
+    switch (p->mode)
+    {
+        case BIN_MIN: kernels.minmax(row, first, nbins, ncols, k, NULL, out); break;
+        case BIN_MEAN: kernels.mean(row, first, nbins, ncols, k, out); break;
+        default: kernels.minmax(row, first, nbins, ncols, k, out, NULL); break;
+    }
+}
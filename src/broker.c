@@ -0,0 +1,152 @@
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ingest.h"
+#include "shmring.h"
+
+#define BROKER_IDLE_NS 200000
+#define BROKER_REPORT_SECONDS 5.0
+
+// Ingests one feed, converting and computing spectra once, and publishes the
+// float frames to a shared memory ring that any number of viewers follow with
+// shm://<name>. Takes the same input options as the viewers, plus
+//   -o <name>  Ring to publish to (default "raster")
+//   -k <n>     Slots in the ring (default 1024)
+//
+// The ring never waits on a viewer, each one keeps its own cursor and a slow
+// one only skips its own frames. Every few seconds the broker prints how far
+// behind each registered viewer is.
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int sig)
+{
+    (void)sig;
+    running = 0;
+}
+
+static void sleep_ns(long ns)
+{
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = ns };
+    nanosleep(&ts, NULL);
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static void report(ShmRing* ring, const Ingest* ingest)
+{
+    int nreaders = reap_shm_readers(ring);
+    uint64_t w = shm_ring_write_index(ring);
+    printf("published %lu frames, %lu dropped on the way in, %d viewers\n",
+            (unsigned long)w, (unsigned long)atomic_load(&ingest->stats.dropped), nreaders);
+    for (uint32_t i = 0; i < ring->header->max_readers; i++)
+    {
+        ShmReader* r = &ring->readers[i];
+        uint64_t pid = atomic_load(&r->pid);
+        if (pid == 0) continue;
+        uint64_t cursor = atomic_load(&r->cursor);
+        printf("  pid %lu: %lu behind, %lu dropped\n", (unsigned long)pid,
+                (unsigned long)(w - cursor), (unsigned long)atomic_load(&r->dropped));
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    IngestOptions ingest_opts = default_ingest_options(1024);
+    const char* name = "raster";
+    uint64_t nslots = 1024;
+    int c;
+
+    while ((c = getopt(argc, argv, INGEST_OPTSTRING "o:k:")) != -1)
+    {
+        if (parse_ingest_option(c, optarg, &ingest_opts)) continue;
+        switch (c)
+        {
+            case 'o':
+                name = optarg;
+                break;
+            case 'k':
+                if (parse_shm_slots(optarg, &nslots) != 0)
+                {
+                    fprintf(stderr, "Bad slot count: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (optind < argc)
+    {
+        ingest_opts.input = argv[optind];
+    }
+    resolve_ingest_input(&ingest_opts);
+    print_ingest_options(&ingest_opts);
+    uint64_t frame_size = ingest_frame_size(&ingest_opts);
+    size_t frame_bytes = frame_size * sizeof(float);
+
+    ShmRing ring;
+    // Spectra come at their own rate, the sample rate only means anything
+    // for raw frames
+    double sample_rate = ingest_opts.psd ? 0.0 : ingest_sample_rate(&ingest_opts);
+    if (create_shm_ring(&ring, name, frame_size, F32, nslots, sample_rate) != 0)
+    {
+        perror(name);
+        exit(EXIT_FAILURE);
+    }
+    printf("publishing to  : shm://%s, %lu slots\n", name, (unsigned long)(ring.mask + 1));
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    Ingest ingest;
+    start_source(&ingest, &ingest_opts);
+
+    double last_report = now_seconds();
+    while (running)
+    {
+        uint64_t nready = ingest_ready(&ingest);
+        if (nready == 0)
+        {
+            // eof goes up after the last frame is published, so check again
+            if (atomic_load(&ingest.eof) && ingest_ready(&ingest) == 0) break;
+            sleep_ns(BROKER_IDLE_NS);
+        } else {
+            // Each frame goes out as soon as it's written, since that's as
+            // far ahead as viewers expect the ring's slots to be reused
+            for (uint64_t i = 0; i < nready; i++)
+            {
+                // Torn frames from a shm input are already counted as dropped
+                const float* frame = ingest_frame(&ingest, i);
+                if (!frame) continue;
+                memcpy(shm_ring_next(&ring), frame, frame_bytes);
+                shm_ring_publish(&ring, 1);
+            }
+            ingest_consume(&ingest, nready);
+        }
+
+        if (now_seconds() - last_report >= BROKER_REPORT_SECONDS)
+        {
+            report(&ring, &ingest);
+            last_report = now_seconds();
+        }
+    }
+
+    report(&ring, &ingest);
+    stop_ingest(&ingest);
+    destroy_shm_ring(&ring);
+    return 0;
+}
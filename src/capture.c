@@ -0,0 +1,376 @@
+#define _GNU_SOURCE // MAP_HUGETLB, MAP_POPULATE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "capture.h"
+#include "crc32.h"
+#include "datatype.h"
+#include "filetypes.h"
+#include "record.h"
+
+#define CAPTURE_POLL_MS 20
+#define CAPTURE_IDLE_NS 1000000
+#define CAPTURE_WRITE_BYTES (4 << 20)
+#define HUGE_PAGE_BYTES (2 << 20)
+
+
+CaptureOptions default_capture_options(void)
+{
+    CaptureOptions opts = {
+        .pre_seconds = 1.0,
+        .pre_bytes = 0,
+        .post_seconds = 1.0,
+        .post_bytes = 0,
+        .level_enabled = 0,
+        .level = 0.0f,
+        .fifo = "",
+        .dir = ".",
+    };
+    return opts;
+}
+
+// "2.5s" in seconds, else bytes with an optional k, M or G
+static int parse_length(const char* value, double* seconds, uint64_t* bytes)
+{
+    char* end;
+    double x = strtod(value, &end);
+    if (end == value || x < 0.0) return -1;
+    *seconds = 0.0;
+    *bytes = 0;
+    if (strcmp(end, "s") == 0) {
+        *seconds = x;
+    } else if (*end == '\0') {
+        *bytes = (uint64_t)x;
+    } else if (strcmp(end, "k") == 0 || strcmp(end, "K") == 0) {
+        *bytes = (uint64_t)(x * 1024.0);
+    } else if (strcmp(end, "M") == 0) {
+        *bytes = (uint64_t)(x * 1024.0 * 1024.0);
+    } else if (strcmp(end, "G") == 0) {
+        *bytes = (uint64_t)(x * 1024.0 * 1024.0 * 1024.0);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int parse_capture_options(const char* spec, CaptureOptions* opts)
+{
+    char buffer[768];
+    snprintf(buffer, sizeof(buffer), "%s", spec);
+
+    for (char* tok = strtok(buffer, ","); tok != NULL; tok = strtok(NULL, ","))
+    {
+        char* value = strchr(tok, '=');
+        if (!value) return -1;
+        *value++ = '\0';
+
+        if (strcmp(tok, "pre") == 0) {
+            if (parse_length(value, &opts->pre_seconds, &opts->pre_bytes) != 0) return -1;
+        } else if (strcmp(tok, "post") == 0) {
+            if (parse_length(value, &opts->post_seconds, &opts->post_bytes) != 0) return -1;
+        } else if (strcmp(tok, "level") == 0) {
+            char* end;
+            opts->level = strtof(value, &end);
+            if (end == value || *end != '\0') return -1;
+            opts->level_enabled = 1;
+        } else if (strcmp(tok, "fifo") == 0) {
+            snprintf(opts->fifo, sizeof(opts->fifo), "%s", value);
+        } else if (strcmp(tok, "dir") == 0) {
+            snprintf(opts->dir, sizeof(opts->dir), "%s", value);
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Explicit huge pages if any are reserved, else ask for transparent ones.
+// Populated up front so the producer never takes a page fault on it.
+static char* map_ring(Capture* cap, size_t nbytes)
+{
+    cap->map_bytes = (nbytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE;
+    void* addr = mmap(NULL, cap->map_bytes, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+    cap->huge = addr != MAP_FAILED;
+    if (!cap->huge)
+    {
+        addr = mmap(NULL, cap->map_bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (addr == MAP_FAILED) return NULL;
+        madvise(addr, cap->map_bytes, MADV_HUGEPAGE);
+    }
+    return (char*)addr;
+}
+
+static uint64_t whole_frames(uint64_t nbytes, uint64_t frame_bytes)
+{
+    return (nbytes + frame_bytes - 1) / frame_bytes * frame_bytes;
+}
+
+static int write_all(int fd, const char* data, size_t nbytes)
+{
+    while (nbytes > 0)
+    {
+        ssize_t n = write(fd, data, nbytes);
+        if (n == -1)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        nbytes -= n;
+    }
+    return 0;
+}
+
+// Writes ring positions [start, end) to the file as they become available
+// and finishes it off as a DSP_DATA file
+static void write_capture(Capture* cap, uint64_t at)
+{
+    uint64_t w = atomic_load(&cap->written);
+    uint64_t oldest = w > cap->capacity ? w - cap->capacity : 0;
+    uint64_t start = at > cap->pre_bytes ? at - cap->pre_bytes : 0;
+    if (start < oldest)
+    {
+        // Came too late for some of it, keep to frame boundaries
+        start = at - (at - oldest) / cap->frame_bytes * cap->frame_bytes;
+    }
+    uint64_t end = at + cap->post_bytes;
+
+    char path[512];
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+    snprintf(path, sizeof(path), "%s/trigger-%s-%lu.dsp", cap->dir, stamp,
+            (unsigned long)atomic_load(&cap->captures));
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    uint8_t header[DSP_DATA_HEADER_SIZE] = { 0 };
+    if (fd == -1 || write_all(fd, (const char*)header, sizeof(header)) == -1)
+    {
+        fprintf(stderr, "Can't capture to %s: %s\n", path, strerror(errno));
+        if (fd != -1) close(fd);
+        return;
+    }
+    printf("capturing to %s\n", path);
+
+    uint32_t crc = 0;
+    uint64_t cursor = start;
+    uint64_t overrun = 0;
+    int failed = 0;
+    while (cursor < end && !failed)
+    {
+        w = atomic_load_explicit(&cap->written, memory_order_acquire);
+        if (w == cursor)
+        {
+            // Whatever came in by the time the input stopped is all there is
+            if (atomic_load(&cap->quit)) break;
+            struct timespec ts = { .tv_sec = 0, .tv_nsec = CAPTURE_IDLE_NS };
+            nanosleep(&ts, NULL);
+            continue;
+        }
+        uint64_t n = (w < end ? w : end) - cursor;
+        if (n > CAPTURE_WRITE_BYTES)
+        {
+            n = CAPTURE_WRITE_BYTES;
+        }
+
+        size_t offset = cursor % cap->capacity;
+        size_t first = n < cap->capacity - offset ? n : cap->capacity - offset;
+        crc = crc32_update(crc, cap->ring + offset, first);
+        crc = crc32_update(crc, cap->ring, n - first);
+        failed = write_all(fd, cap->ring + offset, first) == -1
+                || write_all(fd, cap->ring, n - first) == -1;
+
+        // The producer never waits, so check it didn't come round while
+        // these were going out
+        uint64_t after = atomic_load_explicit(&cap->written, memory_order_acquire);
+        if (after > cursor + cap->capacity)
+        {
+            uint64_t lost = after - cap->capacity - cursor;
+            overrun += lost < n ? lost : n;
+        }
+        cursor += n;
+    }
+
+    char extra[64];
+    snprintf(extra, sizeof(extra), "trigger_offset=%lu\n", (unsigned long)(at - start));
+    if (failed || finish_dsp_data_file(fd, cap->type, cap->sample_rate, cursor - start, crc, extra) == -1)
+    {
+        fprintf(stderr, "Capture to %s is incomplete: %s\n", path, strerror(errno));
+    }
+    close(fd);
+    atomic_fetch_add(&cap->overruns, overrun);
+    atomic_fetch_add(&cap->captures, 1);
+    printf("captured %lu bytes to %s, %lu before the trigger\n",
+            (unsigned long)(cursor - start), path, (unsigned long)(at - start));
+    if (overrun > 0)
+    {
+        fprintf(stderr, "Capture fell behind, %lu bytes were overwritten before they were saved\n", (unsigned long)overrun);
+    }
+}
+
+static void* capture_thread(void* arg)
+{
+    Capture* cap = (Capture*)arg;
+    struct pollfd pfd = { .fd = cap->fifo_fd, .events = POLLIN };
+
+    while (!atomic_load(&cap->quit))
+    {
+        if (cap->fifo_fd != -1) {
+            int ret = poll(&pfd, 1, CAPTURE_POLL_MS);
+            if (ret == 1 && (pfd.revents & POLLIN))
+            {
+                char drain[256];
+                while (read(cap->fifo_fd, drain, sizeof(drain)) > 0);
+                trigger_capture(cap);
+            }
+        } else {
+            struct timespec ts = { .tv_sec = 0, .tv_nsec = CAPTURE_POLL_MS * 1000000L };
+            nanosleep(&ts, NULL);
+        }
+
+        uint64_t t = atomic_load(&cap->trigger);
+        if (t == 0) continue;
+        atomic_store(&cap->busy, 1);
+        write_capture(cap, t - 1);
+        atomic_store(&cap->trigger, 0);
+        atomic_store(&cap->busy, 0);
+    }
+    return NULL;
+}
+
+static int open_fifo(Capture* cap, const char* path)
+{
+    if (mkfifo(path, 0644) == -1 && errno != EEXIST) return -1;
+    cap->fifo_fd = open(path, O_RDONLY | O_NONBLOCK);
+    if (cap->fifo_fd == -1) return -1;
+    cap->fifo_keepalive = open(path, O_WRONLY | O_NONBLOCK);
+    if (cap->fifo_keepalive == -1)
+    {
+        int err = errno;
+        close(cap->fifo_fd);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+int start_capture(Capture* cap, const CaptureOptions* opts, DataType type, double sample_rate, uint64_t frame_bytes)
+{
+    double bytes_per_second = sample_rate * datatype_size(type);
+    uint64_t pre = opts->pre_seconds > 0.0 ? (uint64_t)(opts->pre_seconds * bytes_per_second) : opts->pre_bytes;
+    uint64_t post = opts->post_seconds > 0.0 ? (uint64_t)(opts->post_seconds * bytes_per_second) : opts->post_bytes;
+    cap->type = type;
+    cap->sample_rate = sample_rate;
+    cap->frame_bytes = frame_bytes;
+    cap->pre_bytes = whole_frames(pre, frame_bytes);
+    cap->post_bytes = whole_frames(post, frame_bytes);
+    cap->capacity = 2 * cap->pre_bytes;
+    if (cap->capacity < CAPTURE_MIN_RING_BYTES)
+    {
+        cap->capacity = whole_frames(CAPTURE_MIN_RING_BYTES, frame_bytes);
+    }
+    cap->ring = map_ring(cap, cap->capacity);
+    if (!cap->ring) return -1;
+
+    snprintf(cap->dir, sizeof(cap->dir), "%s", opts->dir);
+    cap->fifo_fd = -1;
+    cap->fifo_keepalive = -1;
+    if (opts->fifo[0] != '\0' && open_fifo(cap, opts->fifo) == -1)
+    {
+        int err = errno;
+        munmap(cap->ring, cap->map_bytes);
+        errno = err;
+        return -1;
+    }
+    cap->level_enabled = opts->level_enabled;
+    cap->level = opts->level;
+    cap->armed = 0;
+    atomic_init(&cap->written, 0);
+    atomic_init(&cap->trigger, 0);
+    atomic_init(&cap->captures, 0);
+    atomic_init(&cap->overruns, 0);
+    atomic_init(&cap->busy, 0);
+    atomic_init(&cap->quit, 0);
+
+    int err = pthread_create(&cap->thread, NULL, capture_thread, cap);
+    if (err != 0)
+    {
+        fprintf(stderr, "pthread_create() failed: %d\n", err);
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
+
+void stop_capture(Capture* cap)
+{
+    atomic_store(&cap->quit, 1);
+    pthread_join(cap->thread, NULL);
+    if (cap->fifo_fd != -1)
+    {
+        close(cap->fifo_fd);
+        close(cap->fifo_keepalive);
+    }
+    munmap(cap->ring, cap->map_bytes);
+    cap->ring = NULL;
+}
+
+void capture_frames(Capture* cap, const void* data, size_t nbytes)
+{
+    const char* p = (const char*)data;
+    uint64_t w = atomic_load_explicit(&cap->written, memory_order_relaxed);
+    while (nbytes > 0)
+    {
+        // Keeps each memcpy to the ring's end
+        size_t offset = w % cap->capacity;
+        size_t n = cap->capacity - offset;
+        if (n > nbytes) n = nbytes;
+        memcpy(cap->ring + offset, p, n);
+        p += n;
+        nbytes -= n;
+        w += n;
+    }
+    atomic_store_explicit(&cap->written, w, memory_order_release);
+}
+
+uint64_t capture_position(const Capture* cap)
+{
+    return atomic_load_explicit(&cap->written, memory_order_relaxed);
+}
+
+void capture_check_level(Capture* cap, const float* frame, uint64_t n, uint64_t at)
+{
+    if (!cap->level_enabled) return;
+    float peak = frame[0];
+    for (uint64_t i = 1; i < n; i++)
+    {
+        peak = frame[i] > peak ? frame[i] : peak;
+    }
+    if (peak < cap->level)
+    {
+        cap->armed = 1;
+    } else if (cap->armed) {
+        cap->armed = 0;
+        uint64_t none = 0;
+        atomic_compare_exchange_strong(&cap->trigger, &none, at + 1);
+    }
+}
+
+void trigger_capture(Capture* cap)
+{
+    uint64_t none = 0;
+    atomic_compare_exchange_strong(&cap->trigger, &none, capture_position(cap) + 1);
+}
@@ -0,0 +1,374 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "colorize.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COLORIZE_X86 1
+#endif
+
+#define QUANTIZE_MAX_THREADS 8
+// Below this many values waking the pool costs more than it saves
+#define QUANTIZE_MIN_PARALLEL (1 << 16)
+
+// Every kernel takes index = clamp((x - lo) * scale, 0, 255), truncated, with
+// scale = 256 / (hi - lo). The clamps are ordered so a NaN comes out as 0.
+typedef void (*QuantizeKernel)(const float* in, uint8_t* out, uint64_t n, float lo, float scale);
+typedef void (*ColorizeKernel)(const float* in, uint32_t* out, uint64_t n, float lo, float scale, const uint32_t* lut);
+
+
+void build_colormap_lut(float (*table)[3], uint32_t lut[COLORMAP_SIZE])
+{
+    for (int i = 0; i < COLORMAP_SIZE; i++)
+    {
+        uint8_t* rgba = (uint8_t*)&lut[i];
+        for (int c = 0; c < 3; c++)
+        {
+            float v = table[i][c];
+            v = v > 0.0f ? v : 0.0f;
+            v = v < 1.0f ? v : 1.0f;
+            rgba[c] = (uint8_t)(255.0f * v + 0.5f);
+        }
+        rgba[3] = 255;
+    }
+}
+
+static inline int32_t quantize_one(float x, float lo, float scale)
+{
+    float t = (x - lo) * scale;
+    t = t > 0.0f ? t : 0.0f;
+    t = t < (float)(COLORMAP_SIZE - 1) ? t : (float)(COLORMAP_SIZE - 1);
+    return (int32_t)t;
+}
+
+// Portable fallback, also used for the tails of the SIMD kernels
+static void quantize_scalar(const float* restrict in, uint8_t* restrict out, uint64_t n, float lo, float scale)
+{
+    for (uint64_t i = 0; i < n; i++)
+    {
+        out[i] = (uint8_t)quantize_one(in[i], lo, scale);
+    }
+}
+
+static void colorize_scalar(const float* restrict in, uint32_t* restrict out, uint64_t n,
+        float lo, float scale, const uint32_t* restrict lut)
+{
+    for (uint64_t i = 0; i < n; i++)
+    {
+        out[i] = lut[quantize_one(in[i], lo, scale)];
+    }
+}
+
+#ifdef COLORIZE_X86
+
+// maxps hands back its second operand when either is NaN, so NaNs become 0
+__attribute__((target("avx2")))
+static inline __m256i quantize8_avx2(const float* in, __m256 lo, __m256 scale, __m256 top)
+{
+    __m256 t = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(in), lo), scale);
+    t = _mm256_min_ps(_mm256_max_ps(t, _mm256_setzero_ps()), top);
+    return _mm256_cvttps_epi32(t);
+}
+
+__attribute__((target("avx2")))
+static void quantize_avx2(const float* in, uint8_t* out, uint64_t n, float lo, float scale)
+{
+    const __m256 vlo = _mm256_set1_ps(lo);
+    const __m256 k = _mm256_set1_ps(scale);
+    const __m256 top = _mm256_set1_ps(COLORMAP_SIZE - 1);
+    // The packs work within 128 bit lanes, leaving the 4 byte groups in
+    // lane order, which the permute puts back
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    uint64_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i a = quantize8_avx2(in + i, vlo, k, top);
+        __m256i b = quantize8_avx2(in + i + 8, vlo, k, top);
+        __m256i c = quantize8_avx2(in + i + 16, vlo, k, top);
+        __m256i d = quantize8_avx2(in + i + 24, vlo, k, top);
+        __m256i bytes = _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_permutevar8x32_epi32(bytes, order));
+    }
+    quantize_scalar(in + i, out + i, n - i, lo, scale);
+}
+
+__attribute__((target("avx2")))
+static void colorize_avx2(const float* in, uint32_t* out, uint64_t n, float lo, float scale, const uint32_t* lut)
+{
+    const __m256 vlo = _mm256_set1_ps(lo);
+    const __m256 k = _mm256_set1_ps(scale);
+    const __m256 top = _mm256_set1_ps(COLORMAP_SIZE - 1);
+    const int* table = (const int*)lut;
+    uint64_t i = 0;
+    // The 1 KB table stays in L1, two gathers in flight
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i a = quantize8_avx2(in + i, vlo, k, top);
+        __m256i b = quantize8_avx2(in + i + 8, vlo, k, top);
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_i32gather_epi32(table, a, 4));
+        _mm256_storeu_si256((__m256i*)(out + i + 8), _mm256_i32gather_epi32(table, b, 4));
+    }
+    colorize_scalar(in + i, out + i, n - i, lo, scale, lut);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i quantize16_avx512(const float* in, __m512 lo, __m512 scale, __m512 top)
+{
+    __m512 t = _mm512_mul_ps(_mm512_sub_ps(_mm512_loadu_ps(in), lo), scale);
+    t = _mm512_min_ps(_mm512_max_ps(t, _mm512_setzero_ps()), top);
+    return _mm512_cvttps_epi32(t);
+}
+
+__attribute__((target("avx512f")))
+static void quantize_avx512(const float* in, uint8_t* out, uint64_t n, float lo, float scale)
+{
+    const __m512 vlo = _mm512_set1_ps(lo);
+    const __m512 k = _mm512_set1_ps(scale);
+    const __m512 top = _mm512_set1_ps(COLORMAP_SIZE - 1);
+    uint64_t i = 0;
+    for (; i + 64 <= n; i += 64)
+    {
+        __m512i a = quantize16_avx512(in + i, vlo, k, top);
+        __m512i b = quantize16_avx512(in + i + 16, vlo, k, top);
+        __m512i c = quantize16_avx512(in + i + 32, vlo, k, top);
+        __m512i d = quantize16_avx512(in + i + 48, vlo, k, top);
+        _mm_storeu_si128((__m128i*)(out + i), _mm512_cvtepi32_epi8(a));
+        _mm_storeu_si128((__m128i*)(out + i + 16), _mm512_cvtepi32_epi8(b));
+        _mm_storeu_si128((__m128i*)(out + i + 32), _mm512_cvtepi32_epi8(c));
+        _mm_storeu_si128((__m128i*)(out + i + 48), _mm512_cvtepi32_epi8(d));
+    }
+    quantize_scalar(in + i, out + i, n - i, lo, scale);
+}
+
+__attribute__((target("avx512f")))
+static void colorize_avx512(const float* in, uint32_t* out, uint64_t n, float lo, float scale, const uint32_t* lut)
+{
+    const __m512 vlo = _mm512_set1_ps(lo);
+    const __m512 k = _mm512_set1_ps(scale);
+    const __m512 top = _mm512_set1_ps(COLORMAP_SIZE - 1);
+    uint64_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m512i a = quantize16_avx512(in + i, vlo, k, top);
+        __m512i b = quantize16_avx512(in + i + 16, vlo, k, top);
+        _mm512_storeu_si512(out + i, _mm512_i32gather_epi32(a, lut, 4));
+        _mm512_storeu_si512(out + i + 16, _mm512_i32gather_epi32(b, lut, 4));
+    }
+    colorize_scalar(in + i, out + i, n - i, lo, scale, lut);
+}
+
+#endif // COLORIZE_X86
+
+static QuantizeKernel quantize_kernel = quantize_scalar;
+static ColorizeKernel colorize_kernel = colorize_scalar;
+static const char* kernel_isa = "scalar";
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+// Same choice as the conversion kernels, RASTER_CONVERT_ISA caps both
+static void init_kernels(void)
+{
+#ifdef COLORIZE_X86
+    const char* cap = getenv("RASTER_CONVERT_ISA");
+    int level = 3;
+    if (cap) {
+        if (strcmp(cap, "scalar") == 0) level = 0;
+        else if (strcmp(cap, "sse2") == 0) level = 1;
+        else if (strcmp(cap, "avx2") == 0) level = 2;
+    }
+
+    __builtin_cpu_init();
+    if (level >= 2 && __builtin_cpu_supports("avx2"))
+    {
+        quantize_kernel = quantize_avx2;
+        colorize_kernel = colorize_avx2;
+        kernel_isa = "avx2";
+    }
+    if (level >= 3 && __builtin_cpu_supports("avx512f"))
+    {
+        quantize_kernel = quantize_avx512;
+        colorize_kernel = colorize_avx512;
+        kernel_isa = "avx512";
+    }
+#endif
+}
+
+const char* colorize_isa(void)
+{
+    pthread_once(&kernels_once, init_kernels);
+    return kernel_isa;
+}
+
+void quantize_row(const float* in, uint8_t* out, uint64_t n, float lo, float hi)
+{
+    pthread_once(&kernels_once, init_kernels);
+    quantize_kernel(in, out, n, lo, COLORMAP_SIZE / (hi - lo));
+}
+
+void colorize_row(const float* in, uint32_t* out, uint64_t n, float lo, float hi, const uint32_t* lut)
+{
+    pthread_once(&kernels_once, init_kernels);
+    colorize_kernel(in, out, n, lo, COLORMAP_SIZE / (hi - lo), lut);
+}
+
+// Rows are contiguous, so any run of them is one long row
+static void run_rows(Quantizer* q, uint64_t r0, uint64_t r1)
+{
+    const float* in = q->in + r0 * q->width;
+    uint64_t n = (r1 - r0) * q->width;
+    if (q->lut) {
+        colorize_row(in, (uint32_t*)q->out + r0 * q->width, n, q->lo, q->hi, q->lut);
+    } else {
+        quantize_row(in, (uint8_t*)q->out + r0 * q->width, n, q->lo, q->hi);
+    }
+}
+
+static void run_share(Quantizer* q, int index)
+{
+    uint64_t chunk = (q->nrows + q->nthreads - 1) / q->nthreads;
+    uint64_t r0 = index * chunk;
+    uint64_t r1 = r0 + chunk < q->nrows ? r0 + chunk : q->nrows;
+    if (r0 < r1)
+    {
+        run_rows(q, r0, r1);
+    }
+}
+
+static void* quantize_worker(void* arg)
+{
+    QuantizeWorker* worker = (QuantizeWorker*)arg;
+    Quantizer* q = worker->q;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&q->lock);
+    while (1)
+    {
+        while (q->generation == seen && !q->quit)
+        {
+            pthread_cond_wait(&q->start, &q->lock);
+        }
+        if (q->quit) break;
+        seen = q->generation;
+        pthread_mutex_unlock(&q->lock);
+
+        run_share(q, worker->index);
+
+        pthread_mutex_lock(&q->lock);
+        if (--q->pending == 0)
+        {
+            pthread_cond_signal(&q->done);
+        }
+    }
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+
+static void dispatch(Quantizer* q, const float* in, void* out, uint64_t nrows, uint64_t width,
+        float lo, float hi, const uint32_t* lut)
+{
+    q->in = in;
+    q->out = out;
+    q->nrows = nrows;
+    q->width = width;
+    q->lo = lo;
+    q->hi = hi;
+    q->lut = lut;
+    if (q->nthreads == 1 || nrows < 2 || nrows * width < QUANTIZE_MIN_PARALLEL)
+    {
+        run_rows(q, 0, nrows);
+        return;
+    }
+
+    pthread_mutex_lock(&q->lock);
+    q->pending = q->nthreads - 1;
+    q->generation++;
+    pthread_cond_broadcast(&q->start);
+    pthread_mutex_unlock(&q->lock);
+
+    run_share(q, 0);
+
+    pthread_mutex_lock(&q->lock);
+    while (q->pending > 0)
+    {
+        pthread_cond_wait(&q->done, &q->lock);
+    }
+    pthread_mutex_unlock(&q->lock);
+}
+
+void quantize_rows(Quantizer* q, const float* in, uint8_t* out, uint64_t nrows, uint64_t width, float lo, float hi)
+{
+    dispatch(q, in, out, nrows, width, lo, hi, NULL);
+}
+
+void colorize_rows(Quantizer* q, const float* in, uint32_t* out, uint64_t nrows, uint64_t width,
+        float lo, float hi, const uint32_t* lut)
+{
+    dispatch(q, in, out, nrows, width, lo, hi, lut);
+}
+
+void start_quantizer(Quantizer* q, int nthreads)
+{
+    if (nthreads < 1)
+    {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = ncpu < 1 ? 1 : (ncpu > QUANTIZE_MAX_THREADS ? QUANTIZE_MAX_THREADS : (int)ncpu);
+    }
+    q->nthreads = nthreads;
+    q->in = NULL;
+    q->out = NULL;
+    q->nrows = 0;
+    q->width = 0;
+    q->lut = NULL;
+
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->start, NULL);
+    pthread_cond_init(&q->done, NULL);
+    q->generation = 0;
+    q->pending = 0;
+    q->quit = 0;
+
+    q->workers = (QuantizeWorker*)calloc(nthreads, sizeof(QuantizeWorker));
+    if (!q->workers)
+    {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < nthreads; i++)
+    {
+        QuantizeWorker* worker = &q->workers[i];
+        worker->q = q;
+        worker->index = i;
+        if (i > 0)
+        {
+            int err = pthread_create(&worker->thread, NULL, quantize_worker, worker);
+            if (err != 0)
+            {
+                fprintf(stderr, "pthread_create() failed: %d\n", err);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+}
+
+void stop_quantizer(Quantizer* q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->quit = 1;
+    pthread_cond_broadcast(&q->start);
+    pthread_mutex_unlock(&q->lock);
+
+    for (int i = 1; i < q->nthreads; i++)
+    {
+        pthread_join(q->workers[i].thread, NULL);
+    }
+    free(q->workers);
+    q->workers = NULL;
+
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->start);
+    pthread_cond_destroy(&q->done);
+}
@@ -1,10 +1,22 @@
 #include <complex.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "raylib.h"
 #include "common.h"
+#include "convert.h"
+#include "ingest.h"
+#include "uring.h"
+
+#define LOAD_CHUNK_BYTES (4 << 20)
+#define LOAD_MAX_THREADS 8
 
 
 float min(float x, float y)
@@ -127,6 +139,14 @@ void free_byte_vec(ByteVec* bvec)
     }
 }
 
+// Reads all `nbytes` of an open file into `buffer`, through io_uring with
+// several reads in flight when the kernel has it, else with fread()
+static size_t read_whole_file(FILE* fid, void* buffer, size_t nbytes)
+{
+    if (uring_read_all(fileno(fid), buffer, nbytes, 0) == 0) return nbytes;
+    return fread(buffer, 1, nbytes, fid);
+}
+
 ByteVec load_file(const char* filename)
 {
     FILE* fid = fopen(filename, "rb");
@@ -147,7 +167,7 @@ ByteVec load_file(const char* filename)
         exit(EXIT_FAILURE);
     }
     char* buffer = (char*)malloc(nbytes);
-    size_t nread = fread(buffer, sizeof(char), nbytes, fid);
+    size_t nread = read_whole_file(fid, buffer, nbytes);
     if (nread != nbytes)
     {
         fprintf(stderr, "fread() failed: %zu\n", nread);
@@ -179,193 +199,405 @@ void free_vec_cf32(VecCf32* v)
     }
 }
 
-void convert_i8_f32(const int8_t* in, float* out, size_t nelements)
+// Shared by the threads of one load
+typedef struct LoadJob {
+    int fd;
+    DataType type;
+    size_t value_bytes;         // per scalar, half a complex sample
+    uint64_t nvalues;
+    float* out;
+    atomic_uint_fast64_t next;  // next chunk to claim
+    atomic_int cancelled;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint64_t done;              // values converted so far, under lock
+    int nrunning;
+    int error;                  // errno of a failed read
+} LoadJob;
+
+// Reads through `ring` if there is one, with pread() if not or if it fails
+static int read_chunk(UringReader* ring, int fd, void* dst, size_t nbytes, uint64_t offset)
 {
-    for (size_t i = 0; i < nelements; i++)
+    if (ring && uring_read_into(ring, fd, dst, nbytes, offset) == 0) return 0;
+    size_t got = 0;
+    while (got < nbytes)
     {
-        out[i] = (float)in[i];
+        ssize_t n = pread(fd, (char*)dst + got, nbytes - got, offset + got);
+        if (n == -1)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0)
+        {
+            errno = EIO;
+            return -1;
+        }
+        got += n;
     }
+    return 0;
 }
 
-void convert_i16_f32(const int16_t* in, float* out, size_t nelements)
+// Claims chunks until there are none left, reading each into a buffer of
+// its own and converting it into place. Floats are read straight into place.
+static void* load_worker(void* arg)
 {
-    for (size_t i = 0; i < nelements; i++)
+    LoadJob* job = (LoadJob*)arg;
+    uint64_t chunk_values = LOAD_CHUNK_BYTES / job->value_bytes;
+    void* raw = NULL;
+    if (job->type != F32 && job->type != Cf32)
     {
-        out[i] = (float)in[i];
+        raw = malloc(LOAD_CHUNK_BYTES);
+        if (!raw)
+        {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
     }
-}
 
-void convert_i32_f32(const int32_t* in, float* out, size_t nelements)
-{
-    for (size_t i = 0; i < nelements; i++)
+    // One ring for every chunk this thread reads
+    UringReader ring;
+    int have_ring = open_uring_batch(&ring) == 0;
+
+    int err = 0;
+    while (!atomic_load(&job->cancelled))
     {
-        out[i] = (float)in[i];
+        uint64_t first = atomic_fetch_add(&job->next, 1) * chunk_values;
+        if (first >= job->nvalues) break;
+        uint64_t n = job->nvalues - first < chunk_values ? job->nvalues - first : chunk_values;
+        void* dst = raw ? raw : (void*)(job->out + first);
+        if (read_chunk(have_ring ? &ring : NULL, job->fd, dst, n * job->value_bytes, first * job->value_bytes) != 0)
+        {
+            err = errno;
+            atomic_store(&job->cancelled, 1);
+            break;
+        }
+        if (raw)
+        {
+            convert_to_f32(job->type, raw, job->out + first, n, 1.0f, 0.0f);
+        }
+        pthread_mutex_lock(&job->lock);
+        job->done += n;
+        pthread_cond_signal(&job->cond);
+        pthread_mutex_unlock(&job->lock);
     }
-}
 
-void convert_i64_f32(const int64_t* in, float* out, size_t nelements)
-{
-    for (size_t i = 0; i < nelements; i++)
+    if (have_ring)
     {
-        out[i] = (float)in[i];
+        close_uring_reader(&ring);
     }
-}
-
-void convert_f64_f32(const double* in, float* out, size_t nelements)
-{
-    for (size_t i = 0; i < nelements; i++)
+    free(raw);
+    pthread_mutex_lock(&job->lock);
+    if (err && !job->error)
     {
-        out[i] = (float)in[i];
+        job->error = err;
     }
+    job->nrunning--;
+    pthread_cond_signal(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
 }
 
-VecF32 load_file_real(const char* filename, DataType type)
+// Loads a whole file of `type` samples as floats, complex ones interleaved.
+// Only the floats and one chunk of raw samples per thread are ever held, and
+// `progress` is called on this thread as chunks finish. Returns NULL if it
+// cancelled the load.
+static float* load_floats(const char* filename, DataType type, uint64_t* nsamples, LoadProgress progress, void* user)
 {
-    size_t element_size = 4;
-    switch (type)
-    {
-        case I8: element_size = 1; break;
-        case I16: element_size = 2; break;
-        case I32: element_size = 4; break;
-        case I64: element_size = 8; break;
-        case F32: element_size = 4; break;
-        case F64: element_size = 8; break;
-        default:
-            fprintf(stderr, "DataType not supported");
-            exit(EXIT_FAILURE);
-    }
-
-    FILE* fid = fopen(filename, "rb");
-    if (!fid)
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
     {
-        perror("fopen");
+        perror("open");
         exit(EXIT_FAILURE);
     }
-    if (fseek(fid, 0, SEEK_END) == -1)
+    struct stat st;
+    if (fstat(fd, &st) == -1)
     {
-        perror("fseek");
+        perror("fstat");
         exit(EXIT_FAILURE);
     }
-    size_t nbytes = ftell(fid);
-    size_t nelements = nbytes / element_size;
-    if (fseek(fid, 0, SEEK_SET) == -1)
+
+    int ncomponents = datatype_is_complex(type) ? 2 : 1;
+    *nsamples = (uint64_t)st.st_size / datatype_size(type);
+    LoadJob job = {
+        .fd = fd,
+        .type = type,
+        .value_bytes = datatype_size(type) / ncomponents,
+        .nvalues = *nsamples * ncomponents,
+        .done = 0,
+        .error = 0,
+    };
+    job.out = (float*)malloc((job.nvalues > 0 ? job.nvalues : 1) * sizeof(float));
+    if (!job.out)
     {
-        perror("fseek");
+        perror("malloc");
         exit(EXIT_FAILURE);
     }
-    void* _buffer = malloc(nelements * element_size);
-    size_t nread = fread(_buffer, element_size, nelements, fid);
-    if (nread != nelements)
+    atomic_init(&job.next, 0);
+    atomic_init(&job.cancelled, 0);
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.cond, NULL);
+
+    uint64_t total_bytes = job.nvalues * job.value_bytes;
+    uint64_t nchunks = (total_bytes + LOAD_CHUNK_BYTES - 1) / LOAD_CHUNK_BYTES;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads = ncpu < 1 ? 1 : (ncpu > LOAD_MAX_THREADS ? LOAD_MAX_THREADS : (int)ncpu);
+    if ((uint64_t)nthreads > nchunks)
     {
-        fprintf(stderr, "fread() failed: %zu\n", nread);
-        exit(EXIT_FAILURE);
+        nthreads = (int)nchunks;
     }
-    fclose(fid);
-
-    float* buffer = (float*)malloc(nelements * sizeof(float));
-    switch (type)
-    {
-        case I8: convert_i8_f32((int8_t*)_buffer, buffer, nelements); break;
-        case I16: convert_i16_f32((int16_t*)_buffer, buffer, nelements); break;
-        case I32: convert_i32_f32((int32_t*)_buffer, buffer, nelements); break;
-        case I64: convert_i64_f32((int64_t*)_buffer, buffer, nelements); break;
-        case F32: buffer = (float*)buffer; break;
-        case F64: convert_f64_f32((double*)_buffer, buffer, nelements); break;
-        default:
-            fprintf(stderr, "DataType not supported");
+    pthread_t threads[LOAD_MAX_THREADS];
+    job.nrunning = nthreads;
+    for (int i = 0; i < nthreads; i++)
+    {
+        int err = pthread_create(&threads[i], NULL, load_worker, &job);
+        if (err != 0)
+        {
+            fprintf(stderr, "pthread_create() failed: %d\n", err);
             exit(EXIT_FAILURE);
+        }
     }
 
-    if (type != F32)
+    uint64_t reported = 0;
+    pthread_mutex_lock(&job.lock);
+    while (job.nrunning > 0)
     {
-        free(_buffer);
+        pthread_cond_wait(&job.cond, &job.lock);
+        uint64_t done = job.done;
+        pthread_mutex_unlock(&job.lock);
+        if (progress && done != reported && progress(done * job.value_bytes, total_bytes, user) != 0)
+        {
+            atomic_store(&job.cancelled, 1);
+        }
+        reported = done;
+        pthread_mutex_lock(&job.lock);
     }
+    pthread_mutex_unlock(&job.lock);
+    for (int i = 0; i < nthreads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.cond);
+    close(fd);
 
-    VecF32 v = {
-        .npoints = nelements,
-        .points = buffer,
-    };
-
-    return v;
+    if (job.error)
+    {
+        errno = job.error;
+        perror("read");
+        exit(EXIT_FAILURE);
+    }
+    if (atomic_load(&job.cancelled))
+    {
+        free(job.out);
+        *nsamples = 0;
+        return NULL;
+    }
+    return job.out;
 }
 
-VecCf32 load_file_complex(const char* filename, DataType type)
+VecF32 load_file_real(const char* filename, DataType type, LoadProgress progress, void* user)
 {
-    size_t element_size = 4;
-    switch (type)
-    {
-        case Ci8: element_size = 1; break;
-        case Ci16: element_size = 2; break;
-        case Ci32: element_size = 4; break;
-        case Ci64: element_size = 8; break;
-        case Cf32: element_size = 4; break;
-        case Cf64: element_size = 8; break;
-        default:
-            fprintf(stderr, "DataType not supported");
-            exit(EXIT_FAILURE);
-    }
-
-    FILE* fid = fopen(filename, "rb");
-    if (!fid)
+    if (datatype_is_complex(type))
     {
-        perror("fopen");
+        fprintf(stderr, "DataType not supported");
         exit(EXIT_FAILURE);
     }
-    if (fseek(fid, 0, SEEK_END) == -1)
+    VecF32 v;
+    v.points = load_floats(filename, type, &v.npoints, progress, user);
+    return v;
+}
+
+VecCf32 load_file_complex(const char* filename, DataType type, LoadProgress progress, void* user)
+{
+    if (!datatype_is_complex(type))
     {
-        perror("fseek");
+        fprintf(stderr, "DataType not supported");
         exit(EXIT_FAILURE);
     }
-    size_t nbytes = ftell(fid);
-    size_t nelements = nbytes / (2 * element_size);
-    if (fseek(fid, 0, SEEK_SET) == -1)
+    VecCf32 v;
+    v.points = (float complex*)load_floats(filename, type, &v.npoints, progress, user);
+    return v;
+}
+
+void draw_info_panel(Screen *screen)
+{
+    if (screen->width >= 170 && screen->height >= 56)
     {
-        perror("fseek");
-        exit(EXIT_FAILURE);
+        DrawRectangle(screen->width - 170, 0, 170, 56, Fade(WHITE, 0.7f));
+        DrawText("Space for controls", screen->width - 160, 8, 16, BLACK);
+        DrawFPS(screen->width - 90, 30);
     }
-    void* _buffer = malloc(2 * nelements * element_size);
-    size_t nread = fread(_buffer, element_size, 2 * nelements, fid);
-    if (nread != 2 * nelements)
+}
+
+// Receive counters for socket inputs, sits under the info panel.
+static void draw_socket_info(Ingest* ingest, Screen* screen)
+{
+    IngestStats* stats = &ingest->stats;
+    char text[48];
+    DrawRectangle(screen->width - 170, 56, 170, 34, Fade(WHITE, 0.7f));
+    if (ingest->kind == SOURCE_TCP)
     {
-        fprintf(stderr, "fread() failed: %zu\n", nread);
-        exit(EXIT_FAILURE);
+        // Byte streams don't have packets to count
+        const char* state = !atomic_load(&ingest->connected) ? "tcp waiting for connection"
+            : atomic_load(&ingest->eof) ? "tcp closed" : "tcp connected";
+        DrawText(state, screen->width - 160, 60, 10, BLACK);
+        return;
     }
-    fclose(fid);
+    snprintf(text, 48, "udp %lu pkts %.1f MB",
+            (unsigned long)atomic_load(&stats->packets), atomic_load(&stats->bytes) / 1e6);
+    DrawText(text, screen->width - 160, 60, 10, BLACK);
+    snprintf(text, 48, "lost %lu late %lu ovfl %lu",
+            (unsigned long)(atomic_load(&stats->lost) + atomic_load(&stats->truncated)),
+            (unsigned long)atomic_load(&stats->reordered),
+            (unsigned long)atomic_load(&stats->overflows));
+    DrawText(text, screen->width - 160, 74, 10, BLACK);
+}
 
-    float complex* buffer = (float complex*)malloc(nelements * sizeof(float complex));
-    switch (type)
-    {
-        case Ci8:  convert_i8_f32((int8_t*)_buffer, (float*)buffer, 2 * nelements); break;
-        case Ci16: convert_i16_f32((int16_t*)_buffer, (float*)buffer, 2 * nelements); break;
-        case Ci32: convert_i32_f32((int32_t*)_buffer, (float*)buffer, 2 * nelements); break;
-        case Ci64: convert_i64_f32((int64_t*)_buffer, (float*)buffer, 2 * nelements); break;
-        case Cf32: buffer = (float complex*)buffer; break;
-        case Cf64: convert_f64_f32((double*)_buffer, (float*)buffer, 2 * nelements); break;
-        default:
-            fprintf(stderr, "DataType not supported");
-            exit(EXIT_FAILURE);
+// Progress bar and position for file playback
+static void draw_playback_bar(Ingest* ingest, Screen* screen)
+{
+    uint64_t pos = atomic_load(&ingest->position);
+    uint64_t nframes = ingest->nframes > 0 ? ingest->nframes : 1;
+    double rate = atomic_load(&ingest->frame_rate);
+
+    DrawRectangle(screen->width - 170, 56, 170, 34, Fade(WHITE, 0.7f));
+    char text[40];
+    if (atomic_load(&ingest->paused)) {
+        snprintf(text, 40, "%lu/%lu paused", (unsigned long)pos, (unsigned long)ingest->nframes);
+    } else if (rate > 0.0) {
+        snprintf(text, 40, "%lu/%lu %.0f fps", (unsigned long)pos, (unsigned long)ingest->nframes, rate);
+    } else {
+        snprintf(text, 40, "%lu/%lu max", (unsigned long)pos, (unsigned long)ingest->nframes);
     }
+    DrawText(text, screen->width - 160, 60, 10, BLACK);
+    DrawRectangle(screen->width - 160, 76, 150, 6, Fade(BLACK, 0.3f));
+    DrawRectangle(screen->width - 160, 76, (int)(150.0 * pos / nframes), 6, BLACK);
+}
 
-    if (type != Cf32)
+// Frame counters and how full the ring is, so it's obvious when the viewer
+// can't keep up and what the overload policy is doing about it. Framed
+// streams add how often sync was lost and how many frames never arrived.
+// Returns the height drawn.
+static int draw_frame_stats(Ingest* ingest, Screen* screen, int y)
+{
+    IngestStats* stats = &ingest->stats;
+    uint64_t dropped = atomic_load(&stats->dropped);
+    int framed = ingest->framing.sync_bytes > 0;
+    int height = framed ? 48 : 34;
+    char text[48];
+    DrawRectangle(screen->width - 170, y, 170, height, Fade(dropped > 0 ? ORANGE : WHITE, 0.7f));
+    snprintf(text, 48, "rx %lu shown %lu",
+            (unsigned long)atomic_load(&stats->received), (unsigned long)atomic_load(&stats->displayed));
+    DrawText(text, screen->width - 160, y + 4, 10, BLACK);
+    uint64_t capacity;
+    uint64_t queued = ingest_queued(ingest, &capacity);
+    snprintf(text, 48, "dropped %lu queue %lu/%lu", (unsigned long)dropped,
+            (unsigned long)queued, (unsigned long)capacity);
+    DrawText(text, screen->width - 160, y + 18, 10, BLACK);
+    if (framed)
     {
-        free(_buffer);
+        snprintf(text, 48, "resyncs %lu gaps %lu",
+                (unsigned long)atomic_load(&stats->resyncs), (unsigned long)atomic_load(&stats->gaps));
+        DrawText(text, screen->width - 160, y + 32, 10, BLACK);
     }
+    return height;
+}
 
-    VecCf32 v = {
-        .npoints = nelements,
-        .points = buffer,
-    };
+// Bytes recorded and the writer's backlog, which should hover near zero
+static void draw_record_info(Ingest* ingest, Screen* screen, int y)
+{
+    Recorder* rec = ingest->recorder;
+    char text[48];
+    DrawRectangle(screen->width - 170, y, 170, 20, Fade(RED, 0.7f));
+    snprintf(text, 48, "REC %.1f MB backlog %.1f MB",
+            atomic_load(&rec->queued) / 1e6, recorder_backlog(rec) / 1e6);
+    DrawText(text, screen->width - 160, y + 5, 10, WHITE);
+}
 
-    return v;
+// Playback position or socket counters, frame counters, then the recording
+// status, stacked under the info panel.
+void draw_ingest_info(Ingest* ingest, Screen* screen)
+{
+    if (screen->width < 170 || screen->height < 144) return;
+    int y = 56;
+    if (ingest->kind == SOURCE_UDP || ingest->kind == SOURCE_TCP) {
+        draw_socket_info(ingest, screen);
+        y += 34;
+    } else if (ingest->kind == SOURCE_FILE) {
+        draw_playback_bar(ingest, screen);
+        y += 34;
+    }
+    y += draw_frame_stats(ingest, screen, y);
+    if (ingest->recorder)
+    {
+        draw_record_info(ingest, screen, y);
+    }
 }
 
-void draw_info_panel(Screen *screen)
+// Adds the recording and playback controls to a help screen starting at `y`,
+// returns the next free y.
+int draw_ingest_help(Ingest* ingest, int y)
 {
-    if (screen->width >= 170 && screen->height >= 56)
+    DrawText("r   - Start/Stop recording", 20, y, 14, WHITE);
+    y += 20;
+    if (ingest->capture_enabled)
     {
-        DrawRectangle(screen->width - 170, 0, 170, 56, Fade(WHITE, 0.7f));
-        DrawText("Space for controls", screen->width - 160, 8, 16, BLACK);
-        DrawFPS(screen->width - 90, 30);
+        DrawText("c   - Capture around now", 20, y, 14, WHITE);
+        y += 20;
+    }
+    if (ingest->kind != SOURCE_FILE) return y;
+    DrawText("p   - Pause/Resume", 20, y, 14, WHITE);
+    DrawText("<-/-> - Seek 1%", 20, y + 20, 14, WHITE);
+    DrawText("PgUp/PgDn - Seek 10%", 20, y + 40, 14, WHITE);
+    DrawText("0-9 - Jump to 0-90%", 20, y + 60, 14, WHITE);
+    DrawText("Home/End - Start/End", 20, y + 80, 14, WHITE);
+    DrawText("[/] - Half/Double speed", 20, y + 100, 14, WHITE);
+    return y + 120;
+}
+
+void handle_ingest_keys(Ingest* ingest)
+{
+    if (IsKeyPressed(KEY_R))
+    {
+        toggle_recording(ingest);
+    }
+    if (IsKeyPressed(KEY_C))
+    {
+        trigger_ingest_capture(ingest);
+    }
+    if (ingest->kind != SOURCE_FILE) return;
+
+    int64_t nframes = ingest->nframes;
+    int64_t pos = atomic_load(&ingest->position);
+    int64_t step = nframes / 100 > 0 ? nframes / 100 : 1;
+
+    if (IsKeyPressed(KEY_P)) {
+        toggle_ingest_pause(ingest);
+    } else if (IsKeyPressed(KEY_LEFT)) {
+        seek_ingest(ingest, pos - step);
+    } else if (IsKeyPressed(KEY_RIGHT)) {
+        seek_ingest(ingest, pos + step);
+    } else if (IsKeyPressed(KEY_PAGE_UP)) {
+        seek_ingest(ingest, pos - 10 * step);
+    } else if (IsKeyPressed(KEY_PAGE_DOWN)) {
+        seek_ingest(ingest, pos + 10 * step);
+    } else if (IsKeyPressed(KEY_HOME)) {
+        seek_ingest(ingest, 0);
+    } else if (IsKeyPressed(KEY_END)) {
+        seek_ingest(ingest, nframes);
+    } else if (IsKeyPressed(KEY_LEFT_BRACKET)) {
+        scale_ingest_rate(ingest, 0.5);
+    } else if (IsKeyPressed(KEY_RIGHT_BRACKET)) {
+        scale_ingest_rate(ingest, 2.0);
+    }
+
+    for (int k = KEY_ZERO; k <= KEY_NINE; k++)
+    {
+        if (IsKeyPressed(k))
+        {
+            seek_ingest(ingest, nframes * (k - KEY_ZERO) / 10);
+        }
     }
 }
 
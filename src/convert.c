@@ -0,0 +1,661 @@
+#include <math.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "convert.h"
+#include "datatype.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CONVERT_X86 1
+#endif
+
+// Every kernel computes out[i] = (float)in[i] * scale + offset.
+typedef void (*ConvertKernel)(const void* in, float* out, size_t n, float scale, float offset);
+
+typedef struct ConvertKernels {
+    const char* isa;
+    ConvertKernel u8;
+    ConvertKernel i8;
+    ConvertKernel i16;
+    ConvertKernel i32;
+    ConvertKernel i64;
+    ConvertKernel f32;
+    ConvertKernel f64;
+    // Input in the opposite byte order to the host, single bytes never need it
+    ConvertKernel i16_swap;
+    ConvertKernel i32_swap;
+    ConvertKernel i64_swap;
+    ConvertKernel f32_swap;
+    ConvertKernel f64_swap;
+} ConvertKernels;
+
+
+// Portable fallback, also used for the tails of the SIMD kernels
+#define SCALAR_KERNEL(name, T)                                                \
+    static void name##_scalar(const void* in, float* out, size_t n,           \
+            float scale, float offset)                                        \
+    {                                                                         \
+        const T* x = (const T*)in;                                            \
+        for (size_t i = 0; i < n; i++)                                        \
+        {                                                                     \
+            out[i] = (float)x[i] * scale + offset;                            \
+        }                                                                     \
+    }
+
+SCALAR_KERNEL(u8, uint8_t)
+SCALAR_KERNEL(i8, int8_t)
+SCALAR_KERNEL(i16, int16_t)
+SCALAR_KERNEL(i32, int32_t)
+SCALAR_KERNEL(i64, int64_t)
+SCALAR_KERNEL(f32, float)
+SCALAR_KERNEL(f64, double)
+
+// Swaps each element into a host order integer of the same size, then goes
+// through T to get the bits back as the right type
+#define SWAP_SCALAR_KERNEL(name, T, U, bswap)                                 \
+    static void name##_swap_scalar(const void* in, float* out, size_t n,      \
+            float scale, float offset)                                        \
+    {                                                                         \
+        const U* x = (const U*)in;                                            \
+        for (size_t i = 0; i < n; i++)                                        \
+        {                                                                     \
+            U u = bswap(x[i]);                                                \
+            T v;                                                              \
+            memcpy(&v, &u, sizeof(v));                                        \
+            out[i] = (float)v * scale + offset;                               \
+        }                                                                     \
+    }
+
+SWAP_SCALAR_KERNEL(i16, int16_t, uint16_t, __builtin_bswap16)
+SWAP_SCALAR_KERNEL(i32, int32_t, uint32_t, __builtin_bswap32)
+SWAP_SCALAR_KERNEL(i64, int64_t, uint64_t, __builtin_bswap64)
+SWAP_SCALAR_KERNEL(f32, float, uint32_t, __builtin_bswap32)
+SWAP_SCALAR_KERNEL(f64, double, uint64_t, __builtin_bswap64)
+
+static const ConvertKernels SCALAR_KERNELS = {
+    "scalar", u8_scalar, i8_scalar, i16_scalar, i32_scalar, i64_scalar, f32_scalar, f64_scalar,
+    i16_swap_scalar, i32_swap_scalar, i64_swap_scalar, f32_swap_scalar, f64_swap_scalar,
+};
+
+
+#ifdef CONVERT_X86
+
+// SSE2, always there on x86-64. No sign extension instructions, so widen by
+// unpacking a register with itself and arithmetic shifting back down.
+static inline void store_affine_sse2(float* out, __m128i v, __m128 k, __m128 b)
+{
+    _mm_storeu_ps(out, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(v), k), b));
+}
+
+__attribute__((target("sse2")))
+static void u8_sse2(const void* in, float* out, size_t n, float scale, float offset)
+{
+    const uint8_t* x = (const uint8_t*)in;
+    __m128 k = _mm_set1_ps(scale);
+    __m128 b = _mm_set1_ps(offset);
+    __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(x + i));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        store_affine_sse2(out + i, _mm_unpacklo_epi16(lo, zero), k, b);
+        store_affine_sse2(out + i + 4, _mm_unpackhi_epi16(lo, zero), k, b);
+        store_affine_sse2(out + i + 8, _mm_unpacklo_epi16(hi, zero), k, b);
+        store_affine_sse2(out + i + 12, _mm_unpackhi_epi16(hi, zero), k, b);
+    }
+    u8_scalar(x + i, out + i, n - i, scale, offset);
+}
+
+__attribute__((target("sse2")))
+static void i8_sse2(const void* in, float* out, size_t n, float scale, float offset)
+{
+    const int8_t* x = (const int8_t*)in;
+    __m128 k = _mm_set1_ps(scale);
+    __m128 b = _mm_set1_ps(offset);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(x + i));
+        __m128i lo = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+        __m128i hi = _mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8);
+        store_affine_sse2(out + i, _mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 16), k, b);
+        store_affine_sse2(out + i + 4, _mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 16), k, b);
+        store_affine_sse2(out + i + 8, _mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 16), k, b);
+        store_affine_sse2(out + i + 12, _mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 16), k, b);
+    }
+    i8_scalar(x + i, out + i, n - i, scale, offset);
+}
+
+__attribute__((target("sse2")))
+static void i16_sse2(const void* in, float* out, size_t n, float scale, float offset)
+{
+    const int16_t* x = (const int16_t*)in;
+    __m128 k = _mm_set1_ps(scale);
+    __m128 b = _mm_set1_ps(offset);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(x + i));
+        store_affine_sse2(out + i, _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16), k, b);
+        store_affine_sse2(out + i + 4, _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16), k, b);
+    }
+    i16_scalar(x + i, out + i, n - i, scale, offset);
+}
+
+__attribute__((target("sse2")))
+static void i32_sse2(const void* in, float* out, size_t n, float scale, float offset)
+{
+    const int32_t* x = (const int32_t*)in;
+    __m128 k = _mm_set1_ps(scale);
+    __m128 b = _mm_set1_ps(offset);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        store_affine_sse2(out + i, _mm_loadu_si128((const __m128i*)(x + i)), k, b);
+    }
+    i32_scalar(x + i, out + i, n - i, scale, offset);
+}
+
+__attribute__((target("sse2")))
+static void f32_sse2(const void* in, float* out, size_t n, float scale, float offset)
+{
+    const float* x = (const float*)in;
+    __m128 k = _mm_set1_ps(scale);
+    __m128 b = _mm_set1_ps(offset);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x + i), k), b));
+    }
+    f32_scalar(x + i, out + i, n - i, scale, offset);
+}
+
+__attribute__((target("sse2")))
+static void f64_sse2(const void* in, float* out, size_t n, float scale, float offset)
+{
+    const double* x = (const double*)in;
+    __m128 k = _mm_set1_ps(scale);
+    __m128 b = _mm_set1_ps(offset);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(x + i));
+        __m128 hi = _mm_cvtpd_ps(_mm_loadu_pd(x + i + 2));
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(_mm_movelh_ps(lo, hi), k), b));
+    }
+    f64_scalar(x + i, out + i, n - i, scale, offset);
+}
+
+// AVX2 + FMA. Widening is a single vpmovsx/vpmovzx straight from memory.
+__attribute__((target("avx2,fma")))
+static void u8_avx2(const void* in, float* out, size_t n, float scale, float offset)
+{
+    const uint8_t* x = (const uint8_t*)in;
+    __m256 k = _mm256_set1_ps(scale);
+    __m256 b = _mm256_set1_ps(offset);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i lo = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(x + i)));
+        __m256i hi = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(x + i + 8)));
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(_mm256_cvtepi32_ps(lo), k, b));
+        _mm256_storeu_ps(out + i + 8, _mm256_fmadd_ps(_mm256_cvtepi32_ps(hi), k, b));
+    }
+    u8_scalar(x + i, out + i, n - i, scale, offset);
+}
+
+__attribute__((target("avx2,fma")))
+static void i8_avx2(const void* in, float* out, size_t n, float scale, float offset)
+{
+    const int8_t* x = (const int8_t*)in;
+    __m256 k = _mm256_set1_ps(scale);
+    __m256 b = _mm256_set1_ps(offset);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i lo = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(x + i)));
+        __m256i hi = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(x + i + 8)));
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(_mm256_cvtepi32_ps(lo), k, b));
+        _mm256_storeu_ps(out + i + 8, _mm256_fmadd_ps(_mm256_cvtepi32_ps(hi), k, b));
+    }
+    i8_scalar(x + i, out + i, n - i, scale, offset);
+}
+
+__attribute__((target("avx2,fma")))
+static void i16_avx2(const void* in, float* out, size_t n, float scale, float offset)
+{
+    const int16_t* x = (const int16_t*)in;
+    __m256 k = _mm256_set1_ps(scale);
+    __m256 b = _mm256_set1_ps(offset);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(x + i)));
+        __m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(x + i + 8)));
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(_mm256_cvtepi32_ps(lo), k, b));
+        _mm256_storeu_ps(out + i + 8, _mm256_fmadd_ps(_mm256_cvtepi32_ps(hi), k, b));
+    }
+    i16_scalar(x + i, out + i, n - i, scale, offset);
+}
+
+__attribute__((target("avx2,fma")))
+static void i32_avx2(const void* in, float* out, size_t n, float scale, float offset)
+{
+    const int32_t* x = (const int32_t*)in;
+    __m256 k = _mm256_set1_ps(scale);
+    __m256 b = _mm256_set1_ps(offset);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(x + i));
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(_mm256_cvtepi32_ps(v), k, b));
+    }
+    i32_scalar(x + i, out + i, n - i, scale, offset);
+}
+
+__attribute__((target("avx2,fma")))
+static void f32_avx2(const void* in, float* out, size_t n, float scale, float offset)
+{
+    const float* x = (const float*)in;
+    __m256 k = _mm256_set1_ps(scale);
+    __m256 b = _mm256_set1_ps(offset);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(_mm256_loadu_ps(x + i), k, b));
+    }
+    f32_scalar(x + i, out + i, n - i, scale, offset);
+}
+
+__attribute__((target("avx2,fma")))
+static void f64_avx2(const void* in, float* out, size_t n, float scale, float offset)
+{
+    const double* x = (const double*)in;
+    __m256 k = _mm256_set1_ps(scale);
+    __m256 b = _mm256_set1_ps(offset);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128 lo = _mm256_cvtpd_ps(_mm256_loadu_pd(x + i));
+        __m128 hi = _mm256_cvtpd_ps(_mm256_loadu_pd(x + i + 4));
+        __m256 v = _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(v, k, b));
+    }
+    f64_scalar(x + i, out + i, n - i, scale, offset);
+}
+
+// Byte swapped AVX2 kernels, one vpshufb per load reverses every element in
+// place before the usual widen and convert, so big endian data costs one
+// extra shuffle rather than a separate pass over memory. vpshufb indexes
+// within each 16 byte lane, so the mask repeats one lane's pattern.
+__attribute__((target("avx2")))
+static inline __m256i swap_mask_avx2(int size)
+{
+    char m[32];
+    for (int i = 0; i < 32; i++)
+    {
+        int j = i & 15;
+        m[i] = (char)(j - j % size + size - 1 - j % size);
+    }
+    return _mm256_loadu_si256((const __m256i*)m);
+}
+
+__attribute__((target("avx2,fma")))
+static void i16_swap_avx2(const void* in, float* out, size_t n, float scale, float offset)
+{
+    const int16_t* x = (const int16_t*)in;
+    __m256 k = _mm256_set1_ps(scale);
+    __m256 b = _mm256_set1_ps(offset);
+    __m256i mask = swap_mask_avx2(2);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(x + i)), mask);
+        __m256i lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(v));
+        __m256i hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1));
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(_mm256_cvtepi32_ps(lo), k, b));
+        _mm256_storeu_ps(out + i + 8, _mm256_fmadd_ps(_mm256_cvtepi32_ps(hi), k, b));
+    }
+    i16_swap_scalar(x + i, out + i, n - i, scale, offset);
+}
+
+__attribute__((target("avx2,fma")))
+static void i32_swap_avx2(const void* in, float* out, size_t n, float scale, float offset)
+{
+    const int32_t* x = (const int32_t*)in;
+    __m256 k = _mm256_set1_ps(scale);
+    __m256 b = _mm256_set1_ps(offset);
+    __m256i mask = swap_mask_avx2(4);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(x + i)), mask);
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(_mm256_cvtepi32_ps(v), k, b));
+    }
+    i32_swap_scalar(x + i, out + i, n - i, scale, offset);
+}
+
+__attribute__((target("avx2,fma")))
+static void f32_swap_avx2(const void* in, float* out, size_t n, float scale, float offset)
+{
+    const float* x = (const float*)in;
+    __m256 k = _mm256_set1_ps(scale);
+    __m256 b = _mm256_set1_ps(offset);
+    __m256i mask = swap_mask_avx2(4);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(x + i)), mask);
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(_mm256_castsi256_ps(v), k, b));
+    }
+    f32_swap_scalar(x + i, out + i, n - i, scale, offset);
+}
+
+__attribute__((target("avx2,fma")))
+static void f64_swap_avx2(const void* in, float* out, size_t n, float scale, float offset)
+{
+    const double* x = (const double*)in;
+    __m256 k = _mm256_set1_ps(scale);
+    __m256 b = _mm256_set1_ps(offset);
+    __m256i mask = swap_mask_avx2(8);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i v0 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(x + i)), mask);
+        __m256i v1 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(x + i + 4)), mask);
+        __m128 lo = _mm256_cvtpd_ps(_mm256_castsi256_pd(v0));
+        __m128 hi = _mm256_cvtpd_ps(_mm256_castsi256_pd(v1));
+        __m256 v = _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(v, k, b));
+    }
+    f64_swap_scalar(x + i, out + i, n - i, scale, offset);
+}
+
+// AVX-512, 16 lanes per instruction. I64 needs DQ for vcvtqq2ps, it is the
+// only type that has no packed conversion below AVX-512.
+__attribute__((target("avx512f")))
+static void u8_avx512(const void* in, float* out, size_t n, float scale, float offset)
+{
+    const uint8_t* x = (const uint8_t*)in;
+    __m512 k = _mm512_set1_ps(scale);
+    __m512 b = _mm512_set1_ps(offset);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m512i v = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(x + i)));
+        _mm512_storeu_ps(out + i, _mm512_fmadd_ps(_mm512_cvtepi32_ps(v), k, b));
+    }
+    u8_scalar(x + i, out + i, n - i, scale, offset);
+}
+
+__attribute__((target("avx512f")))
+static void i8_avx512(const void* in, float* out, size_t n, float scale, float offset)
+{
+    const int8_t* x = (const int8_t*)in;
+    __m512 k = _mm512_set1_ps(scale);
+    __m512 b = _mm512_set1_ps(offset);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m512i v = _mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i*)(x + i)));
+        _mm512_storeu_ps(out + i, _mm512_fmadd_ps(_mm512_cvtepi32_ps(v), k, b));
+    }
+    i8_scalar(x + i, out + i, n - i, scale, offset);
+}
+
+__attribute__((target("avx512f")))
+static void i16_avx512(const void* in, float* out, size_t n, float scale, float offset)
+{
+    const int16_t* x = (const int16_t*)in;
+    __m512 k = _mm512_set1_ps(scale);
+    __m512 b = _mm512_set1_ps(offset);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m512i v = _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i*)(x + i)));
+        _mm512_storeu_ps(out + i, _mm512_fmadd_ps(_mm512_cvtepi32_ps(v), k, b));
+    }
+    i16_scalar(x + i, out + i, n - i, scale, offset);
+}
+
+__attribute__((target("avx512f")))
+static void i32_avx512(const void* in, float* out, size_t n, float scale, float offset)
+{
+    const int32_t* x = (const int32_t*)in;
+    __m512 k = _mm512_set1_ps(scale);
+    __m512 b = _mm512_set1_ps(offset);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m512i v = _mm512_loadu_si512((const void*)(x + i));
+        _mm512_storeu_ps(out + i, _mm512_fmadd_ps(_mm512_cvtepi32_ps(v), k, b));
+    }
+    i32_scalar(x + i, out + i, n - i, scale, offset);
+}
+
+__attribute__((target("avx512f,avx512dq,fma")))
+static void i64_avx512(const void* in, float* out, size_t n, float scale, float offset)
+{
+    const int64_t* x = (const int64_t*)in;
+    __m256 k = _mm256_set1_ps(scale);
+    __m256 b = _mm256_set1_ps(offset);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 v = _mm512_cvtepi64_ps(_mm512_loadu_si512((const void*)(x + i)));
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(v, k, b));
+    }
+    i64_scalar(x + i, out + i, n - i, scale, offset);
+}
+
+__attribute__((target("avx512f")))
+static void f32_avx512(const void* in, float* out, size_t n, float scale, float offset)
+{
+    const float* x = (const float*)in;
+    __m512 k = _mm512_set1_ps(scale);
+    __m512 b = _mm512_set1_ps(offset);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        _mm512_storeu_ps(out + i, _mm512_fmadd_ps(_mm512_loadu_ps(x + i), k, b));
+    }
+    f32_scalar(x + i, out + i, n - i, scale, offset);
+}
+
+__attribute__((target("avx512f,fma")))
+static void f64_avx512(const void* in, float* out, size_t n, float scale, float offset)
+{
+    const double* x = (const double*)in;
+    __m256 k = _mm256_set1_ps(scale);
+    __m256 b = _mm256_set1_ps(offset);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 v = _mm512_cvtpd_ps(_mm512_loadu_pd(x + i));
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(v, k, b));
+    }
+    f64_scalar(x + i, out + i, n - i, scale, offset);
+}
+
+#endif // CONVERT_X86
+
+
+static ConvertKernels kernels;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+// Picks the widest kernels the CPU (and OS, for the AVX register state)
+// supports. RASTER_CONVERT_ISA=scalar|sse2|avx2|avx512 caps the choice, which
+// is handy for comparing kernels on one machine.
+static void init_kernels(void)
+{
+    kernels = SCALAR_KERNELS;
+#ifdef CONVERT_X86
+    const char* cap = getenv("RASTER_CONVERT_ISA");
+    int level = 3;
+    if (cap) {
+        if (strcmp(cap, "scalar") == 0) level = 0;
+        else if (strcmp(cap, "sse2") == 0) level = 1;
+        else if (strcmp(cap, "avx2") == 0) level = 2;
+    }
+
+    __builtin_cpu_init();
+    if (level >= 1 && __builtin_cpu_supports("sse2"))
+    {
+        kernels = (ConvertKernels) {
+            "sse2", u8_sse2, i8_sse2, i16_sse2, i32_sse2, i64_scalar, f32_sse2, f64_sse2,
+            i16_swap_scalar, i32_swap_scalar, i64_swap_scalar, f32_swap_scalar, f64_swap_scalar,
+        };
+    }
+    if (level >= 2 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        kernels = (ConvertKernels) {
+            "avx2", u8_avx2, i8_avx2, i16_avx2, i32_avx2, i64_scalar, f32_avx2, f64_avx2,
+            i16_swap_avx2, i32_swap_avx2, i64_swap_scalar, f32_swap_avx2, f64_swap_avx2,
+        };
+    }
+    if (level >= 3 && __builtin_cpu_supports("avx512f"))
+    {
+        kernels.isa = "avx512";
+        kernels.u8 = u8_avx512;
+        kernels.i8 = i8_avx512;
+        kernels.i16 = i16_avx512;
+        kernels.i32 = i32_avx512;
+        kernels.f32 = f32_avx512;
+        kernels.f64 = f64_avx512;
+        if (__builtin_cpu_supports("avx512dq"))
+        {
+            kernels.i64 = i64_avx512;
+        }
+    }
+#endif
+}
+
+static const ConvertKernels* get_kernels(void)
+{
+    pthread_once(&kernels_once, init_kernels);
+    return &kernels;
+}
+
+const char* convert_isa(void)
+{
+    return get_kernels()->isa;
+}
+
+void convert_u8_f32(const uint8_t* in, float* out, size_t nelements)
+{
+    get_kernels()->u8(in, out, nelements, 1.0f, 0.0f);
+}
+
+void convert_i8_f32(const int8_t* in, float* out, size_t nelements)
+{
+    get_kernels()->i8(in, out, nelements, 1.0f, 0.0f);
+}
+
+void convert_i16_f32(const int16_t* in, float* out, size_t nelements)
+{
+    get_kernels()->i16(in, out, nelements, 1.0f, 0.0f);
+}
+
+void convert_i32_f32(const int32_t* in, float* out, size_t nelements)
+{
+    get_kernels()->i32(in, out, nelements, 1.0f, 0.0f);
+}
+
+void convert_i64_f32(const int64_t* in, float* out, size_t nelements)
+{
+    get_kernels()->i64(in, out, nelements, 1.0f, 0.0f);
+}
+
+void convert_f64_f32(const double* in, float* out, size_t nelements)
+{
+    get_kernels()->f64(in, out, nelements, 1.0f, 0.0f);
+}
+
+void convert_to_f32(DataType type, const void* in, float* out, size_t nelements, float scale, float offset)
+{
+    const ConvertKernels* k = get_kernels();
+    switch (type)
+    {
+        case U8: k->u8(in, out, nelements, scale, offset); break;
+        case I8:
+        case Ci8: k->i8(in, out, nelements, scale, offset); break;
+        case I16:
+        case Ci16: k->i16(in, out, nelements, scale, offset); break;
+        case I32:
+        case Ci32: k->i32(in, out, nelements, scale, offset); break;
+        case I64:
+        case Ci64: k->i64(in, out, nelements, scale, offset); break;
+        case F32:
+        case Cf32:
+            if (scale == 1.0f && offset == 0.0f) {
+                memcpy(out, in, nelements * sizeof(float));
+            } else {
+                k->f32(in, out, nelements, scale, offset);
+            }
+            break;
+        case F64:
+        case Cf64: k->f64(in, out, nelements, scale, offset); break;
+    }
+}
+
+void convert_to_f32_swapped(DataType type, const void* in, float* out, size_t nelements, float scale, float offset)
+{
+    const ConvertKernels* k = get_kernels();
+    switch (type)
+    {
+        case I16:
+        case Ci16: k->i16_swap(in, out, nelements, scale, offset); break;
+        case I32:
+        case Ci32: k->i32_swap(in, out, nelements, scale, offset); break;
+        case I64:
+        case Ci64: k->i64_swap(in, out, nelements, scale, offset); break;
+        case F32:
+        case Cf32: k->f32_swap(in, out, nelements, scale, offset); break;
+        case F64:
+        case Cf64: k->f64_swap(in, out, nelements, scale, offset); break;
+        default: convert_to_f32(type, in, out, nelements, scale, offset); break;
+    }
+}
+
+static void magnitude_cf32(const float* restrict iq, float* restrict out, size_t nsamples)
+{
+    for (size_t i = 0; i < nsamples; i++)
+    {
+        float re = iq[2 * i];
+        float im = iq[2 * i + 1];
+        out[i] = sqrtf(re * re + im * im);
+    }
+}
+
+void convert_frame(DataType type, const void* in, float* out, size_t nsamples, float scale, float offset, float* scratch)
+{
+    if (datatype_is_complex(type))
+    {
+        const float* iq = (const float*)in;
+        if (type != Cf32 || scale != 1.0f || offset != 0.0f)
+        {
+            convert_to_f32(type, in, scratch, 2 * nsamples, scale, offset);
+            iq = scratch;
+        }
+        magnitude_cf32(iq, out, nsamples);
+    } else {
+        convert_to_f32(type, in, out, nsamples, scale, offset);
+    }
+}
+
+void convert_frame_swapped(DataType type, const void* in, float* out, size_t nsamples, float scale, float offset, float* scratch)
+{
+    if (datatype_is_complex(type)) {
+        convert_to_f32_swapped(type, in, scratch, 2 * nsamples, scale, offset);
+        magnitude_cf32(scratch, out, nsamples);
+    } else {
+        convert_to_f32_swapped(type, in, out, nsamples, scale, offset);
+    }
+}
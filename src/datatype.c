@@ -0,0 +1,54 @@
+#include <stddef.h>
+#include <strings.h>
+
+#include "datatype.h"
+
+static const char* DATATYPE_NAMES[] = {
+    "U8", "I8", "I16", "I32", "I64", "F32", "F64",
+    "Ci8", "Ci16", "Ci32", "Ci64", "Cf32", "Cf64",
+};
+
+size_t datatype_size(DataType type)
+{
+    switch (type)
+    {
+        case U8: return 1;
+        case I8: return 1;
+        case I16: return 2;
+        case I32: return 4;
+        case I64: return 8;
+        case F32: return 4;
+        case F64: return 8;
+        case Ci8: return 2;
+        case Ci16: return 4;
+        case Ci32: return 8;
+        case Ci64: return 16;
+        case Cf32: return 8;
+        case Cf64: return 16;
+    }
+    return 0;
+}
+
+int datatype_is_complex(DataType type)
+{
+    return type >= Ci8;
+}
+
+int parse_datatype(const char* name, DataType* type)
+{
+    for (int i = U8; i <= Cf64; i++)
+    {
+        if (strcasecmp(name, DATATYPE_NAMES[i]) == 0)
+        {
+            *type = (DataType)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char* datatype_name(DataType type)
+{
+    if (type < U8 || type > Cf64) return "unknown";
+    return DATATYPE_NAMES[type];
+}
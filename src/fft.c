@@ -0,0 +1,114 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fft.h"
+
+
+Fft new_fft(uint64_t n)
+{
+    if (n < 2 || (n & (n - 1)) != 0)
+    {
+        fprintf(stderr, "FFT size must be a power of 2: %lu\n", (unsigned long)n);
+        exit(EXIT_FAILURE);
+    }
+
+    int log2n = 0;
+    while ((1ull << log2n) < n)
+    {
+        log2n++;
+    }
+
+    uint32_t* bitrev = (uint32_t*)malloc(n * sizeof(uint32_t));
+    float* twiddle_re = (float*)malloc(n * sizeof(float));
+    float* twiddle_im = (float*)malloc(n * sizeof(float));
+    if (!bitrev || !twiddle_re || !twiddle_im)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint64_t k = 0; k < n; k++)
+    {
+        uint32_t r = 0;
+        for (int b = 0; b < log2n; b++)
+        {
+            r |= ((k >> b) & 1) << (log2n - 1 - b);
+        }
+        bitrev[k] = r;
+    }
+
+    // Stage of length L uses exp(-2 pi i k / L) for k < L/2, stored
+    // contiguously so the butterfly loop reads them in order.
+    for (uint64_t len = 2; len <= n; len <<= 1)
+    {
+        uint64_t half = len / 2;
+        for (uint64_t k = 0; k < half; k++)
+        {
+            double phase = -2.0 * M_PI * k / len;
+            twiddle_re[half - 1 + k] = cos(phase);
+            twiddle_im[half - 1 + k] = sin(phase);
+        }
+    }
+
+    Fft fft = {
+        .n = n,
+        .bitrev = bitrev,
+        .twiddle_re = twiddle_re,
+        .twiddle_im = twiddle_im,
+    };
+    return fft;
+}
+
+void free_fft(Fft* fft)
+{
+    free(fft->bitrev);
+    free(fft->twiddle_re);
+    free(fft->twiddle_im);
+    fft->bitrev = NULL;
+    fft->twiddle_re = NULL;
+    fft->twiddle_im = NULL;
+}
+
+static void butterflies(float* restrict re0, float* restrict im0,
+        float* restrict re1, float* restrict im1,
+        const float* restrict wr, const float* restrict wi, uint64_t half)
+{
+    for (uint64_t k = 0; k < half; k++)
+    {
+        float tr = wr[k] * re1[k] - wi[k] * im1[k];
+        float ti = wr[k] * im1[k] + wi[k] * re1[k];
+        re1[k] = re0[k] - tr;
+        im1[k] = im0[k] - ti;
+        re0[k] = re0[k] + tr;
+        im0[k] = im0[k] + ti;
+    }
+}
+
+void fft_bitrev_input(const Fft* fft, float* re, float* im)
+{
+    uint64_t n = fft->n;
+
+    // First stage has a twiddle of 1, no multiplies needed
+    for (uint64_t i = 0; i < n; i += 2)
+    {
+        float r = re[i + 1];
+        float m = im[i + 1];
+        re[i + 1] = re[i] - r;
+        im[i + 1] = im[i] - m;
+        re[i] += r;
+        im[i] += m;
+    }
+
+    for (uint64_t len = 4; len <= n; len <<= 1)
+    {
+        uint64_t half = len / 2;
+        const float* wr = fft->twiddle_re + half - 1;
+        const float* wi = fft->twiddle_im + half - 1;
+        for (uint64_t i = 0; i < n; i += len)
+        {
+            butterflies(re + i, im + i, re + i + half, im + i + half, wr, wi, half);
+        }
+    }
+}
@@ -1,13 +1,299 @@
+#include <fcntl.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "crc32.h"
+#include "datatype.h"
+#include "filetypes.h"
 
 typedef struct Buffer {
     uint64_t nbytes;
     char* data;
 } Buffer;
 
+int parse_file_format(const char* name, FileFormat* format)
+{
+    if (strcasecmp(name, "raw") == 0) {
+        *format = FORMAT_RAW;
+    } else if (strcasecmp(name, "dsp") == 0 || strcasecmp(name, "dsp_data") == 0) {
+        *format = FORMAT_DSP_DATA;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static uint64_t load_le64(const uint8_t* p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+    {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+// Fills in the fixed fields of `file` from a DSP_DATA header, returns NULL on
+// success or what's wrong with it.
+static const char* parse_dsp_header(const uint8_t* header, DspDataFile* file)
+{
+    if (memcmp(header, "DSP_DATA", 8) != 0) return "bad magic";
+    uint64_t data_type = load_le64(header + 8);
+    if (data_type > Cf64) return "unknown data type";
+    memcpy(file->magic, header, 8);
+    file->data_type = (char)data_type;
+    file->data_format = (char)load_le64(header + 16);
+    file->nbytes_data = load_le64(header + 24);
+    file->nbytes_meta = load_le64(header + 32);
+    return NULL;
+}
+
+static void store_le64(uint8_t* p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+void format_dsp_data_header(uint8_t* header, DataType type, uint64_t nbytes_data, uint64_t nbytes_meta)
+{
+    memcpy(header, "DSP_DATA", 8);
+    store_le64(header + 8, type);
+    store_le64(header + 16, 0);
+    store_le64(header + 24, nbytes_data);
+    store_le64(header + 32, nbytes_meta);
+}
+
+DspDataParser new_dsp_data_parser(void)
+{
+    DspDataParser parser;
+    memset(&parser, 0, sizeof(parser));
+    parser.state = DSP_PARSE_HEADER;
+    return parser;
+}
+
+void free_dsp_data_parser(DspDataParser* parser)
+{
+    free(parser->file.metadata);
+    parser->file.metadata = NULL;
+}
+
+static size_t min_size(size_t a, uint64_t b)
+{
+    return a < b ? a : (size_t)b;
+}
+
+static void fail_parse(DspDataParser* p, const char* error)
+{
+    p->state = DSP_PARSE_ERROR;
+    p->error = error;
+}
+
+size_t dsp_data_filter(DspDataParser* p, char* buf, size_t n)
+{
+    size_t in = 0;
+    size_t out = 0;
+    while (in < n && p->state != DSP_PARSE_ERROR)
+    {
+        DspDataFile* file = &p->file;
+        size_t avail = n - in;
+        size_t k;
+        switch (p->state)
+        {
+            case DSP_PARSE_HEADER:
+                k = min_size(avail, DSP_DATA_HEADER_SIZE - p->have);
+                memcpy(p->header + p->have, buf + in, k);
+                in += k;
+                p->have += k;
+                if (p->have < DSP_DATA_HEADER_SIZE) break;
+
+                const char* error = parse_dsp_header(p->header, file);
+                if (error)
+                {
+                    fail_parse(p, error);
+                    break;
+                }
+                if (p->typed && (DataType)file->data_type != p->type)
+                {
+                    fail_parse(p, "data type changed between records");
+                    break;
+                }
+                p->typed = 1;
+                p->type = (DataType)file->data_type;
+                free(file->metadata);
+                file->metadata = NULL;
+                if (file->nbytes_meta <= DSP_DATA_MAX_META)
+                {
+                    file->metadata = (char*)malloc(file->nbytes_meta + 1);
+                    if (file->metadata) file->metadata[file->nbytes_meta] = '\0';
+                }
+                p->crc = crc32_update(0, p->header, DSP_DATA_HEADER_SIZE);
+                p->have = 0;
+                p->state = DSP_PARSE_DATA;
+                // Empty sections finish without more input
+                /* fall through */
+            case DSP_PARSE_DATA:
+                // Payload is the bulk of the stream, it only needs moving if a
+                // header came before it in this same chunk
+                k = min_size(n - in, file->nbytes_data - p->have);
+                p->crc = crc32_update(p->crc, buf + in, k);
+                if (out != in)
+                {
+                    memmove(buf + out, buf + in, k);
+                }
+                in += k;
+                out += k;
+                p->have += k;
+                if (p->have < file->nbytes_data) break;
+                p->have = 0;
+                p->state = DSP_PARSE_META;
+                // fall through
+            case DSP_PARSE_META:
+                k = min_size(n - in, file->nbytes_meta - p->have);
+                p->crc = crc32_update(p->crc, buf + in, k);
+                if (file->metadata)
+                {
+                    memcpy(file->metadata + p->have, buf + in, k);
+                }
+                in += k;
+                p->have += k;
+                if (p->have < file->nbytes_meta) break;
+                p->have = 0;
+                p->state = DSP_PARSE_CRC;
+                // fall through
+            case DSP_PARSE_CRC:
+                k = min_size(n - in, 4 - p->have);
+                memcpy(p->crc_bytes + p->have, buf + in, k);
+                in += k;
+                p->have += k;
+                if (p->have < 4) break;
+                file->crc32 = (uint32_t)p->crc_bytes[0] | (uint32_t)p->crc_bytes[1] << 8
+                    | (uint32_t)p->crc_bytes[2] << 16 | (uint32_t)p->crc_bytes[3] << 24;
+                p->records++;
+                if (file->crc32 != p->crc)
+                {
+                    p->crc_errors++;
+                }
+                p->have = 0;
+                p->state = DSP_PARSE_HEADER;
+                break;
+            case DSP_PARSE_ERROR:
+                break;
+        }
+    }
+    return out;
+}
+
+static int host_is_big_endian(void)
+{
+    return __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__;
+}
+
+// Header fields are stored in head_rep order
+static int32_t blue_i32(const uint8_t* p, int swapped)
+{
+    uint32_t u;
+    memcpy(&u, p, sizeof(u));
+    if (swapped) u = __builtin_bswap32(u);
+    int32_t v;
+    memcpy(&v, &u, sizeof(v));
+    return v;
+}
+
+static double blue_f64(const uint8_t* p, int swapped)
+{
+    uint64_t u;
+    memcpy(&u, p, sizeof(u));
+    if (swapped) u = __builtin_bswap64(u);
+    double v;
+    memcpy(&v, &u, sizeof(v));
+    return v;
+}
+
+// Returns 1 if `rep` names the other byte order to the host, 0 if the same
+// and -1 for anything else (VAX).
+static int blue_swapped(const uint8_t* rep)
+{
+    int big;
+    if (memcmp(rep, "IEEE", 4) == 0) {
+        big = 1;
+    } else if (memcmp(rep, "EEEI", 4) == 0) {
+        big = 0;
+    } else {
+        return -1;
+    }
+    return big != host_is_big_endian();
+}
+
+// Maps a BLUE format code to a DataType, returns -1 for the ones the viewers
+// can't take (packed bits, ASCII, vector modes, complex offset bytes)
+static int blue_datatype(const char format[2], DataType* type)
+{
+    static const char ELEMENTS[] = "OBILXFD";
+    static const DataType SCALAR[] = { U8, I8, I16, I32, I64, F32, F64 };
+    static const DataType COMPLEX[] = { U8, Ci8, Ci16, Ci32, Ci64, Cf32, Cf64 };
+    const char* e = format[1] ? strchr(ELEMENTS, format[1]) : NULL;
+    if (!e) return -1;
+    int i = e - ELEMENTS;
+    if (format[0] == 'S') {
+        *type = SCALAR[i];
+    } else if (format[0] == 'C' && format[1] != 'O') {
+        *type = COMPLEX[i];
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Fills in `blue` from a 512 byte header control block, returns NULL on
+// success or what's wrong with it. Offsets are from the Midas HCB layout.
+static const char* parse_blue_header(const uint8_t* h, BlueFile* blue)
+{
+    if (memcmp(h, "BLUE", 4) != 0) return "bad magic";
+    memset(blue, 0, sizeof(*blue));
+    memcpy(blue->magic, h, 4);
+    memcpy(blue->header, h + 4, sizeof(blue->header));
+
+    int head = blue_swapped(h + 4);
+    int data = blue_swapped(h + 8);
+    if (head < 0 || data < 0) return "unsupported byte order";
+    blue->head_swapped = head;
+    blue->data_swapped = data;
+    if (blue_i32(h + 12, head) != 0) return "detached data isn't supported";
+
+    blue->data_start = blue_f64(h + 32, head);
+    blue->data_size = blue_f64(h + 40, head);
+    // Both get cast to byte offsets, which is only defined for these
+    if (!(blue->data_start >= 0.0 && blue->data_start < 0x1p63)) return "bad data start";
+    if (!(blue->data_size >= 0.0 && blue->data_size < 0x1p63)) return "bad data size";
+    blue->type = blue_i32(h + 48, head);
+    memcpy(blue->format, h + 52, 2);
+
+    // Adjunct, type 1000 and 2000 share the x axis
+    int family = blue->type / 1000;
+    if (family != 1 && family != 2) return "only type 1000 and 2000 are supported";
+    blue->xstart = blue_f64(h + 256, head);
+    blue->xdelta = blue_f64(h + 264, head);
+    blue->xunits = blue_i32(h + 272, head);
+    if (family == 2)
+    {
+        blue->subsize = blue_i32(h + 276, head);
+        blue->ystart = blue_f64(h + 280, head);
+        blue->ydelta = blue_f64(h + 288, head);
+        blue->yunits = blue_i32(h + 296, head);
+        if (blue->subsize <= 0) return "bad subsize";
+    }
+    return NULL;
+}
+
 void read_file(const char* filename, char* buffer)
 {
     FILE* fid = fopen(filename, "rb");
@@ -27,16 +313,28 @@ void read_file(const char* filename, char* buffer)
 
     if (strncmp(magic, "BLUE", 4) == 0)
     {
-        // BLUE file
-        if (fseek(fid, 512, SEEK_SET) != 0)
+        // BLUE file, data sits wherever the header says
+        uint8_t header[BLUE_HEADER_SIZE];
+        BlueFile blue;
+        uint64_t start = BLUE_HEADER_SIZE;
+        uint64_t size = nbytes > BLUE_HEADER_SIZE ? nbytes - BLUE_HEADER_SIZE : 0;
+        if (fseek(fid, 0, SEEK_SET) == 0 && fread(header, 1, sizeof(header), fid) == sizeof(header)
+                && parse_blue_header(header, &blue) == NULL)
+        {
+            start = blue.data_start;
+            size = blue.data_size;
+        }
+        if (start > nbytes) start = nbytes;
+        if (size > nbytes - start) size = nbytes - start;
+        if (fseek(fid, start, SEEK_SET) != 0)
         {
             perror("fseek");
             return;
         }
-        fread(buffer, sizeof(char), nbytes - 512, fid);
+        fread(buffer, sizeof(char), size, fid);
     } else if (strncmp(magic, "DSP_DATA", 8) == 0) {
-        // DSP_DATA file
-        if (fseek(fid, 0, SEEK_SET) != 0)
+        // DSP_DATA file, fields follow the magic
+        if (fseek(fid, 8, SEEK_SET) != 0)
         {
             perror("fseek");
             return;
@@ -65,3 +363,153 @@ void read_nbytes(FILE* fid, const uint64_t byte_pos, const uint64_t nbytes, char
     }
     fread(output, sizeof(char), nbytes, fid);
 }
+
+// Works out the payload and type from the first `nhead` bytes of a file of
+// `nbytes`. Anything unrecognized is raw samples end to end.
+static void describe_file(const uint8_t* head, uint64_t nhead, uint64_t nbytes, MappedFile* f)
+{
+    memset(f, 0, sizeof(*f));
+    f->nbytes = nbytes;
+    f->format = FORMAT_RAW;
+    f->data_offset = 0;
+    f->data_nbytes = nbytes;
+
+    if (nhead >= BLUE_HEADER_SIZE && memcmp(head, "BLUE", 4) == 0)
+    {
+        BlueFile* blue = &f->blue;
+        DataType type;
+        const char* error = parse_blue_header(head, blue);
+        if (!error && blue_datatype(blue->format, &type) != 0)
+        {
+            error = "unsupported format code";
+        }
+        if (error)
+        {
+            fprintf(stderr, "Ignoring BLUE header: %s\n", error);
+            return;
+        }
+        uint64_t start = blue->data_start;
+        uint64_t size = blue->data_size;
+        if (start > nbytes) start = nbytes;
+        // Files still being written can have a size of 0 or less than what's
+        // there, play whatever the file holds
+        if (size == 0 || size > nbytes - start) size = nbytes - start;
+
+        f->format = FORMAT_BLUE;
+        f->typed = 1;
+        f->type = type;
+        f->swapped = blue->data_swapped;
+        f->data_offset = start;
+        f->data_nbytes = size;
+        if (blue->type / 1000 == 2) {
+            f->frame_size = blue->subsize;
+            // Frames are ydelta apart
+            if (blue->yunits == 1 && blue->ydelta > 0.0)
+            {
+                f->sample_rate = blue->subsize / blue->ydelta;
+            }
+        } else if (blue->xunits == 1 && blue->xdelta > 0.0) {
+            f->sample_rate = 1.0 / blue->xdelta;
+        }
+        return;
+    }
+
+    DspDataFile dsp;
+    if (nhead >= DSP_DATA_HEADER_SIZE && memcmp(head, "DSP_DATA", 8) == 0)
+    {
+        const char* error = parse_dsp_header(head, &dsp);
+        if (error)
+        {
+            fprintf(stderr, "Ignoring DSP_DATA header: %s\n", error);
+            return;
+        }
+        uint64_t avail = nbytes - DSP_DATA_HEADER_SIZE;
+        f->format = FORMAT_DSP_DATA;
+        f->typed = 1;
+        f->type = (DataType)dsp.data_type;
+        f->data_offset = DSP_DATA_HEADER_SIZE;
+        f->data_nbytes = dsp.nbytes_data < avail ? dsp.nbytes_data : avail;
+        // Truncated files just play what's there, without a CRC to check.
+        // The lengths get checked one at a time so huge ones can't wrap.
+        f->has_crc = dsp.nbytes_data <= avail && dsp.nbytes_meta <= avail - dsp.nbytes_data
+            && avail - dsp.nbytes_data - dsp.nbytes_meta >= 4;
+        if (f->has_crc)
+        {
+            f->crc_nbytes = DSP_DATA_HEADER_SIZE + dsp.nbytes_data + dsp.nbytes_meta;
+        }
+        if (f->has_crc)
+        {
+            const uint8_t* c = head + f->crc_nbytes;
+            if (f->crc_nbytes + 4 <= nhead) {
+                f->crc32 = (uint32_t)c[0] | (uint32_t)c[1] << 8 | (uint32_t)c[2] << 16 | (uint32_t)c[3] << 24;
+            } else {
+                f->has_crc = 0;
+            }
+        }
+    }
+}
+
+int probe_file(const char* filename, MappedFile* info)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) return -1;
+    struct stat st;
+    uint8_t head[BLUE_HEADER_SIZE];
+    ssize_t nhead = 0;
+    if (fstat(fd, &st) == 0)
+    {
+        nhead = pread(fd, head, sizeof(head), 0);
+    }
+    close(fd);
+    if (nhead < 0) return -1;
+    describe_file(head, nhead, st.st_size, info);
+    return 0;
+}
+
+MappedFile map_file(const char* filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+    {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        perror("fstat");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t nbytes = st.st_size;
+
+    const char* bytes = NULL;
+    if (nbytes > 0)
+    {
+        void* addr = mmap(NULL, nbytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED)
+        {
+            perror("mmap");
+            exit(EXIT_FAILURE);
+        }
+        // Playback mostly walks forward, let the kernel read ahead and drop
+        // pages behind us.
+        madvise(addr, nbytes, MADV_SEQUENTIAL);
+        bytes = (const char*)addr;
+    }
+    // The mapping holds its own reference to the file
+    close(fd);
+
+    MappedFile f;
+    describe_file((const uint8_t*)bytes, nbytes, nbytes, &f);
+    f.bytes = bytes;
+    return f;
+}
+
+void unmap_file(MappedFile* file)
+{
+    if (file->bytes)
+    {
+        munmap((void*)file->bytes, file->nbytes);
+        file->bytes = NULL;
+    }
+}
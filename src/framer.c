@@ -0,0 +1,233 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "framer.h"
+
+
+FramerOptions default_framer_options(void)
+{
+    FramerOptions opts = {
+        .sync = 0,
+        .sync_bytes = 0,
+        .seq_bytes = 0,
+    };
+    return opts;
+}
+
+int parse_framer_options(const char* spec, FramerOptions* opts)
+{
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "%s", spec);
+    char* rest = strchr(buffer, ',');
+    if (rest)
+    {
+        *rest++ = '\0';
+    }
+
+    const char* hex = buffer;
+    if (strncmp(hex, "0x", 2) == 0 || strncmp(hex, "0X", 2) == 0)
+    {
+        hex += 2;
+    }
+    size_t ndigits = strlen(hex);
+    if (ndigits != 4 && ndigits != 8 && ndigits != 16) return -1;
+    char* end;
+    opts->sync = strtoull(hex, &end, 16);
+    if (*end != '\0') return -1;
+    opts->sync_bytes = ndigits / 2;
+    opts->seq_bytes = 0;
+
+    for (char* tok = rest ? strtok(rest, ",") : NULL; tok != NULL; tok = strtok(NULL, ","))
+    {
+        if (strcmp(tok, "seq=u16") == 0) opts->seq_bytes = 2;
+        else if (strcmp(tok, "seq=u32") == 0) opts->seq_bytes = 4;
+        else if (strcmp(tok, "seq=u64") == 0) opts->seq_bytes = 8;
+        else if (strcmp(tok, "seq=none") == 0) opts->seq_bytes = 0;
+        else return -1;
+    }
+    return 0;
+}
+
+Framer new_framer(uint64_t frame_bytes, uint64_t nframes, size_t extra, const FramerOptions* opts)
+{
+    uint64_t header_bytes = opts->sync_bytes + opts->seq_bytes;
+    // Locking on needs a frame and the next sync word in view
+    if (nframes < 2)
+    {
+        nframes = 2;
+    }
+    size_t capacity = nframes * (header_bytes + frame_bytes) + extra;
+    char* buf = (char*)malloc(capacity);
+    if (!buf)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    Framer f = {
+        .opts = *opts,
+        .frame_bytes = frame_bytes,
+        .header_bytes = header_bytes,
+        .buf = buf,
+        .capacity = capacity,
+        .nready = 0,
+        .have = 0,
+        .locked = 0,
+        .have_seq = 0,
+        .expected = 0,
+        .suspect = 0,
+        .suspect_seq = 0,
+        .resyncs = 0,
+        .gaps = 0,
+        .skipped = 0,
+    };
+    return f;
+}
+
+void free_framer(Framer* framer)
+{
+    if (framer->buf)
+    {
+        free(framer->buf);
+        framer->buf = NULL;
+    }
+}
+
+char* framer_write_ptr(Framer* framer)
+{
+    return framer->buf + framer->have;
+}
+
+size_t framer_room(const Framer* framer)
+{
+    return framer->capacity - framer->have;
+}
+
+static uint64_t read_be(const unsigned char* p, int nbytes)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < nbytes; i++)
+    {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static int sync_at(const Framer* f, size_t offset)
+{
+    return read_be((const unsigned char*)f->buf + offset, f->opts.sync_bytes) == f->opts.sync;
+}
+
+// First offset in [from, last] with the sync word there and one frame on,
+// or last + 1 if there isn't one
+static size_t hunt(const Framer* f, size_t from, size_t last)
+{
+    size_t unit = f->header_bytes + f->frame_bytes;
+    unsigned char lead = (unsigned char)(f->opts.sync >> (8 * (f->opts.sync_bytes - 1)));
+    while (from <= last)
+    {
+        const char* hit = (const char*)memchr(f->buf + from, lead, last - from + 1);
+        if (!hit) break;
+        from = hit - f->buf;
+        if (sync_at(f, from) && sync_at(f, from + unit)) return from;
+        from++;
+    }
+    return last + 1;
+}
+
+// Checks the sequence number of the frame at `offset`. A number that doesn't
+// follow on is only believed once the next frame follows on from it, so a
+// corrupted number doesn't count as a huge gap.
+static void follow_sequence(Framer* f, size_t offset)
+{
+    int nbytes = f->opts.seq_bytes;
+    if (nbytes == 0) return;
+    uint64_t mask = nbytes == 8 ? UINT64_MAX : (1ull << (8 * nbytes)) - 1;
+    uint64_t seq = read_be((const unsigned char*)f->buf + offset + f->opts.sync_bytes, nbytes);
+    if (!f->have_seq || seq == f->expected)
+    {
+        f->have_seq = 1;
+        f->suspect = 0;
+        f->expected = (seq + 1) & mask;
+        return;
+    }
+    if (f->suspect && seq == ((f->suspect_seq + 1) & mask))
+    {
+        // The jump was real. Going backwards is most likely the sender
+        // starting over, so it isn't a gap.
+        uint64_t ahead = (f->suspect_seq - f->expected) & mask;
+        if (ahead <= mask / 2)
+        {
+            f->gaps += ahead;
+        }
+        f->suspect = 0;
+        f->expected = (seq + 1) & mask;
+    } else if (f->suspect && seq == ((f->expected + 1) & mask)) {
+        // The last number was garbage, the sequence never moved
+        f->suspect = 0;
+        f->expected = (seq + 1) & mask;
+    } else {
+        f->suspect = 1;
+        f->suspect_seq = seq;
+    }
+}
+
+uint64_t framer_commit(Framer* f, size_t n)
+{
+    f->have += n;
+    size_t fb = f->frame_bytes;
+    if (f->opts.sync_bytes == 0)
+    {
+        // Bare frames are already where they need to be
+        f->nready = f->have / fb;
+        return f->nready;
+    }
+
+    size_t unit = f->header_bytes + fb;
+    size_t p = f->nready * fb;
+    for (;;)
+    {
+        if (!f->locked)
+        {
+            if (f->have - p < unit + f->opts.sync_bytes) break;
+            size_t last = f->have - unit - f->opts.sync_bytes;
+            size_t q = hunt(f, p, last);
+            f->skipped += q - p;
+            p = q;
+            if (q > last) break;
+            f->locked = 1;
+        }
+        if (f->have - p < unit) break;
+        if (!sync_at(f, p))
+        {
+            f->locked = 0;
+            f->resyncs++;
+            continue;
+        }
+        follow_sequence(f, p);
+        // Pack the payload up against the frames before it
+        memmove(f->buf + f->nready * fb, f->buf + p + f->header_bytes, fb);
+        f->nready++;
+        p += unit;
+    }
+
+    size_t leftover = f->have - p;
+    memmove(f->buf + f->nready * fb, f->buf + p, leftover);
+    f->have = f->nready * fb + leftover;
+    return f->nready;
+}
+
+void framer_consume(Framer* framer, uint64_t nframes)
+{
+    size_t nbytes = nframes * framer->frame_bytes;
+    framer->nready -= nframes;
+    framer->have -= nbytes;
+    memmove(framer->buf, framer->buf + nbytes, framer->have);
+}
+
+void framer_break(Framer* framer)
+{
+    framer->have = framer->nready * framer->frame_bytes;
+}
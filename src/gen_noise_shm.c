@@ -0,0 +1,168 @@
+#include <math.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "datatype.h"
+#include "fft.h"
+#include "shmring.h"
+
+// Same test signal as scripts/gen_noise.py, a tone in complex noise, but
+// written straight into a shared memory ring for viewers to pick up with
+// shm://<name>.
+//
+//   gen_noise_shm [-r <frames/sec>] [-k <slots>] <name> [n] [iq]
+//
+// Each frame is the dB magnitude spectrum of n samples, or with "iq" the raw
+// Cf32 samples themselves. -r paces the frames (default 1000/sec, 0 for flat
+// out) since nothing pushes back on a shm producer.
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int sig)
+{
+    (void)sig;
+    running = 0;
+}
+
+// xorshift64*, plenty random for a test signal and far cheaper than rand()
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static float uniform(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    uint64_t x = rng_state * 0x2545f4914f6cdd1dull;
+    return ((x >> 40) + 0.5f) * (1.0f / 16777216.0f);
+}
+
+// Box-Muller, two unit variance normals at a time
+static void gaussian_pair(float* a, float* b)
+{
+    float r = sqrtf(-2.0f * logf(uniform()));
+    float theta = 2.0f * (float)M_PI * uniform();
+    *a = r * cosf(theta);
+    *b = r * sinf(theta);
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+int main(int argc, char* argv[])
+{
+    double rate = 1000.0;
+    uint64_t nslots = 1024;
+    int c;
+    while ((c = getopt(argc, argv, "r:k:")) != -1)
+    {
+        switch (c)
+        {
+            case 'r':
+                rate = atof(optarg);
+                break;
+            case 'k':
+                if (parse_shm_slots(optarg, &nslots) != 0)
+                {
+                    fprintf(stderr, "Bad slot count: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-r <frames/sec>] [-k <slots>] <name> [n] [iq]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (optind >= argc)
+    {
+        fprintf(stderr, "usage: %s [-r <frames/sec>] [-k <slots>] <name> [n] [iq]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    const char* name = argv[optind];
+    uint64_t n = optind + 1 < argc ? strtoull(argv[optind + 1], NULL, 10) : 1024;
+    int raw_iq = optind + 2 < argc && strcmp(argv[optind + 2], "iq") == 0;
+    if (n == 0 || (n & (n - 1)) != 0)
+    {
+        fprintf(stderr, "n must be a power of 2\n");
+        exit(EXIT_FAILURE);
+    }
+
+    ShmRing ring;
+    DataType type = raw_iq ? Cf32 : F32;
+    if (create_shm_ring(&ring, name, n, type, nslots, 0.0) != 0)
+    {
+        perror(name);
+        exit(EXIT_FAILURE);
+    }
+    printf("writing %lu %s frames to shm://%s, %lu slots\n",
+            (unsigned long)n, datatype_name(type), name, (unsigned long)(ring.mask + 1));
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    Fft fft = new_fft(n);
+    float* re = (float*)malloc(n * sizeof(float));
+    float* im = (float*)malloc(n * sizeof(float));
+    if (!re || !im)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    const double f = 0.01;
+    double t0 = now_seconds();
+    uint64_t emitted = 0;
+    while (running)
+    {
+        if (rate > 0.0)
+        {
+            double wait = emitted / rate - (now_seconds() - t0);
+            if (wait > 0.0)
+            {
+                usleep((useconds_t)(wait * 1e6));
+                continue;
+            }
+        }
+
+        float* slot = (float*)shm_ring_next(&ring);
+        for (uint64_t i = 0; i < n; i++)
+        {
+            float nr, ni;
+            gaussian_pair(&nr, &ni);
+            float x = (float)M_SQRT1_2 * nr + (float)cos(2.0 * M_PI * f * i);
+            float y = (float)M_SQRT1_2 * ni + (float)sin(2.0 * M_PI * f * i);
+            if (raw_iq) {
+                slot[2 * i] = x;
+                slot[2 * i + 1] = y;
+            } else {
+                re[fft.bitrev[i]] = x;
+                im[fft.bitrev[i]] = y;
+            }
+        }
+        if (!raw_iq)
+        {
+            fft_bitrev_input(&fft, re, im);
+            for (uint64_t k = 0; k < n; k++)
+            {
+                slot[k] = 10.0f * log10f(re[k] * re[k] + im[k] * im[k] + 1e-20f);
+            }
+        }
+        shm_ring_publish(&ring, 1);
+        emitted++;
+    }
+
+    printf("wrote %lu frames\n", (unsigned long)emitted);
+    free(re);
+    free(im);
+    free_fft(&fft);
+    destroy_shm_ring(&ring);
+    return 0;
+}
@@ -0,0 +1,1797 @@
+#define _GNU_SOURCE // recvmmsg
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "capture.h"
+#include "convert.h"
+#include "crc32.h"
+#include "datatype.h"
+#include "framer.h"
+#include "ingest.h"
+#include "net.h"
+#include "plugin.h"
+#include "psd.h"
+#include "resample.h"
+#include "ring.h"
+#include "shmring.h"
+#include "uring.h"
+
+#define INGEST_MAX_IOV 64
+#define INGEST_POLL_MS 100
+#define PLAYBACK_IDLE_NS 10000000
+#define SHM_POLL_NS 100000
+
+
+static void sleep_ns(long ns)
+{
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = ns };
+    nanosleep(&ts, NULL);
+}
+
+static void wait_for_space(void)
+{
+    sleep_ns(100000);
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// Passes raw input on to the capture ring and the recorder, if there are
+// any. The lock is only ever contended while recording is being switched on
+// or off.
+static void record_raw(Ingest* ingest, const void* raw, size_t nbytes)
+{
+    if (ingest->capture_enabled)
+    {
+        capture_frames(&ingest->capture, raw, nbytes);
+    }
+    pthread_mutex_lock(&ingest->record_lock);
+    if (ingest->recorder)
+    {
+        record(ingest->recorder, raw, nbytes);
+    }
+    pthread_mutex_unlock(&ingest->record_lock);
+}
+
+// Level trigger check of a frame that's been converted, `nback` frames
+// before the end of the raw input recorded so far
+static void check_capture_level(Ingest* ingest, const float* frame, uint64_t nback)
+{
+    if (!ingest->capture_enabled) return;
+    Capture* cap = &ingest->capture;
+    capture_check_level(cap, frame, ingest->ring.frame_size, capture_position(cap) - nback * ingest->raw_frame_bytes);
+}
+
+// Raw frames that can go through process_frames() when `nfree` slots are
+// free, more than nfree when decimating
+static uint64_t frames_that_fit(Ingest* ingest, uint64_t nfree)
+{
+    if (nfree == 0) return 0;
+    uint64_t N = ingest->decimate;
+    uint64_t first = (N - ingest->decimate_phase) % N; // frames until the next kept one
+    uint64_t n = first + nfree * N;
+    // Bounds the PSD output list below
+    return n < INGEST_RING_SLOTS ? n : INGEST_RING_SLOTS;
+}
+
+// Where the kept frame `k` of a batch is converted to. Plugins that keep
+// the frame size work on it in its ring slot, otherwise it's staged.
+static float* convert_target(Ingest* ingest, uint64_t k)
+{
+    if (ingest->staging) return ingest->staging + k * ingest->convert_size;
+    return frame_ring_write_ptr(&ingest->ring, k);
+}
+
+// Turns `n` consecutive raw frames into ring slots from the next free one on,
+// keeping every decimate'th. Returns how many slots were filled, the caller
+// has already checked with frames_that_fit() that there's room.
+static uint64_t process_frames(Ingest* ingest, const char* raw, uint64_t n, float* scratch)
+{
+    FrameRing* ring = &ingest->ring;
+    record_raw(ingest, raw, n * ingest->raw_frame_bytes);
+
+    float* outputs[INGEST_RING_SLOTS];
+    uint64_t nkept = 0;
+    for (uint64_t i = 0; i < n; i++)
+    {
+        int keep = ingest->decimate_phase == 0;
+        ingest->decimate_phase = (ingest->decimate_phase + 1) % ingest->decimate;
+        // Spectra still need computing to keep the average going, the ones
+        // not kept all land in scratch
+        outputs[i] = keep ? convert_target(ingest, nkept++) : scratch;
+    }
+    atomic_fetch_add_explicit(&ingest->stats.received, n, memory_order_relaxed);
+    atomic_fetch_add_explicit(&ingest->stats.dropped, n - nkept, memory_order_relaxed);
+
+    // Every frame goes through the resampler to keep its history going, and
+    // what comes out is floats, scaled already
+    DataType type = ingest->type;
+    int swapped = ingest->swapped;
+    float scale = ingest->scale;
+    float offset = ingest->offset;
+    size_t frame_bytes = ingest->raw_frame_bytes;
+    if (ingest->resample_enabled)
+    {
+        Resampler* r = &ingest->resampler;
+        raw = (const char*)resample_blocks(r, raw, n, scale, offset);
+        type = resampled_type(type);
+        swapped = 0;
+        scale = 1.0f;
+        offset = 0.0f;
+        frame_bytes = r->out_samples * datatype_size(type);
+    }
+
+    if (ingest->psd_enabled) {
+        process_psd(&ingest->psd, raw, scale, offset, n, outputs);
+    } else {
+        for (uint64_t i = 0; i < n; i++)
+        {
+            if (outputs[i] == scratch) continue;
+            const char* in = raw + i * frame_bytes;
+            if (swapped) {
+                convert_frame_swapped(type, in, outputs[i], ingest->convert_size, scale, offset, scratch);
+            } else {
+                convert_frame(type, in, outputs[i], ingest->convert_size, scale, offset, scratch);
+            }
+        }
+    }
+    for (uint64_t i = 0, k = 0; i < n; i++)
+    {
+        if (outputs[i] == scratch) continue;
+        float* slot = frame_ring_write_ptr(ring, k++);
+        if (ingest->plugins.n > 0)
+        {
+            run_plugin_chain(&ingest->plugins, outputs[i], slot);
+        }
+        check_capture_level(ingest, slot, n - i);
+    }
+    return nkept;
+}
+
+// Spectra and the resampler shouldn't carry their history across a gap or
+// a seek
+static void reset_history(Ingest* ingest)
+{
+    if (ingest->psd_enabled)
+    {
+        reset_psd(&ingest->psd);
+    }
+    if (ingest->resample_enabled)
+    {
+        reset_resampler(&ingest->resampler);
+    }
+}
+
+// Throws away `n` raw frames under OVERLOAD_DROP when the ring and staging
+// buffer are both full. They still get recorded.
+static void discard_frames(Ingest* ingest, const char* raw, uint64_t n)
+{
+    record_raw(ingest, raw, n * ingest->raw_frame_bytes);
+    atomic_fetch_add_explicit(&ingest->stats.received, n, memory_order_relaxed);
+    atomic_fetch_add_explicit(&ingest->stats.dropped, n, memory_order_relaxed);
+    reset_history(ingest);
+}
+
+// Reads straight into the free slots of the ring with one readv() per wakeup,
+// so a burst of data on the pipe lands as many frames per syscall. A frame
+// that only partially arrived stays unpublished until the rest shows up.
+static void* ingest_thread(void* arg)
+{
+    Ingest* ingest = (Ingest*)arg;
+    FrameRing* ring = &ingest->ring;
+    size_t frame_bytes = ring->frame_size * sizeof(float);
+    size_t filled = 0; // bytes already in the slot at head
+    struct iovec iov[INGEST_MAX_IOV];
+    struct pollfd pfd = { .fd = ingest->fd, .events = POLLIN };
+
+    while (atomic_load(&ingest->running))
+    {
+        uint64_t nfree = frame_ring_writable(ring);
+        if (nfree == 0)
+        {
+            // Render loop is behind, hold off and let the pipe back up
+            wait_for_space();
+            continue;
+        }
+        if (nfree > INGEST_MAX_IOV)
+        {
+            nfree = INGEST_MAX_IOV;
+        }
+
+        int ret = poll(&pfd, 1, INGEST_POLL_MS);
+        if (ret == 0)
+        {
+            continue;
+        } else if (ret == -1) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+
+        for (uint64_t i = 0; i < nfree; i++)
+        {
+            char* slot = (char*)frame_ring_write_ptr(ring, i);
+            size_t skip = (i == 0) ? filled : 0;
+            iov[i].iov_base = slot + skip;
+            iov[i].iov_len = frame_bytes - skip;
+        }
+
+        ssize_t nbytes = readv(ingest->fd, iov, (int)nfree);
+        if (nbytes == 0)
+        {
+            // EOF
+            break;
+        } else if (nbytes == -1) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            perror("readv");
+            break;
+        }
+
+        filled += nbytes;
+        uint64_t nframes = filled / frame_bytes;
+        filled %= frame_bytes;
+        if (nframes > 0)
+        {
+            // Slots are padded so each frame is recorded on its own
+            for (uint64_t i = 0; i < nframes; i++)
+            {
+                record_raw(ingest, frame_ring_write_ptr(ring, i), frame_bytes);
+                check_capture_level(ingest, frame_ring_write_ptr(ring, i), 1);
+            }
+            atomic_fetch_add_explicit(&ingest->stats.received, nframes, memory_order_relaxed);
+            frame_ring_publish(ring, nframes);
+        }
+    }
+
+    atomic_store(&ingest->eof, 1);
+    return NULL;
+}
+
+// Publishes the parser's counters and makes sure the records hold what the
+// viewer was set up for. Returns 0 if the stream can't go on.
+static int check_dsp_stream(Ingest* ingest)
+{
+    DspDataParser* dsp = &ingest->dsp;
+    if (dsp->crc_errors > atomic_load(&ingest->stats.crc_errors))
+    {
+        fprintf(stderr, "DSP_DATA record %lu failed its CRC check\n", (unsigned long)dsp->records);
+    }
+    atomic_store(&ingest->stats.records, dsp->records);
+    atomic_store(&ingest->stats.crc_errors, dsp->crc_errors);
+    if (dsp->state == DSP_PARSE_ERROR)
+    {
+        fprintf(stderr, "Bad DSP_DATA stream: %s\n", dsp->error);
+        return 0;
+    }
+    if (dsp->typed && dsp->type != ingest->type)
+    {
+        fprintf(stderr, "DSP_DATA stream holds %s samples, run with -t %s\n",
+                datatype_name(dsp->type), datatype_name(dsp->type));
+        return 0;
+    }
+    return 1;
+}
+
+// Publishes the framer's counters, noting on stderr when sync or frames went
+// missing since last time
+static void check_framer(Ingest* ingest, const Framer* framer)
+{
+    IngestStats* stats = &ingest->stats;
+    uint64_t resyncs = atomic_load(&stats->resyncs);
+    uint64_t gaps = atomic_load(&stats->gaps);
+    if (framer->resyncs > resyncs)
+    {
+        fprintf(stderr, "Lost frame sync, %lu bytes skipped so far\n", (unsigned long)framer->skipped);
+    }
+    if (framer->gaps > gaps)
+    {
+        fprintf(stderr, "Sequence gap, %lu frames missing\n", (unsigned long)(framer->gaps - gaps));
+    }
+    atomic_store(&stats->resyncs, framer->resyncs);
+    atomic_store(&stats->gaps, framer->gaps);
+    atomic_store(&stats->skipped, framer->skipped);
+}
+
+// Where a stream reader's bytes come from. With -u that's an io_uring
+// reader, which has the next read in flight while the last one is being
+// converted, otherwise poll() and read().
+typedef struct StreamSource {
+    int fd;
+    int use_uring;
+    UringReader reader;
+    const char* pending;    // rest of the last io_uring block
+    size_t npending;
+} StreamSource;
+
+static void open_stream_source(StreamSource* src, Ingest* ingest)
+{
+    src->fd = ingest->fd;
+    src->use_uring = 0;
+    src->pending = NULL;
+    src->npending = 0;
+    if (!ingest->uring) return;
+    // A file given as stdin or streamed for -y goes on from where it is
+    off_t start = lseek(src->fd, 0, SEEK_CUR);
+    if (open_uring_reader(&src->reader, src->fd, start < 0 ? 0 : start, URING_BLOCK_BYTES, URING_DEPTH) == 0) {
+        src->use_uring = 1;
+    } else {
+        fprintf(stderr, "io_uring unavailable (%s), using read()\n", strerror(errno));
+    }
+}
+
+static void close_stream_source(StreamSource* src)
+{
+    if (src->use_uring)
+    {
+        close_uring_reader(&src->reader);
+    }
+}
+
+// Waits up to `timeout_ms` for input and copies up to `room` bytes of it to
+// `dst`. Returns the bytes copied, 0 at eof or -1 with errno set, EAGAIN if
+// nothing came in time.
+static ssize_t read_stream(StreamSource* src, char* dst, size_t room, int timeout_ms)
+{
+    if (src->use_uring)
+    {
+        if (src->npending == 0)
+        {
+            ssize_t n = uring_reader_next(&src->reader, &src->pending, timeout_ms);
+            if (n == -1 && errno == ETIME) errno = EAGAIN;
+            if (n <= 0) return n;
+            src->npending = n;
+        }
+        size_t n = src->npending < room ? src->npending : room;
+        memcpy(dst, src->pending, n);
+        src->pending += n;
+        src->npending -= n;
+        return n;
+    }
+
+    struct pollfd pfd = { .fd = src->fd, .events = POLLIN };
+    int ret = poll(&pfd, 1, timeout_ms);
+    if (ret == 0)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (ret == -1) return -1;
+    return read(src->fd, dst, room);
+}
+
+// Reader for anything that isn't bare native floats. Raw bytes land in a
+// Framer big enough for INGEST_STAGE_FRAMES frames, with DSP_DATA headers,
+// metadata and CRCs filtered out in place first. Every whole frame gets
+// converted straight into a ring slot and any partial frame is carried over
+// for the next read.
+static void* ingest_convert_thread(void* arg)
+{
+    Ingest* ingest = (Ingest*)arg;
+    FrameRing* ring = &ingest->ring;
+    Framer framer = new_framer(ingest->raw_frame_bytes, INGEST_STAGE_FRAMES, 0, &ingest->framing);
+    float* scratch = (float*)malloc(2 * ingest->convert_size * sizeof(float));
+    if (!scratch)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    StreamSource src;
+    open_stream_source(&src, ingest);
+
+    while (atomic_load(&ingest->running))
+    {
+        uint64_t nwhole = framer.nready;
+        int timeout = INGEST_POLL_MS;
+        if (nwhole > 0)
+        {
+            uint64_t n = frames_that_fit(ingest, frame_ring_writable(ring));
+            if (n > 0)
+            {
+                n = n < nwhole ? n : nwhole;
+                frame_ring_publish(ring, process_frames(ingest, framer.buf, n, scratch));
+                framer_consume(&framer, n);
+                continue;
+            }
+            if (ingest->policy != OVERLOAD_DROP)
+            {
+                // Render loop is behind, hold off and let the pipe back up
+                wait_for_space();
+                continue;
+            }
+            // Render loop is behind, have it skip ahead and keep the pipe
+            // moving. Once the stage fills its oldest frames go too.
+            frame_ring_request_skip(ring, nwhole);
+            if (framer_room(&framer) < framer.header_bytes + framer.frame_bytes)
+            {
+                discard_frames(ingest, framer.buf, nwhole);
+                framer_consume(&framer, nwhole);
+            }
+            // Come back soon to see if there's room yet
+            timeout = 1;
+        }
+
+        char* dst = framer_write_ptr(&framer);
+        ssize_t nbytes = read_stream(&src, dst, framer_room(&framer), timeout);
+        if (nbytes == 0)
+        {
+            // EOF
+            break;
+        } else if (nbytes == -1) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            perror("read");
+            break;
+        }
+        if (ingest->format == FORMAT_DSP_DATA)
+        {
+            nbytes = dsp_data_filter(&ingest->dsp, dst, nbytes);
+            if (!check_dsp_stream(ingest)) break;
+        }
+        framer_commit(&framer, nbytes);
+        if (ingest->framing.sync_bytes > 0)
+        {
+            check_framer(ingest, &framer);
+        }
+    }
+
+    close_stream_source(&src);
+    free_framer(&framer);
+    free(scratch);
+    atomic_store(&ingest->eof, 1);
+    return NULL;
+}
+
+static uint64_t read_be(const unsigned char* p, int nbytes)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < nbytes; i++)
+    {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+// Pulls up to `batch` datagrams per recvmmsg() into a receive area, then
+// appends their payloads to a Framer like the one in ingest_convert_thread(). With a sequence number in front of each datagram
+// lost and late datagrams are counted, late ones are thrown away, and a gap
+// discards the partial frame it tore so frames stay aligned as long as the
+// sender starts each datagram on a frame boundary.
+static void* udp_thread(void* arg)
+{
+    Ingest* ingest = (Ingest*)arg;
+    FrameRing* ring = &ingest->ring;
+    IngestStats* stats = &ingest->stats;
+    size_t raw_frame_bytes = ingest->raw_frame_bytes;
+    size_t batch = ingest->net.batch;
+    size_t mtu = ingest->net.max_datagram;
+    int hdr = ingest->net.seq_bytes;
+    uint64_t seq_mask = hdr == 8 ? UINT64_MAX : UINT32_MAX;
+    size_t ctrl_size = CMSG_SPACE(sizeof(uint32_t));
+
+    Framer framer = new_framer(raw_frame_bytes, INGEST_STAGE_FRAMES, batch * mtu, &ingest->framing);
+    char* dgrams = (char*)malloc(batch * mtu);
+    char* ctrl = (char*)malloc(batch * ctrl_size);
+    struct mmsghdr* msgs = (struct mmsghdr*)calloc(batch, sizeof(struct mmsghdr));
+    struct iovec* iovs = (struct iovec*)malloc(batch * sizeof(struct iovec));
+    float* scratch = (float*)malloc(2 * ingest->convert_size * sizeof(float));
+    if (!dgrams || !ctrl || !msgs || !iovs || !scratch)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t expected = 0;
+    int have_seq = 0;
+    struct pollfd pfd = { .fd = ingest->fd, .events = POLLIN };
+
+    while (atomic_load(&ingest->running))
+    {
+        uint64_t nwhole = framer.nready;
+        uint64_t nfit = frames_that_fit(ingest, frame_ring_writable(ring));
+        if (nwhole > 0 && nfit > 0)
+        {
+            nfit = nfit < nwhole ? nfit : nwhole;
+            frame_ring_publish(ring, process_frames(ingest, framer.buf, nfit, scratch));
+            framer_consume(&framer, nfit);
+            continue;
+        }
+        int timeout = INGEST_POLL_MS;
+        if (nwhole > 0 && ingest->policy == OVERLOAD_DROP)
+        {
+            // Same as ingest_convert_thread(), the socket never waits on the
+            // render loop
+            frame_ring_request_skip(ring, nwhole);
+            if (framer_room(&framer) < batch * mtu)
+            {
+                discard_frames(ingest, framer.buf, nwhole);
+                framer_consume(&framer, nwhole);
+            }
+            timeout = 1;
+        } else if (framer_room(&framer) < batch * mtu) {
+            // Render loop is behind and the stage is full, let the socket
+            // buffer take the slack
+            wait_for_space();
+            continue;
+        }
+
+        int ret = poll(&pfd, 1, timeout);
+        if (ret == 0)
+        {
+            continue;
+        } else if (ret == -1) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+
+        for (size_t i = 0; i < batch; i++)
+        {
+            iovs[i].iov_base = dgrams + i * mtu;
+            iovs[i].iov_len = mtu;
+            memset(&msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = ctrl + i * ctrl_size;
+            msgs[i].msg_hdr.msg_controllen = ctrl_size;
+        }
+
+        int n = recvmmsg(ingest->fd, msgs, batch, MSG_DONTWAIT, NULL);
+        if (n == -1)
+        {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            perror("recvmmsg");
+            break;
+        }
+
+        uint64_t nbytes = 0, nlost = 0, nlate = 0, ntrunc = 0;
+        for (int i = 0; i < n; i++)
+        {
+            struct msghdr* msg = &msgs[i].msg_hdr;
+            size_t len = msgs[i].msg_len;
+            const unsigned char* payload = (const unsigned char*)dgrams + i * mtu;
+            nbytes += len;
+
+            for (struct cmsghdr* cm = CMSG_FIRSTHDR(msg); cm != NULL; cm = CMSG_NXTHDR(msg, cm))
+            {
+                if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_RXQ_OVFL)
+                {
+                    // Running total for the socket
+                    uint32_t overflows;
+                    memcpy(&overflows, CMSG_DATA(cm), sizeof(overflows));
+                    atomic_store(&stats->overflows, overflows);
+                }
+            }
+
+            int gap = 0;
+            if (msg->msg_flags & MSG_TRUNC)
+            {
+                ntrunc++;
+                gap = 1;
+            } else if (len < (size_t)hdr) {
+                continue;
+            } else if (hdr > 0) {
+                uint64_t seq = read_be(payload, hdr);
+                if (have_seq)
+                {
+                    uint64_t ahead = (seq - expected) & seq_mask;
+                    if (ahead > seq_mask / 2)
+                    {
+                        nlate++;
+                        continue;
+                    }
+                    nlost += ahead;
+                    gap = ahead > 0;
+                }
+                have_seq = 1;
+                expected = (seq + 1) & seq_mask;
+            }
+
+            if (gap)
+            {
+                framer_break(&framer);
+                if (msg->msg_flags & MSG_TRUNC) continue;
+            }
+            size_t npayload = len - hdr;
+            char* dst = framer_write_ptr(&framer);
+            memcpy(dst, payload + hdr, npayload);
+            if (ingest->format == FORMAT_DSP_DATA)
+            {
+                npayload = dsp_data_filter(&ingest->dsp, dst, npayload);
+            }
+            framer_commit(&framer, npayload);
+        }
+        if (ingest->format == FORMAT_DSP_DATA && !check_dsp_stream(ingest)) break;
+        if (ingest->framing.sync_bytes > 0)
+        {
+            check_framer(ingest, &framer);
+        }
+
+        atomic_fetch_add_explicit(&stats->packets, n, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats->bytes, nbytes, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats->lost, nlost, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats->reordered, nlate, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats->truncated, ntrunc, memory_order_relaxed);
+    }
+
+    free_framer(&framer);
+    free(dgrams);
+    free(ctrl);
+    free(msgs);
+    free(iovs);
+    free(scratch);
+    atomic_store(&ingest->eof, 1);
+    return NULL;
+}
+
+// Copies frames out of a shared memory ring into a Framer, so PSD units and
+// conversions work just like a stream. The producer can't be held up, so
+// once it gets over half the ring ahead the frames in between are skipped,
+// and a frame it overwrote while it was being copied is dropped.
+static void* shm_thread(void* arg)
+{
+    Ingest* ingest = (Ingest*)arg;
+    FrameRing* ring = &ingest->ring;
+    ShmRing* shm = &ingest->shm;
+    uint64_t slack = (shm->mask + 1) / 2;
+    FramerOptions bare = default_framer_options();
+    Framer framer = new_framer(ingest->raw_frame_bytes, INGEST_STAGE_FRAMES, shm->frame_bytes, &bare);
+    float* scratch = (float*)malloc(2 * ingest->convert_size * sizeof(float));
+    if (!scratch)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t cursor = ingest->shm_cursor;
+
+    while (atomic_load(&ingest->running))
+    {
+        uint64_t nwhole = framer.nready;
+        if (nwhole > 0)
+        {
+            uint64_t n = frames_that_fit(ingest, frame_ring_writable(ring));
+            if (n == 0)
+            {
+                if (ingest->policy == OVERLOAD_DROP)
+                {
+                    frame_ring_request_skip(ring, nwhole);
+                }
+                wait_for_space();
+            } else {
+                n = n < nwhole ? n : nwhole;
+                frame_ring_publish(ring, process_frames(ingest, framer.buf, n, scratch));
+                framer_consume(&framer, n);
+                continue;
+            }
+        }
+
+        uint64_t w = shm_ring_write_index(shm);
+        if (w - cursor > slack)
+        {
+            uint64_t nlost = w - cursor - slack;
+            atomic_fetch_add_explicit(&ingest->stats.received, nlost, memory_order_relaxed);
+            atomic_fetch_add_explicit(&ingest->stats.dropped, nlost, memory_order_relaxed);
+            cursor += nlost;
+            framer_break(&framer);
+            reset_history(ingest);
+        }
+        if (w == cursor)
+        {
+            if (shm_ring_closed(shm)) break;
+            sleep_ns(SHM_POLL_NS);
+            continue;
+        }
+        while (cursor != w && framer_room(&framer) >= shm->frame_bytes)
+        {
+            memcpy(framer_write_ptr(&framer), shm_ring_frame(shm, cursor), shm->frame_bytes);
+            if (cursor < shm_ring_oldest_intact(shm))
+            {
+                // The producer got to the slot while it was being copied, so
+                // it's lapping us. The next look skips ahead.
+                atomic_fetch_add_explicit(&ingest->stats.received, 1, memory_order_relaxed);
+                atomic_fetch_add_explicit(&ingest->stats.dropped, 1, memory_order_relaxed);
+                cursor++;
+                framer_break(&framer);
+                reset_history(ingest);
+                break;
+            }
+            framer_commit(&framer, shm->frame_bytes);
+            cursor++;
+        }
+        shm_reader_update(shm, cursor, atomic_load(&ingest->stats.dropped));
+    }
+
+    free_framer(&framer);
+    free(scratch);
+    atomic_store(&ingest->eof, 1);
+    return NULL;
+}
+
+// Follows playback through a file that carries a CRC and checks it once
+// every byte it covers has been played in order from the start, so the check
+// costs no extra reads. Seeking anywhere but the start gives up until
+// playback starts over.
+typedef struct CrcCursor {
+    uint64_t next; // file offset covered so far, 0 when not following
+    uint32_t crc;
+} CrcCursor;
+
+static void follow_crc(Ingest* ingest, CrcCursor* cursor, const char* data, uint64_t offset, uint64_t nbytes)
+{
+    const MappedFile* file = &ingest->file;
+    if (!file->has_crc) return;
+    if (offset == file->data_offset)
+    {
+        cursor->crc = crc32_update(0, file->bytes, file->data_offset);
+        cursor->next = file->data_offset;
+    }
+    if (cursor->next != offset)
+    {
+        cursor->next = 0;
+        return;
+    }
+    // `data` holds the bytes at `offset`, wherever they were read to
+    cursor->crc = crc32_update(cursor->crc, data, nbytes);
+    cursor->next += nbytes;
+    if (cursor->next == file->data_offset + ingest->nframes * ingest->raw_frame_bytes)
+    {
+        // Last frame is out, the partial frame and metadata after it finish
+        // the CRC off. describe_file() only sets has_crc when the frames fit
+        // inside what it covers.
+        assert(cursor->next <= file->crc_nbytes);
+        cursor->crc = crc32_update(cursor->crc, file->bytes + cursor->next, file->crc_nbytes - cursor->next);
+        cursor->next = 0;
+        atomic_fetch_add(&ingest->stats.records, 1);
+        if (cursor->crc != file->crc32)
+        {
+            atomic_fetch_add(&ingest->stats.crc_errors, 1);
+            fprintf(stderr, "DSP_DATA file failed its CRC check\n");
+        }
+    }
+}
+
+// Playback with -u. Reads run ahead of the playback position through
+// io_uring, O_DIRECT if the file system allows, and the frames to be queued
+// next get gathered whole into a bare Framer.
+typedef struct StagedPlayback {
+    UringReader reader;
+    Framer stage;
+    uint64_t pos;           // frame at the front of the stage
+    const char* pending;    // rest of the last block read
+    size_t npending;
+} StagedPlayback;
+
+static int open_staged_playback(StagedPlayback* sp, Ingest* ingest)
+{
+    if (open_uring_reader(&sp->reader, ingest->fd, ingest->file.data_offset, URING_BLOCK_BYTES, URING_DEPTH) != 0) return -1;
+    FramerOptions bare = default_framer_options();
+    sp->stage = new_framer(ingest->raw_frame_bytes, INGEST_RING_SLOTS, 0, &bare);
+    sp->pos = 0;
+    sp->pending = NULL;
+    sp->npending = 0;
+    return 0;
+}
+
+static void close_staged_playback(StagedPlayback* sp)
+{
+    close_uring_reader(&sp->reader);
+    free_framer(&sp->stage);
+}
+
+// Returns `n` frames from `pos` on, waiting for the reads if need be. A
+// seek starts the reads over from the new position. Returns NULL with errno
+// set if the file couldn't be read.
+static const char* staged_frames(Ingest* ingest, StagedPlayback* sp, uint64_t pos, uint64_t n)
+{
+    Framer* stage = &sp->stage;
+    if (pos != sp->pos)
+    {
+        uring_reader_seek(&sp->reader, ingest->file.data_offset + pos * ingest->raw_frame_bytes);
+        framer_consume(stage, stage->nready);
+        framer_break(stage);
+        sp->npending = 0;
+        sp->pos = pos;
+    }
+    while (stage->nready < n)
+    {
+        if (sp->npending == 0)
+        {
+            ssize_t got = uring_reader_next(&sp->reader, &sp->pending, -1);
+            if (got == 0) errno = EIO; // the file shrank
+            if (got <= 0) return NULL;
+            sp->npending = got;
+        }
+        // Only as much as is needed, so consuming never moves much
+        size_t need = n * stage->frame_bytes - stage->have;
+        size_t m = sp->npending < need ? sp->npending : need;
+        memcpy(framer_write_ptr(stage), sp->pending, m);
+        framer_commit(stage, m);
+        sp->pending += m;
+        sp->npending -= m;
+    }
+    return stage->buf;
+}
+
+static void consume_staged(StagedPlayback* sp, uint64_t n)
+{
+    framer_consume(&sp->stage, n);
+    sp->pos += n;
+}
+
+// Copies frames out of the mapping at `frame_rate`. Only the pages of frames
+// that actually get queued are ever faulted in, and a seek just moves the
+// read position. The thread idles at the end of the file rather than exiting
+// so the user can still seek backwards. With -u the frames come from a
+// StagedPlayback instead and the mapping is only there for the CRC.
+static void* playback_thread(void* arg)
+{
+    Ingest* ingest = (Ingest*)arg;
+    FrameRing* ring = &ingest->ring;
+    size_t raw_frame_bytes = ingest->raw_frame_bytes;
+    const char* data = ingest->file.bytes + ingest->file.data_offset;
+    uint64_t pos = 0;
+    CrcCursor cursor = { 0, 0 };
+    float* scratch = (float*)malloc(2 * ingest->convert_size * sizeof(float));
+    if (!scratch)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    StagedPlayback staged;
+    int use_uring = ingest->fd != -1 && open_staged_playback(&staged, ingest) == 0;
+    if (ingest->uring && !use_uring)
+    {
+        fprintf(stderr, "io_uring unavailable (%s), playing back from mmap()\n", strerror(errno));
+    }
+
+    // Pacing is relative to when the current run of frames started, so a
+    // slow draw catches up instead of drifting.
+    double t0 = now_seconds();
+    double rate = atomic_load(&ingest->frame_rate);
+    uint64_t emitted = 0;
+
+    while (atomic_load(&ingest->running))
+    {
+        int64_t target = atomic_exchange(&ingest->seek, -1);
+        double new_rate = atomic_load(&ingest->frame_rate);
+        if (target >= 0 || new_rate != rate || atomic_load(&ingest->paused))
+        {
+            if (target >= 0)
+            {
+                pos = target;
+                atomic_store(&ingest->position, pos);
+                reset_history(ingest);
+            }
+            rate = new_rate;
+            t0 = now_seconds();
+            emitted = 0;
+            if (atomic_load(&ingest->paused))
+            {
+                sleep_ns(PLAYBACK_IDLE_NS);
+                continue;
+            }
+        }
+
+        if (pos >= ingest->nframes)
+        {
+            atomic_store(&ingest->eof, 1);
+            sleep_ns(PLAYBACK_IDLE_NS);
+            t0 = now_seconds();
+            emitted = 0;
+            continue;
+        }
+        atomic_store(&ingest->eof, 0);
+
+        uint64_t ndue = ingest->nframes - pos;
+        if (rate > 0.0)
+        {
+            double elapsed = now_seconds() - t0;
+            uint64_t due = (uint64_t)(elapsed * rate) + 1;
+            if (due <= emitted)
+            {
+                // Sleep until the next frame is due, but never so long that a
+                // seek or rate change feels laggy.
+                double wait = (emitted - elapsed * rate) / rate;
+                long ns = (long)(wait * 1e9);
+                sleep_ns(ns < PLAYBACK_IDLE_NS ? ns : PLAYBACK_IDLE_NS);
+                continue;
+            }
+            if (due - emitted < ndue)
+            {
+                ndue = due - emitted;
+            }
+        }
+
+        uint64_t n = frames_that_fit(ingest, frame_ring_writable(ring));
+        if (n == 0)
+        {
+            if (ingest->policy == OVERLOAD_DROP)
+            {
+                // Nothing is lost by waiting on a file, but the viewer should
+                // catch up to the playback position rather than lag it
+                frame_ring_request_skip(ring, ndue);
+            }
+            wait_for_space();
+            continue;
+        }
+        n = n < ndue ? n : ndue;
+        const char* frames = data + pos * raw_frame_bytes;
+        if (use_uring)
+        {
+            frames = staged_frames(ingest, &staged, pos, n);
+            if (!frames)
+            {
+                fprintf(stderr, "io_uring read failed (%s), going back to mmap()\n", strerror(errno));
+                close_staged_playback(&staged);
+                use_uring = 0;
+                continue;
+            }
+        }
+        frame_ring_publish(ring, process_frames(ingest, frames, n, scratch));
+        follow_crc(ingest, &cursor, frames, ingest->file.data_offset + pos * raw_frame_bytes, n * raw_frame_bytes);
+        if (use_uring)
+        {
+            consume_staged(&staged, n);
+        }
+        pos += n;
+        emitted += n;
+        atomic_store(&ingest->position, pos);
+    }
+
+    if (use_uring)
+    {
+        close_staged_playback(&staged);
+    }
+    free(scratch);
+    return NULL;
+}
+
+IngestOptions default_ingest_options(uint64_t frame_size)
+{
+    IngestOptions opts = {
+        .input = NULL,
+        .format = FORMAT_RAW,
+        .swapped = 0,
+        .frame_size = frame_size,
+        .type = F32,
+        .scale = 1.0f,
+        .offset = 0.0f,
+        .sample_rate = 0.0,
+        .speed = 1.0,
+        .psd = 0,
+        .psd_opts = default_psd_options(),
+        .record_path = NULL,
+        .policy = OVERLOAD_BLOCK,
+        .decimate = 1,
+        .framing = default_framer_options(),
+        .uring = 0,
+        .capture = 0,
+        .capture_opts = default_capture_options(),
+        .resample = 0,
+        .resample_opts = default_resample_options(),
+        .nplugins = 0,
+        .plugins = { .n = 0 },
+    };
+    return opts;
+}
+
+// Floats per frame before any plugins
+static uint64_t convert_frame_size(const IngestOptions* opts)
+{
+    if (opts->psd) return psd_output_size(&opts->psd_opts, opts->type);
+    return opts->frame_size;
+}
+
+uint64_t ingest_frame_size(const IngestOptions* opts)
+{
+    if (opts->plugins.n > 0) return opts->plugins.out_size;
+    return convert_frame_size(opts);
+}
+
+// Samples per frame after any resampling
+static uint64_t resampled_input_size(const IngestOptions* opts)
+{
+    if (opts->psd) return psd_input_size(&opts->psd_opts);
+    return opts->frame_size;
+}
+
+// Raw samples per frame
+static uint64_t ingest_input_size(const IngestOptions* opts)
+{
+    uint64_t n = resampled_input_size(opts);
+    if (opts->resample) return n * opts->resample_opts.down / opts->resample_opts.up;
+    return n;
+}
+
+double ingest_sample_rate(const IngestOptions* opts)
+{
+    if (opts->resample) return opts->sample_rate * opts->resample_opts.up / opts->resample_opts.down;
+    return opts->sample_rate;
+}
+
+int parse_overload_policy(const char* spec, OverloadPolicy* policy, uint64_t* decimate)
+{
+    *decimate = 1;
+    if (strcmp(spec, "block") == 0) {
+        *policy = OVERLOAD_BLOCK;
+    } else if (strcmp(spec, "drop") == 0 || strcmp(spec, "drop-oldest") == 0) {
+        *policy = OVERLOAD_DROP;
+    } else if (strncmp(spec, "decimate:", 9) == 0) {
+        char* end;
+        long n = strtol(spec + 9, &end, 10);
+        if (*end != '\0' || n < 1) return -1;
+        *policy = OVERLOAD_DECIMATE;
+        *decimate = n;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int parse_ingest_option(int c, const char* arg, IngestOptions* opts)
+{
+    switch (c)
+    {
+        case 'f':
+            opts->frame_size = atoi(arg);
+            if (opts->frame_size == 0)
+            {
+                fprintf(stderr, "Bad frame size: %s\n", arg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 't':
+            if (parse_datatype(arg, &opts->type) != 0)
+            {
+                fprintf(stderr, "Unknown data type: %s\n", arg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'g':
+            opts->scale = atof(arg);
+            break;
+        case 'b':
+            opts->offset = atof(arg);
+            break;
+        case 's':
+            opts->sample_rate = atof(arg);
+            break;
+        case 'x':
+            opts->speed = atof(arg);
+            break;
+        case 'P':
+            opts->psd = 1;
+            if (parse_psd_options(arg, &opts->psd_opts) != 0)
+            {
+                fprintf(stderr, "Bad PSD spec: %s\n", arg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'i':
+            opts->input = arg;
+            break;
+        case 'w':
+            opts->record_path = arg;
+            break;
+        case 'q':
+            if (parse_overload_policy(arg, &opts->policy, &opts->decimate) != 0)
+            {
+                fprintf(stderr, "Bad overload policy: %s\n", arg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'y':
+            if (parse_framer_options(arg, &opts->framing) != 0)
+            {
+                fprintf(stderr, "Bad sync spec: %s\n", arg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'u':
+            opts->uring = 1;
+            break;
+        case 'T':
+            opts->capture = 1;
+            if (parse_capture_options(arg, &opts->capture_opts) != 0)
+            {
+                fprintf(stderr, "Bad capture spec: %s\n", arg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'R':
+            opts->resample = 1;
+            if (parse_resample_options(arg, &opts->resample_opts) != 0)
+            {
+                fprintf(stderr, "Bad resample spec: %s\n", arg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'L':
+            if (opts->nplugins == PLUGIN_MAX_STAGES)
+            {
+                fprintf(stderr, "At most %d plugins\n", PLUGIN_MAX_STAGES);
+                exit(EXIT_FAILURE);
+            }
+            opts->plugin_specs[opts->nplugins++] = arg;
+            break;
+        case 'F':
+            if (parse_file_format(arg, &opts->format) != 0)
+            {
+                fprintf(stderr, "Unknown format: %s\n", arg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            return 0;
+    }
+    return 1;
+}
+
+static int is_file_input(const char* input)
+{
+    return input != NULL && strcmp(input, "-") != 0 && strstr(input, "://") == NULL;
+}
+
+// Whatever the file header says wins over the command line, except for a
+// sample rate given with -s
+static void apply_file_info(IngestOptions* opts, const MappedFile* info)
+{
+    opts->format = info->format;
+    opts->swapped = info->swapped;
+    if (info->typed)
+    {
+        opts->type = info->type;
+    }
+    if (info->frame_size > 0)
+    {
+        opts->frame_size = info->frame_size;
+    }
+    if (info->sample_rate > 0.0 && opts->sample_rate <= 0.0)
+    {
+        opts->sample_rate = info->sample_rate;
+    }
+}
+
+// Same idea as apply_file_info() for a shared memory ring
+static void apply_shm_info(IngestOptions* opts, const ShmRing* shm)
+{
+    opts->format = FORMAT_RAW;
+    opts->swapped = 0;
+    opts->type = (DataType)shm->header->data_type;
+    opts->frame_size = shm->header->frame_size;
+    if (shm->header->sample_rate > 0.0 && opts->sample_rate <= 0.0)
+    {
+        opts->sample_rate = shm->header->sample_rate;
+    }
+}
+
+static void resolve_input_info(IngestOptions* opts)
+{
+    if (opts->input && strncmp(opts->input, "shm://", 6) == 0)
+    {
+        ShmRing shm;
+        if (open_shm_ring(&shm, opts->input + 6) == 0)
+        {
+            apply_shm_info(opts, &shm);
+            close_shm_ring(&shm);
+        }
+        return;
+    }
+    MappedFile info;
+    if (!is_file_input(opts->input) || probe_file(opts->input, &info) != 0) return;
+    apply_file_info(opts, &info);
+    if (info.format == FORMAT_BLUE)
+    {
+        const BlueFile* blue = &info.blue;
+        // data_rep follows head_rep at the start of the header
+        printf("blue header    : type %d, format %.2s, data_rep %.4s\n", blue->type, blue->format, blue->header + 4);
+        printf("x axis         : %g + %g * i (units %d)\n", blue->xstart, blue->xdelta, blue->xunits);
+        if (blue->type / 1000 == 2)
+        {
+            printf("y axis         : %g + %g * i (units %d)\n", blue->ystart, blue->ydelta, blue->yunits);
+        }
+    }
+}
+
+void resolve_ingest_input(IngestOptions* opts)
+{
+    resolve_input_info(opts);
+    if (opts->resample && resampled_input_size(opts) * opts->resample_opts.down % opts->resample_opts.up != 0)
+    {
+        fprintf(stderr, "Resampling by %u/%u needs frames of a multiple of %u samples\n",
+                opts->resample_opts.up, opts->resample_opts.down, opts->resample_opts.up);
+        exit(EXIT_FAILURE);
+    }
+    if (opts->nplugins > 0 && load_plugin_chain(&opts->plugins, opts->plugin_specs, opts->nplugins,
+                convert_frame_size(opts), ingest_sample_rate(opts), opts->psd) != 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+}
+
+void print_ingest_options(const IngestOptions* opts)
+{
+    printf("input          : %s%s\n", opts->input ? opts->input : "stdin",
+            opts->format == FORMAT_DSP_DATA ? " (DSP_DATA)" : opts->format == FORMAT_BLUE ? " (BLUE)" : "");
+    printf("frame size     : %lu\n", (unsigned long)ingest_frame_size(opts));
+    printf("data type      : %s\n", datatype_name(opts->type));
+    printf("convert        : x * %g + %g (%s)\n", opts->scale, opts->offset, convert_isa());
+    if (opts->policy == OVERLOAD_DECIMATE) {
+        printf("overload       : decimate by %lu\n", (unsigned long)opts->decimate);
+    } else {
+        printf("overload       : %s\n", opts->policy == OVERLOAD_DROP ? "drop oldest" : "block");
+    }
+    if (opts->framing.sync_bytes > 0)
+    {
+        printf("frame sync     : 0x%0*lx, %d byte sequence number\n", 2 * opts->framing.sync_bytes,
+                (unsigned long)opts->framing.sync, opts->framing.seq_bytes);
+    }
+    if (opts->uring)
+    {
+        printf("io             : %s\n", uring_available() ? "io_uring" : "read/mmap, no io_uring");
+    }
+    if (opts->capture)
+    {
+        const CaptureOptions* c = &opts->capture_opts;
+        char pre[32], post[32];
+        if (c->pre_seconds > 0.0) snprintf(pre, sizeof(pre), "%gs", c->pre_seconds);
+        else snprintf(pre, sizeof(pre), "%lu bytes", (unsigned long)c->pre_bytes);
+        if (c->post_seconds > 0.0) snprintf(post, sizeof(post), "%gs", c->post_seconds);
+        else snprintf(post, sizeof(post), "%lu bytes", (unsigned long)c->post_bytes);
+        printf("capture        : %s before, %s after, to %s", pre, post, c->dir);
+        if (c->level_enabled) printf(", level %g", c->level);
+        if (c->fifo[0] != '\0') printf(", fifo %s", c->fifo);
+        printf("\n");
+    }
+    if (opts->format == FORMAT_DSP_DATA)
+    {
+        printf("crc32          : %s\n", crc32_isa());
+    }
+    if (opts->resample)
+    {
+        const ResampleOptions* r = &opts->resample_opts;
+        printf("resample       : %u/%u, %u taps per phase, %g dB (%s)\n", r->up, r->down,
+                resample_taps(r), r->atten, resample_isa());
+    }
+    if (opts->psd)
+    {
+        const PsdOptions* p = &opts->psd_opts;
+        printf("psd            : nfft %lu, overlap %g, avg %lu, alpha %g, %s, %d threads\n",
+                (unsigned long)p->nfft, p->overlap, (unsigned long)p->navg, p->alpha,
+                p->db ? "dB" : "linear", p->nthreads);
+    }
+    for (int i = 0; i < opts->plugins.n; i++)
+    {
+        const PluginStage* s = &opts->plugins.stages[i];
+        printf("plugin         : %s, %lu -> %lu%s\n", s->api->name, (unsigned long)s->in_size,
+                (unsigned long)s->out_size, s->in_place ? " in place" : "");
+    }
+}
+
+static void init_ingest(Ingest* ingest, SourceKind kind, const IngestOptions* opts, double frame_rate)
+{
+    ingest->kind = kind;
+    ingest->type = opts->type;
+    ingest->swapped = opts->swapped;
+    ingest->scale = opts->scale;
+    ingest->offset = opts->offset;
+    ingest->raw_frame_bytes = ingest_input_size(opts) * datatype_size(opts->type);
+    ingest->convert_size = convert_frame_size(opts);
+    ingest->policy = opts->policy;
+    ingest->decimate = opts->decimate;
+    ingest->decimate_phase = 0;
+    ingest->framing = opts->framing;
+    ingest->uring = opts->uring;
+    ingest->direct = 0;
+    ingest->ring = new_frame_ring(INGEST_RING_SLOTS, ingest_frame_size(opts));
+    ingest->resample_enabled = opts->resample;
+    if (opts->resample)
+    {
+        ingest->resampler = new_resampler(&opts->resample_opts, opts->type, opts->swapped,
+                resampled_input_size(opts), INGEST_RING_SLOTS);
+    }
+    ingest->psd_enabled = opts->psd;
+    if (opts->psd)
+    {
+        // Spectra of the resampler's output if there is one
+        DataType type = opts->resample ? resampled_type(opts->type) : opts->type;
+        int swapped = opts->resample ? 0 : opts->swapped;
+        start_psd(&ingest->psd, &opts->psd_opts, type, swapped, INGEST_RING_SLOTS);
+    }
+    ingest->plugins = opts->plugins;
+    ingest->staging = NULL;
+    if (ingest->plugins.n > 0 && ingest->plugins.out_size != ingest->convert_size)
+    {
+        ingest->staging = (float*)malloc(INGEST_RING_SLOTS * ingest->convert_size * sizeof(float));
+        if (!ingest->staging)
+        {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    atomic_init(&ingest->frame_rate, frame_rate);
+    ingest->nominal_rate = playback_frame_rate(opts->sample_rate, 1.0, ingest_input_size(opts));
+    atomic_init(&ingest->paused, 0);
+    atomic_init(&ingest->seek, -1);
+    atomic_init(&ingest->position, 0);
+    atomic_init(&ingest->running, 1);
+    atomic_init(&ingest->eof, 0);
+    // Only sockets have anything to wait for
+    atomic_init(&ingest->connected, kind != SOURCE_UDP && kind != SOURCE_TCP);
+    atomic_init(&ingest->stats.received, 0);
+    atomic_init(&ingest->stats.displayed, 0);
+    atomic_init(&ingest->stats.dropped, 0);
+    atomic_init(&ingest->stats.packets, 0);
+    atomic_init(&ingest->stats.bytes, 0);
+    atomic_init(&ingest->stats.lost, 0);
+    atomic_init(&ingest->stats.reordered, 0);
+    atomic_init(&ingest->stats.overflows, 0);
+    atomic_init(&ingest->stats.truncated, 0);
+    atomic_init(&ingest->stats.records, 0);
+    atomic_init(&ingest->stats.crc_errors, 0);
+    atomic_init(&ingest->stats.resyncs, 0);
+    atomic_init(&ingest->stats.gaps, 0);
+    atomic_init(&ingest->stats.skipped, 0);
+    ingest->format = opts->format;
+    ingest->dsp = new_dsp_data_parser();
+    ingest->sample_rate = opts->sample_rate;
+    pthread_mutex_init(&ingest->record_lock, NULL);
+    ingest->recorder = NULL;
+    ingest->capture_enabled = 0;
+    if (opts->capture)
+    {
+        const CaptureOptions* c = &opts->capture_opts;
+        if ((c->pre_seconds > 0.0 || c->post_seconds > 0.0) && opts->sample_rate <= 0.0)
+        {
+            fprintf(stderr, "Capture lengths in seconds need a sample rate (-s)\n");
+            exit(EXIT_FAILURE);
+        }
+        if (opts->swapped)
+        {
+            fprintf(stderr, "Can't capture byte swapped input\n");
+            exit(EXIT_FAILURE);
+        }
+        if (start_capture(&ingest->capture, c, opts->type, opts->sample_rate, ingest->raw_frame_bytes) != 0)
+        {
+            fprintf(stderr, "Can't start capture: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        ingest->capture_enabled = 1;
+    }
+    // Before the reader starts so the recording misses nothing
+    if (opts->record_path && start_recording(ingest, opts->record_path) != 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void spawn_ingest(Ingest* ingest, void* (*thread)(void*))
+{
+    int err = pthread_create(&ingest->thread, NULL, thread, ingest);
+    if (err != 0)
+    {
+        fprintf(stderr, "pthread_create() failed: %d\n", err);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Reader for a byte stream, pipe or TCP
+static void* (*stream_thread(const Ingest* ingest))(void*)
+{
+    if (ingest->type == F32 && ingest->scale == 1.0f && ingest->offset == 0.0f && !ingest->psd_enabled
+            && ingest->format == FORMAT_RAW && ingest->policy == OVERLOAD_BLOCK
+            && ingest->framing.sync_bytes == 0 && !ingest->uring && !ingest->resample_enabled
+            && ingest->plugins.n == 0) {
+        // Native floats can go straight from the pipe into the ring, which
+        // only works if the ring is allowed to push back
+        return ingest_thread;
+    }
+    return ingest_convert_thread;
+}
+
+// Opens the socket on the reader thread, since a TCP one can wait on its
+// peer for as long as it likes, then reads it like any other source
+static void* socket_thread(void* arg)
+{
+    Ingest* ingest = (Ingest*)arg;
+    int fd = open_socket(&ingest->net, &ingest->running);
+    if (fd == -1)
+    {
+        // Stopped before anyone connected
+        atomic_store(&ingest->eof, 1);
+        return NULL;
+    }
+    ingest->fd = fd;
+    atomic_store(&ingest->connected, 1);
+    return ingest->net.udp ? udp_thread(arg) : stream_thread(ingest)(arg);
+}
+
+void start_ingest(Ingest* ingest, int fd, const IngestOptions* opts)
+{
+    init_ingest(ingest, SOURCE_FD, opts, 0.0);
+    ingest->fd = fd;
+    ingest->nframes = 0;
+    spawn_ingest(ingest, stream_thread(ingest));
+}
+
+void start_playback(Ingest* ingest, const char* filename, const IngestOptions* opts)
+{
+    MappedFile file = map_file(filename);
+    IngestOptions resolved = *opts;
+    apply_file_info(&resolved, &file);
+    opts = &resolved;
+
+    double frame_rate = playback_frame_rate(opts->sample_rate, opts->speed, ingest_input_size(opts));
+    init_ingest(ingest, SOURCE_FILE, opts, frame_rate);
+    ingest->fd = -1;
+    if (opts->uring)
+    {
+        // The mapping stays for the header and seeking, the samples get read
+        // around the page cache where the file system lets us
+        ingest->fd = open(filename, O_RDONLY | O_DIRECT);
+        if (ingest->fd == -1)
+        {
+            ingest->fd = open(filename, O_RDONLY);
+        }
+    }
+    ingest->file = file;
+    ingest->nframes = ingest->file.data_nbytes / ingest->raw_frame_bytes;
+    spawn_ingest(ingest, playback_thread);
+}
+
+void start_socket(Ingest* ingest, const SocketUri* uri, const IngestOptions* opts)
+{
+    init_ingest(ingest, uri->udp ? SOURCE_UDP : SOURCE_TCP, opts, 0.0);
+    ingest->net = *uri;
+    ingest->fd = -1;
+    ingest->nframes = 0;
+    spawn_ingest(ingest, socket_thread);
+}
+
+void start_shm(Ingest* ingest, const char* name, const IngestOptions* opts)
+{
+    ShmRing shm;
+    if (open_shm_ring(&shm, name) != 0)
+    {
+        fprintf(stderr, "Can't open shared memory ring %s: %s\n", name, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    IngestOptions resolved = *opts;
+    apply_shm_info(&resolved, &shm);
+    opts = &resolved;
+
+    init_ingest(ingest, SOURCE_SHM, opts, 0.0);
+    ingest->fd = -1;
+    ingest->nframes = 0;
+    ingest->shm = shm;
+    // Join live, whatever is already in the ring is old news
+    ingest->shm_cursor = shm_ring_write_index(&shm);
+    ingest->shm_seen = ingest->shm_cursor;
+    // Lets the producer see how this viewer is doing, nothing else needs it
+    register_shm_reader(&ingest->shm, ingest->shm_cursor);
+    ingest->shm_copy = NULL;
+    if (opts->type == F32 && opts->scale == 1.0f && opts->offset == 0.0f && !opts->psd
+            && opts->policy != OVERLOAD_DECIMATE && !opts->resample && opts->plugins.n == 0) {
+        // Frames are taken straight out of the ring as the viewer asks for
+        // them, one at a time so each is checked just before it's used
+        ingest->direct = 1;
+        ingest->shm_copy = (float*)malloc(shm.frame_bytes);
+        if (!ingest->shm_copy)
+        {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        spawn_ingest(ingest, shm_thread);
+    }
+}
+
+void start_source(Ingest* ingest, const IngestOptions* opts)
+{
+    const char* input = opts->input;
+    SocketUri uri;
+    if (input == NULL || strcmp(input, "-") == 0) {
+        start_ingest(ingest, 0, opts);
+    } else if (parse_socket_uri(input, &uri) == 0) {
+        start_socket(ingest, &uri, opts);
+    } else if (strncmp(input, "shm://", 6) == 0) {
+        start_shm(ingest, input + 6, opts);
+    } else if (!is_file_input(input)) {
+        fprintf(stderr, "Bad input URI: %s\n", input);
+        exit(EXIT_FAILURE);
+    } else if (opts->framing.sync_bytes > 0) {
+        // Sync words only mean anything to the stream reader, so the file
+        // gets streamed through it rather than played back
+        int fd = open(input, O_RDONLY);
+        if (fd == -1)
+        {
+            perror(input);
+            exit(EXIT_FAILURE);
+        }
+        start_ingest(ingest, fd, opts);
+    } else {
+        start_playback(ingest, input, opts);
+    }
+}
+
+void stop_ingest(Ingest* ingest)
+{
+    atomic_store(&ingest->running, 0);
+    if (!ingest->direct)
+    {
+        pthread_join(ingest->thread, NULL);
+    }
+    stop_recording(ingest);
+    if (ingest->capture_enabled)
+    {
+        stop_capture(&ingest->capture);
+    }
+    pthread_mutex_destroy(&ingest->record_lock);
+    free_frame_ring(&ingest->ring);
+    if (ingest->psd_enabled)
+    {
+        stop_psd(&ingest->psd);
+    }
+    if (ingest->resample_enabled)
+    {
+        free_resampler(&ingest->resampler);
+    }
+    if (ingest->plugins.n > 0)
+    {
+        close_plugin_chain(&ingest->plugins);
+    }
+    free(ingest->staging);
+    free_dsp_data_parser(&ingest->dsp);
+    if (ingest->kind == SOURCE_FILE) {
+        unmap_file(&ingest->file);
+        if (ingest->fd != -1)
+        {
+            close(ingest->fd);
+        }
+    } else if (ingest->kind == SOURCE_SHM) {
+        free(ingest->shm_copy);
+        close_shm_ring(&ingest->shm);
+    } else if (ingest->fd != -1 && (ingest->kind != SOURCE_FD || ingest->fd != 0)) {
+        close(ingest->fd);
+    }
+}
+
+// ingest_ready() for frames read straight out of shm. Only the newest half
+// of the ring is offered, which leaves the producer half a ring to go before
+// it overwrites one. It doesn't wait though, so each frame still gets
+// checked once it's copied out.
+static uint64_t shm_ready(Ingest* ingest)
+{
+    ShmRing* shm = &ingest->shm;
+    uint64_t slack = (shm->mask + 1) / 2;
+    uint64_t w = shm_ring_write_index(shm);
+    atomic_fetch_add_explicit(&ingest->stats.received, w - ingest->shm_seen, memory_order_relaxed);
+    ingest->shm_seen = w;
+    if (w - ingest->shm_cursor > slack)
+    {
+        uint64_t nskipped = w - ingest->shm_cursor - slack;
+        atomic_fetch_add_explicit(&ingest->stats.dropped, nskipped, memory_order_relaxed);
+        ingest->shm_cursor += nskipped;
+    }
+    if (w == ingest->shm_cursor && shm_ring_closed(shm))
+    {
+        atomic_store(&ingest->eof, 1);
+    }
+    return w - ingest->shm_cursor;
+}
+
+// Copies direct shm frame `index` out of its slot. Returns the copy, valid
+// until the next call, or NULL if the producer may have overwritten the
+// frame along the way.
+static const float* copy_shm_frame(Ingest* ingest, uint64_t index)
+{
+    memcpy(ingest->shm_copy, shm_ring_frame(&ingest->shm, index), ingest->shm.frame_bytes);
+    if (index < shm_ring_oldest_intact(&ingest->shm)) return NULL;
+    return ingest->shm_copy;
+}
+
+// Direct shm frames are recorded as the viewer takes them, there's no reader
+// thread to do it. Frames the producer may have overwritten since they were
+// offered could have reached the viewer torn, so they count as dropped even
+// if `shown`.
+static void take_shm_frames(Ingest* ingest, uint64_t nframes, int shown)
+{
+    if (ingest->recorder || ingest->capture_enabled)
+    {
+        for (uint64_t i = 0; i < nframes; i++)
+        {
+            const float* frame = copy_shm_frame(ingest, ingest->shm_cursor + i);
+            if (!frame) continue;
+            record_raw(ingest, frame, ingest->shm.frame_bytes);
+            check_capture_level(ingest, frame, 1);
+        }
+    }
+    // The oldest intact frame only ever moves forward, so anything torn along
+    // the way is before it now
+    uint64_t oldest = shm_ring_oldest_intact(&ingest->shm);
+    uint64_t end = ingest->shm_cursor + nframes;
+    uint64_t nlapped = oldest <= ingest->shm_cursor ? 0 : (oldest < end ? oldest : end) - ingest->shm_cursor;
+    ingest->shm_cursor = end;
+    uint64_t ndropped = shown ? nlapped : nframes;
+    atomic_fetch_add_explicit(&ingest->stats.displayed, nframes - ndropped, memory_order_relaxed);
+    atomic_fetch_add_explicit(&ingest->stats.dropped, ndropped, memory_order_relaxed);
+    shm_reader_update(&ingest->shm, ingest->shm_cursor, atomic_load(&ingest->stats.dropped));
+}
+
+uint64_t ingest_ready(Ingest* ingest)
+{
+    if (ingest->direct) return shm_ready(ingest);
+    uint64_t nskipped = frame_ring_skip(&ingest->ring);
+    if (nskipped > 0)
+    {
+        atomic_fetch_add_explicit(&ingest->stats.dropped, nskipped, memory_order_relaxed);
+    }
+    return frame_ring_readable(&ingest->ring);
+}
+
+const float* ingest_frame(Ingest* ingest, uint64_t offset)
+{
+    if (ingest->direct) return copy_shm_frame(ingest, ingest->shm_cursor + offset);
+    return frame_ring_read_ptr(&ingest->ring, offset);
+}
+
+uint64_t ingest_queued(Ingest* ingest, uint64_t* capacity)
+{
+    if (ingest->direct)
+    {
+        *capacity = (ingest->shm.mask + 1) / 2;
+        return ingest->shm_seen - ingest->shm_cursor;
+    }
+    *capacity = ingest->ring.nslots;
+    return frame_ring_readable(&ingest->ring);
+}
+
+void ingest_consume(Ingest* ingest, uint64_t nframes)
+{
+    if (ingest->direct)
+    {
+        take_shm_frames(ingest, nframes, 1);
+        return;
+    }
+    frame_ring_consume(&ingest->ring, nframes);
+    atomic_fetch_add_explicit(&ingest->stats.displayed, nframes, memory_order_relaxed);
+}
+
+void ingest_drop(Ingest* ingest, uint64_t nframes)
+{
+    if (ingest->direct)
+    {
+        take_shm_frames(ingest, nframes, 0);
+        return;
+    }
+    frame_ring_consume(&ingest->ring, nframes);
+    atomic_fetch_add_explicit(&ingest->stats.dropped, nframes, memory_order_relaxed);
+}
+
+double playback_frame_rate(double sample_rate, double speed, uint64_t frame_size)
+{
+    if (speed <= 0.0) return 0.0;
+    if (sample_rate <= 0.0) return speed * DEFAULT_PLAYBACK_FPS;
+    return speed * sample_rate / frame_size;
+}
+
+void seek_ingest(Ingest* ingest, int64_t frame)
+{
+    if (ingest->kind != SOURCE_FILE) return;
+    if (frame < 0) frame = 0;
+    if (frame > (int64_t)ingest->nframes) frame = ingest->nframes;
+    atomic_store(&ingest->seek, frame);
+    // Reflect the jump right away so the UI doesn't lag the producer
+    atomic_store(&ingest->position, frame);
+}
+
+void set_ingest_rate(Ingest* ingest, double frame_rate)
+{
+    atomic_store(&ingest->frame_rate, frame_rate);
+}
+
+void scale_ingest_rate(Ingest* ingest, double factor)
+{
+    // Flat out has no rate to scale, so start from real time
+    double rate = atomic_load(&ingest->frame_rate);
+    rate = (rate > 0.0 ? rate : ingest->nominal_rate) * factor;
+    double lo = MIN_PLAYBACK_SPEED * ingest->nominal_rate;
+    double hi = MAX_PLAYBACK_SPEED * ingest->nominal_rate;
+    set_ingest_rate(ingest, rate < lo ? lo : rate > hi ? hi : rate);
+}
+
+void toggle_ingest_pause(Ingest* ingest)
+{
+    atomic_fetch_xor(&ingest->paused, 1);
+}
+
+int start_recording(Ingest* ingest, const char* path)
+{
+    if (ingest->swapped)
+    {
+        fprintf(stderr, "Can't record byte swapped input\n");
+        return -1;
+    }
+
+    char name[64];
+    if (path == NULL)
+    {
+        time_t now = time(NULL);
+        struct tm tm;
+        localtime_r(&now, &tm);
+        strftime(name, sizeof(name), "capture-%Y%m%d-%H%M%S.dsp", &tm);
+        path = name;
+    }
+
+    Recorder* rec = (Recorder*)malloc(sizeof(Recorder));
+    if (!rec)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    if (start_recorder(rec, path, ingest->type, ingest->sample_rate) != 0)
+    {
+        fprintf(stderr, "Can't record to %s: %s\n", path, strerror(errno));
+        free(rec);
+        return -1;
+    }
+    printf("recording to %s\n", rec->path);
+
+    pthread_mutex_lock(&ingest->record_lock);
+    Recorder* old = ingest->recorder;
+    ingest->recorder = rec;
+    pthread_mutex_unlock(&ingest->record_lock);
+    if (old)
+    {
+        stop_recorder(old);
+        free(old);
+    }
+    return 0;
+}
+
+void stop_recording(Ingest* ingest)
+{
+    // Detach first so the final flush doesn't hold up the reader thread
+    pthread_mutex_lock(&ingest->record_lock);
+    Recorder* rec = ingest->recorder;
+    ingest->recorder = NULL;
+    pthread_mutex_unlock(&ingest->record_lock);
+    if (!rec) return;
+
+    stop_recorder(rec);
+    printf("recorded %lu bytes to %s\n", (unsigned long)rec->nbytes_data, rec->path);
+    free(rec);
+}
+
+void toggle_recording(Ingest* ingest)
+{
+    if (ingest->recorder) {
+        stop_recording(ingest);
+    } else {
+        start_recording(ingest, NULL);
+    }
+}
+
+void trigger_ingest_capture(Ingest* ingest)
+{
+    if (!ingest->capture_enabled) return;
+    if (atomic_load(&ingest->capture.busy)) {
+        printf("capture already in progress\n");
+    } else {
+        trigger_capture(&ingest->capture);
+    }
+}
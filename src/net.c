@@ -0,0 +1,253 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "net.h"
+
+// How often a socket that's waiting for its connection checks it should stop
+#define NET_POLL_MS 100
+
+int parse_socket_uri(const char* uri, SocketUri* out)
+{
+    const char* rest;
+    if (strncmp(uri, "udp://", 6) == 0) {
+        out->udp = 1;
+        rest = uri + 6;
+    } else if (strncmp(uri, "tcp://", 6) == 0) {
+        out->udp = 0;
+        rest = uri + 6;
+    } else {
+        return -1;
+    }
+    out->rcvbuf = 0;
+    out->seq_bytes = 0;
+    out->batch = 64;
+    out->max_datagram = 65536;
+
+    char buffer[512];
+    if (strlen(rest) >= sizeof(buffer)) return -1;
+    memcpy(buffer, rest, strlen(rest) + 1);
+    char* query = strchr(buffer, '?');
+    if (query)
+    {
+        *query++ = '\0';
+    }
+
+    // host:port, host may be a bracketed IPv6 address
+    char* host = buffer;
+    char* port;
+    if (host[0] == '[') {
+        char* end = strchr(host, ']');
+        if (!end || end[1] != ':') return -1;
+        *end = '\0';
+        host++;
+        port = end + 2;
+    } else {
+        port = strrchr(host, ':');
+        if (!port) return -1;
+        *port++ = '\0';
+    }
+    if (port[0] == '\0') return -1;
+    if (strlen(host) >= sizeof(out->host) || strlen(port) >= sizeof(out->port)) return -1;
+    memcpy(out->host, host, strlen(host) + 1);
+    memcpy(out->port, port, strlen(port) + 1);
+
+    for (char* tok = query ? strtok(query, "&") : NULL; tok != NULL; tok = strtok(NULL, "&"))
+    {
+        char* value = strchr(tok, '=');
+        if (!value) return -1;
+        *value++ = '\0';
+        if (strcmp(tok, "rcvbuf") == 0) {
+            out->rcvbuf = atoi(value);
+        } else if (strcmp(tok, "seq") == 0) {
+            if (strcmp(value, "u32") == 0) out->seq_bytes = 4;
+            else if (strcmp(value, "u64") == 0) out->seq_bytes = 8;
+            else if (strcmp(value, "none") == 0) out->seq_bytes = 0;
+            else return -1;
+        } else if (strcmp(tok, "batch") == 0) {
+            out->batch = atoi(value);
+        } else if (strcmp(tok, "mtu") == 0) {
+            out->max_datagram = atoi(value);
+        } else {
+            return -1;
+        }
+    }
+    if (out->batch < 1 || out->max_datagram <= out->seq_bytes) return -1;
+    return 0;
+}
+
+static int is_wildcard(const char* host)
+{
+    return host[0] == '\0' || strcmp(host, "0.0.0.0") == 0 || strcmp(host, "::") == 0;
+}
+
+static void set_rcvbuf(int fd, int rcvbuf)
+{
+    if (rcvbuf <= 0) return;
+    // FORCE goes past rmem_max but needs CAP_NET_ADMIN, fall back quietly
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) == -1)
+    {
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) == -1)
+        {
+            perror("setsockopt[SO_RCVBUF]");
+        }
+    }
+    int actual = 0;
+    socklen_t len = sizeof(actual);
+    getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &actual, &len);
+    printf("receive buffer : %d bytes\n", actual);
+}
+
+static void set_nonblocking(int fd, int nonblocking)
+{
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fcntl(fd, F_SETFL, nonblocking ? flags | O_NONBLOCK : flags & ~O_NONBLOCK) == -1)
+    {
+        perror("fcntl");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Waits for `events` on `fd` as long as `running` stays set. Returns 1 once
+// they come, 0 if told to stop first.
+static int wait_for_socket(int fd, short events, const atomic_int* running)
+{
+    struct pollfd pfd = { .fd = fd, .events = events };
+    while (atomic_load(running))
+    {
+        int ret = poll(&pfd, 1, NET_POLL_MS);
+        if (ret > 0)
+        {
+            return 1;
+        } else if (ret == -1 && errno != EINTR) {
+            perror("poll");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return 0;
+}
+
+// Connects without blocking so the wait can be called off. Returns 0 when
+// connected, -1 if the connection failed or `running` was cleared, with
+// *stopped set for the latter.
+static int connect_socket(int fd, const struct addrinfo* ai, const atomic_int* running, int* stopped)
+{
+    set_nonblocking(fd, 1);
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == -1)
+    {
+        if (errno != EINPROGRESS) return -1;
+        if (!wait_for_socket(fd, POLLOUT, running))
+        {
+            *stopped = 1;
+            return -1;
+        }
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err != 0) return -1;
+    }
+    set_nonblocking(fd, 0);
+    return 0;
+}
+
+// Takes the first connection on a listening socket, -1 if `running` was
+// cleared before one came
+static int accept_socket(int fd, const atomic_int* running)
+{
+    set_nonblocking(fd, 1);
+    while (wait_for_socket(fd, POLLIN, running))
+    {
+        int conn = accept(fd, NULL, NULL);
+        if (conn != -1)
+        {
+            // Linux doesn't pass O_NONBLOCK on, but not every system agrees
+            set_nonblocking(conn, 0);
+            return conn;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+        {
+            perror("accept");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return -1;
+}
+
+int open_socket(const SocketUri* uri, const atomic_int* running)
+{
+    int listening = !uri->udp && is_wildcard(uri->host);
+    struct addrinfo hints = { 0 };
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = uri->udp ? SOCK_DGRAM : SOCK_STREAM;
+    hints.ai_flags = (uri->udp || listening) ? AI_PASSIVE : 0;
+
+    struct addrinfo* res;
+    const char* host = uri->host[0] == '\0' ? NULL : uri->host;
+    int err = getaddrinfo(host, uri->port, &hints, &res);
+    if (err != 0)
+    {
+        fprintf(stderr, "getaddrinfo(%s:%s) failed: %s\n", uri->host, uri->port, gai_strerror(err));
+        exit(EXIT_FAILURE);
+    }
+
+    int fd = -1;
+    int stopped = 0;
+    for (struct addrinfo* ai = res; ai != NULL; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd == -1) continue;
+
+        // Set before bind/connect so TCP can negotiate a matching window
+        set_rcvbuf(fd, uri->rcvbuf);
+
+        if (uri->udp || listening) {
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        } else {
+            if (connect_socket(fd, ai, running, &stopped) == 0) break;
+        }
+        close(fd);
+        fd = -1;
+        if (stopped) break;
+    }
+    freeaddrinfo(res);
+    if (stopped) return -1;
+    if (fd == -1)
+    {
+        fprintf(stderr, "Could not open %s://%s:%s\n", uri->udp ? "udp" : "tcp", uri->host, uri->port);
+        exit(EXIT_FAILURE);
+    }
+
+    if (listening)
+    {
+        if (listen(fd, 1) == -1)
+        {
+            perror("listen");
+            exit(EXIT_FAILURE);
+        }
+        printf("waiting for a connection on port %s\n", uri->port);
+        int conn = accept_socket(fd, running);
+        close(fd);
+        if (conn == -1) return -1;
+        fd = conn;
+    }
+
+    if (uri->udp)
+    {
+        // Have the kernel tell us how many datagrams it dropped on the floor
+        int one = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)) == -1)
+        {
+            perror("setsockopt[SO_RXQ_OVFL]");
+        }
+    }
+
+    return fd;
+}
@@ -1,5 +1,3 @@
-#include <errno.h>
-#include <fcntl.h>
 #include <float.h>
 #include <math.h>
 #include <stdio.h>
@@ -8,7 +6,9 @@
 #include <unistd.h>
 
 #include "raylib.h"
+#include "binning.h"
 #include "common.h"
+#include "ingest.h"
 #include "grayscale_colormap.h"
 #include "inferno_colormap.h"
 #include "viridis_colormap.h"
@@ -44,41 +44,64 @@ ActiveScreen active_screen = MAIN;
 typedef struct Plot {
     float min_value;
     float max_value;
-    int32_t npoints;
-    int32_t max_points;
+    int32_t npoints;        // points to draw
+    int32_t max_points;     // bins per frame
+    BinMode bin_mode;
+    // With more bins in view than pixel columns each point is a column,
+    // and for the envelope lows holds the bottom of each
+    int binned;
     Vector2* points;
+    Vector2* lows;
+    float* hi;
+    float* lo;
 } Plot;
 
-// Allocates Color*, up to user to free
-Plot new_plot(uint32_t npoints)
+// Allocates points, lows and the column buffers, up to user to free
+Plot new_plot(uint32_t npoints, BinMode bin_mode)
 {
+    // Frames only get binned into fewer columns than they have points
     Vector2* buffer = (Vector2*)calloc(sizeof(Vector2), npoints);
+    Vector2* lows = (Vector2*)calloc(sizeof(Vector2), npoints);
+    float* hi = (float*)calloc(sizeof(float), npoints);
+    float* lo = (float*)calloc(sizeof(float), npoints);
+    if (!buffer || !lows || !hi || !lo)
+    {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
     Plot p = {
         .min_value = FLT_MAX,
         .max_value = FLT_MIN,
         .npoints = npoints,
         .max_points = npoints,
-        .points = buffer
+        .bin_mode = bin_mode,
+        .binned = 0,
+        .points = buffer,
+        .lows = lows,
+        .hi = hi,
+        .lo = lo,
     };
     return p;
 }
 
 void free_plot(Plot* p)
 {
-    if (p->points != NULL)
-    {
-        free(p->points);
-    }
+    free(p->points);
+    free(p->lows);
+    free(p->hi);
+    free(p->lo);
 }
 
-// Shallow copy, just passing the pointer along.
+// Maps the bins in view onto the screen, each bin's logical x being its
+// index. When there are more of them than pixel columns they're binned down
+// to one point (or min and max) per column first, so narrow peaks don't
+// get lost between pixels and nothing is drawn that can't be seen.
 void update_plot(const float* points, const uint64_t npoints, Screen* screen, Plot* plot)
 {
     plot->npoints = npoints;
     if (plot->npoints > plot->max_points) {
         plot->max_points = plot->npoints;
     }
-    float dx = (float)screen->width / (plot->npoints - 1);
 
     // Update plot range
     for (int i = 0; i < plot->npoints; i++)
@@ -99,45 +122,113 @@ void update_plot(const float* points, const uint64_t npoints, Screen* screen, Pl
     screen->zoom_stack[0].logical_height = range;
     screen->zoom_stack[0].logical_minx = 0.0;
     screen->zoom_stack[0].logical_width = (float)plot->max_points;
-    if (screen->zlevel > 0)
+
+    // Bins in view, one either side so the line runs off the edges
+    Zoom z = screen->zoom_stack[screen->zlevel];
+    double x0 = floor(z.logical_minx) - 1.0;
+    double x1 = ceil(z.logical_minx + z.logical_width) + 1.0;
+    uint64_t first = x0 < 0.0 ? 0 : (uint64_t)x0;
+    uint64_t last = x1 > (double)npoints ? npoints : (uint64_t)x1;
+    if (last <= first)
     {
-        range = screen->zoom_stack[screen->zlevel].logical_height;
+        plot->npoints = 0;
+        return;
     }
+    uint64_t nbins = last - first;
 
-    // Little fudge just to ensure range stays > 0.0
-    range += 1e-6;
+    uint64_t ncols = screen->width > 0 ? (uint64_t)screen->width : 1;
+    if (nbins <= ncols)
+    {
+        plot->binned = 0;
+        plot->npoints = nbins;
+        for (uint64_t i = 0; i < nbins; i++)
+        {
+            Vector2 pt = { (float)(first + i), points[first + i] };
+            plot->points[i] = to_pixels(pt, screen);
+        }
+        return;
+    }
 
-    float x = 0.0f;
-    for (int i = 0; i < plot->npoints; i++)
+    plot->binned = 1;
+    plot->npoints = ncols;
+    bin_columns(points + first, nbins, ncols, plot->bin_mode, plot->hi, plot->lo);
+    double bins_per_col = (double)nbins / ncols;
+    for (uint64_t c = 0; c < ncols; c++)
     {
-        Vector2 pt = { x, points[i] };
-        // Map each point onto logical space [0, 1.0)
-        Vector2 xy = to_pixels(pt, screen);
-        plot->points[i] = xy;
-        x += dx;
+        // Middle of the column's bins
+        float x = (float)(first + (c + 0.5) * bins_per_col - 0.5);
+        plot->points[c] = to_pixels((Vector2){ x, plot->hi[c] }, screen);
+        if (plot->bin_mode == BIN_ENVELOPE)
+        {
+            plot->lows[c] = to_pixels((Vector2){ x, plot->lo[c] }, screen);
+        }
+    }
+}
+
+// A line through the points, or for an envelope a bar from min to max in
+// every column with lines along the top and bottom to join them up
+void draw_plot(const Plot* plot)
+{
+    if (plot->npoints < 1) return;
+    if (plot->binned && plot->bin_mode == BIN_ENVELOPE)
+    {
+        for (int i = 0; i < plot->npoints; i++)
+        {
+            DrawLineV(plot->lows[i], plot->points[i], WHITE);
+        }
+        DrawLineStrip(plot->lows, plot->npoints, WHITE);
     }
+    DrawLineStrip(plot->points, plot->npoints, WHITE);
 }
 
 int main(int argc, char *argv[])
 {
     SetConfigFlags(FLAG_WINDOW_RESIZABLE);
+    IngestOptions ingest_opts = default_ingest_options(1024);
+    int c;
+    BinMode bin_mode = BIN_ENVELOPE;
+
+    while ((c = getopt(argc, argv, INGEST_OPTSTRING "B:")) != -1)
+    {
+        if (parse_ingest_option(c, optarg, &ingest_opts)) continue;
+        switch (c)
+        {
+            case 'B':
+                if (parse_bin_mode(optarg, &bin_mode) != 0)
+                {
+                    fprintf(stderr, "Unknown bin mode: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                abort();
+        }
+    }
+
+    if (optind < argc)
+    {
+        ingest_opts.input = argv[optind];
+    }
+    resolve_ingest_input(&ingest_opts);
+    print_ingest_options(&ingest_opts);
+    int frame_size = ingest_frame_size(&ingest_opts);
+    printf("column binning : %s (%s)\n", bin_mode_name(bin_mode), binning_isa());
 
     // Now set up our GUI
     InitWindow(screen.width, screen.height, "Plot");
     screen.width = GetScreenWidth();
     screen.height = GetScreenHeight();
-    Plot plot = new_plot(screen.width);
+    Plot plot = new_plot(frame_size, bin_mode);
     SetTargetFPS(60);
     Font font = LoadFont("resources/fonts/pixelplay.png");
 
-    float* points_buffer = (float*)calloc(sizeof(float), screen.width);
-
     RenderTexture2D rtex = LoadRenderTexture(screen.width, screen.height);
     Vector2 click_start = { 0, 0 };
     Vector2 click_end = { 0, 0 };
     int last_mouse = 0; // 0 - not pressed, 1 - pressed
 
-    fcntl(0, F_SETFL, fcntl(0, F_GETFL) | O_NONBLOCK);
+    Ingest ingest;
+    start_source(&ingest, &ingest_opts);
 
     while (!WindowShouldClose())
     {
@@ -149,41 +240,24 @@ int main(int argc, char *argv[])
             screen.height = GetScreenHeight();
 
             free_plot(&plot);
-            plot = new_plot(screen.width);
-
-            free(points_buffer);
-            points_buffer = (float*)calloc(sizeof(float), screen.width);
+            plot = new_plot(frame_size, bin_mode);
 
+            UnloadRenderTexture(rtex);
             rtex = LoadRenderTexture(screen.width, screen.height);
         }
 
-        int nelements = 0;
-        while (1)
+        // Take whatever complete frames the reader thread has queued up
+        uint64_t nready = ingest_ready(&ingest);
+        if (nready > 0)
         {
-            // Receive all queued up data and push to Raster before rendering frame
-            ssize_t nbytes = read(0, points_buffer, sizeof(float)*screen.width);
-            if (nbytes == 0)
+            // Only draw the most recent frame, the rest count as dropped
+            ingest_drop(&ingest, nready - 1);
+            const float* frame = ingest_frame(&ingest, 0);
+            if (frame)
             {
-                // EOF
-                break;
-            } else if (nbytes == -1) {
-                if (errno == EAGAIN)
-                {
-                    break;
-                } else {
-                    // Error
-                    perror("read");
-                    break;
-                }
-            }
-            nelements = nbytes / sizeof(float);
-            if (nelements > screen.width) {
-                // Received data got truncated down to buffer size
-                nelements = screen.width;
+                update_plot(frame, frame_size, &screen, &plot);
             }
-
-            // Only draw the most recent line
-            update_plot(points_buffer, nelements, &screen, &plot);
+            ingest_consume(&ingest, 1);
         }
 
         // TODO: Render all the data we have to a texture?
@@ -226,6 +300,9 @@ int main(int argc, char *argv[])
             ntags++;
         } else if (IsKeyPressed(KEY_Y)) {
             ntags = 0;
+        } else if (IsKeyPressed(KEY_B)) {
+            bin_mode = (bin_mode + 1) % (BIN_ENVELOPE + 1);
+            plot.bin_mode = bin_mode;
         } else if (IsKeyPressed(KEY_SPACE)) {
             if (active_screen == MAIN) {
                 active_screen = HELP;
@@ -233,6 +310,7 @@ int main(int argc, char *argv[])
                 active_screen = MAIN;
             }
         }
+        handle_ingest_keys(&ingest);
 
         // Draw
         BeginDrawing();
@@ -243,8 +321,10 @@ int main(int argc, char *argv[])
             DrawText("Controls", 20, 10, 20, WHITE);
             DrawText("t   - Draw Tag", 20, 40, 14, WHITE);
             DrawText("y   - Clear Tags", 20, 60, 14, WHITE);
-            DrawText("Click and Drag to zoom", 20, 80, 14, WHITE);
-            DrawText("Esc - Quit", 20, 100, 14, WHITE);
+            DrawText("b   - Next column binning", 20, 80, 14, WHITE);
+            DrawText("Click and Drag to zoom", 20, 100, 14, WHITE);
+            DrawText("Esc - Quit", 20, 120, 14, WHITE);
+            draw_ingest_help(&ingest, 150);
 
             DrawText("Tags", screen.width / 2, 10, 20, WHITE);
             for (size_t i = 0; i < ntags; i++)
@@ -254,7 +334,7 @@ int main(int argc, char *argv[])
             }
         } else {
             // Actual plot
-            DrawLineStrip(plot.points, plot.npoints, WHITE);
+            draw_plot(&plot);
 
             // Draw tagged positions
             draw_tags(global_tags, ntags, &screen);
@@ -270,15 +350,14 @@ int main(int argc, char *argv[])
 
             // Info panel
             draw_info_panel(&screen);
+            draw_ingest_info(&ingest, &screen);
         }
 
         EndDrawing();
     }
 
-    fcntl(0, F_SETFL, fcntl(0, F_GETFL) | ~O_NONBLOCK);
-
     // Clean up
-    free(points_buffer);
+    stop_ingest(&ingest);
     free_plot(&plot);
     UnloadRenderTexture(rtex);
     CloseWindow();
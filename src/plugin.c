@@ -0,0 +1,140 @@
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plugin.h"
+
+
+// Unwinds stages [0, n)
+static void close_stages(PluginChain* chain, int n)
+{
+    for (int i = n - 1; i >= 0; i--)
+    {
+        PluginStage* s = &chain->stages[i];
+        s->api->destroy(s->state);
+        dlclose(s->handle);
+    }
+    chain->n = 0;
+}
+
+static int load_stage(PluginStage* s, const char* spec, uint64_t frame_size, double sample_rate, int spectrum)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s", spec);
+    char* comma = strchr(path, ',');
+    const char* args = "";
+    if (comma)
+    {
+        *comma = '\0';
+        args = spec + (comma - path) + 1;
+    }
+
+    s->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!s->handle)
+    {
+        fprintf(stderr, "Can't load plugin: %s\n", dlerror());
+        return -1;
+    }
+    s->api = (const RasterPlugin*)dlsym(s->handle, "raster_plugin");
+    if (!s->api) {
+        fprintf(stderr, "%s: no raster_plugin symbol\n", path);
+    } else if (s->api->abi != RASTER_PLUGIN_ABI) {
+        fprintf(stderr, "%s: plugin ABI %u, expected %u\n", path, s->api->abi, RASTER_PLUGIN_ABI);
+    } else {
+        RasterPluginConfig config = {
+            .abi = RASTER_PLUGIN_ABI,
+            .frame_size = frame_size,
+            .sample_rate = sample_rate,
+            .spectrum = spectrum,
+            .args = args,
+            .out_frame_size = frame_size,
+            .in_place = 0,
+        };
+        s->state = s->api->init(&config);
+        if (!s->state) {
+            fprintf(stderr, "%s: plugin %s failed to start\n", path, s->api->name);
+        } else if (config.out_frame_size == 0) {
+            fprintf(stderr, "%s: plugin %s makes empty frames\n", path, s->api->name);
+            s->api->destroy(s->state);
+        } else {
+            s->in_size = frame_size;
+            s->out_size = config.out_frame_size;
+            // Growing a frame in place would run off the end of its buffer
+            s->in_place = config.in_place && s->out_size <= s->in_size;
+            return 0;
+        }
+    }
+    dlclose(s->handle);
+    return -1;
+}
+
+int load_plugin_chain(PluginChain* chain, const char* const* specs, int nspecs,
+        uint64_t frame_size, double sample_rate, int spectrum)
+{
+    chain->n = 0;
+    chain->in_size = frame_size;
+    chain->work[0] = NULL;
+    chain->work[1] = NULL;
+    if (nspecs > PLUGIN_MAX_STAGES)
+    {
+        fprintf(stderr, "At most %d plugins\n", PLUGIN_MAX_STAGES);
+        return -1;
+    }
+
+    uint64_t size = frame_size;
+    uint64_t max_size = frame_size;
+    for (int i = 0; i < nspecs; i++)
+    {
+        if (load_stage(&chain->stages[i], specs[i], size, sample_rate, spectrum) != 0)
+        {
+            close_stages(chain, i);
+            return -1;
+        }
+        size = chain->stages[i].out_size;
+        if (size > max_size) max_size = size;
+    }
+    chain->n = nspecs;
+    chain->out_size = size;
+
+    chain->work[0] = (float*)malloc(2 * max_size * sizeof(float));
+    if (!chain->work[0])
+    {
+        perror("malloc");
+        close_stages(chain, nspecs);
+        return -1;
+    }
+    chain->work[1] = chain->work[0] + max_size;
+    return 0;
+}
+
+void close_plugin_chain(PluginChain* chain)
+{
+    close_stages(chain, chain->n);
+    free(chain->work[0]);
+    chain->work[0] = NULL;
+    chain->work[1] = NULL;
+}
+
+void run_plugin_chain(PluginChain* chain, float* in, float* out)
+{
+    float* src = in;
+    for (int i = 0; i < chain->n; i++)
+    {
+        PluginStage* s = &chain->stages[i];
+        float* other = src == chain->work[0] ? chain->work[1] : chain->work[0];
+        float* dst;
+        if (i == chain->n - 1) {
+            dst = out == src && !s->in_place ? other : out;
+        } else {
+            dst = s->in_place ? src : other;
+        }
+        s->api->process(s->state, src, dst);
+        src = dst;
+    }
+    if (src != out)
+    {
+        memcpy(out, src, chain->out_size * sizeof(float));
+    }
+}
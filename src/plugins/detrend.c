@@ -0,0 +1,73 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plugin.h"
+
+// Example plugin, takes the least squares straight line out of each frame,
+// or with "mean" just the mean:
+//   ./waterfall -L ./libdetrend.so
+//   ./plot -L ./libdetrend.so,mean
+
+typedef struct Detrend {
+    uint64_t n;
+    int mean_only;
+    double sum_x;   // of 0..n-1
+    double det;     // n * sum(x^2) - sum(x)^2
+} Detrend;
+
+static void* detrend_init(RasterPluginConfig* config)
+{
+    Detrend* d = (Detrend*)malloc(sizeof(Detrend));
+    if (!d) return NULL;
+    d->n = config->frame_size;
+    d->mean_only = strcmp(config->args, "mean") == 0;
+    if (!d->mean_only && config->args[0] != '\0')
+    {
+        fprintf(stderr, "detrend: unknown option %s\n", config->args);
+        free(d);
+        return NULL;
+    }
+    double n = (double)d->n;
+    d->sum_x = n * (n - 1.0) / 2.0;
+    d->det = n * (n - 1.0) * n * (n + 1.0) / 12.0;
+    config->in_place = 1;
+    return d;
+}
+
+static void detrend_process(void* state, const float* in, float* out)
+{
+    const Detrend* d = (const Detrend*)state;
+    double sum_y = 0.0, sum_xy = 0.0;
+    for (uint64_t i = 0; i < d->n; i++)
+    {
+        sum_y += in[i];
+        sum_xy += (double)i * in[i];
+    }
+    float a, b;
+    if (d->mean_only || d->n < 2) {
+        a = (float)(sum_y / d->n);
+        b = 0.0f;
+    } else {
+        b = (float)((d->n * sum_xy - d->sum_x * sum_y) / d->det);
+        a = (float)((sum_y - b * d->sum_x) / d->n);
+    }
+    for (uint64_t i = 0; i < d->n; i++)
+    {
+        out[i] = in[i] - (a + b * (float)i);
+    }
+}
+
+static void detrend_destroy(void* state)
+{
+    free(state);
+}
+
+const RasterPlugin raster_plugin = {
+    .abi = RASTER_PLUGIN_ABI,
+    .name = "detrend",
+    .init = detrend_init,
+    .process = detrend_process,
+    .destroy = detrend_destroy,
+};
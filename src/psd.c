@@ -0,0 +1,442 @@
+#include <ctype.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "convert.h"
+#include "datatype.h"
+#include "fft.h"
+#include "psd.h"
+
+#define PSD_MAX_THREADS 16
+
+
+PsdOptions default_psd_options(void)
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    PsdOptions opts = {
+        .nfft = 1024,
+        .window = WINDOW_HANN,
+        .overlap = 0.5f,
+        .navg = 1,
+        .alpha = 1.0f,
+        .db = 1,
+        .nthreads = ncpu < 1 ? 1 : (ncpu > 8 ? 8 : (int)ncpu),
+    };
+    return opts;
+}
+
+static int parse_window(const char* name, WindowType* window)
+{
+    if (strcmp(name, "rect") == 0 || strcmp(name, "none") == 0) {
+        *window = WINDOW_RECT;
+    } else if (strcmp(name, "hann") == 0) {
+        *window = WINDOW_HANN;
+    } else if (strcmp(name, "bh") == 0 || strcmp(name, "blackman-harris") == 0) {
+        *window = WINDOW_BLACKMAN_HARRIS;
+    } else if (strcmp(name, "flattop") == 0 || strcmp(name, "flat-top") == 0) {
+        *window = WINDOW_FLAT_TOP;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int parse_psd_options(const char* spec, PsdOptions* opts)
+{
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%s", spec);
+
+    for (char* tok = strtok(buffer, ","); tok != NULL; tok = strtok(NULL, ","))
+    {
+        char* value = strchr(tok, '=');
+        if (value)
+        {
+            *value++ = '\0';
+        }
+
+        if (isdigit((unsigned char)tok[0]) && !value) {
+            opts->nfft = strtoull(tok, NULL, 10);
+        } else if (strcmp(tok, "db") == 0) {
+            opts->db = 1;
+        } else if (strcmp(tok, "lin") == 0 || strcmp(tok, "linear") == 0) {
+            opts->db = 0;
+        } else if (!value) {
+            if (parse_window(tok, &opts->window) != 0) return -1;
+        } else if (strcmp(tok, "nfft") == 0) {
+            opts->nfft = strtoull(value, NULL, 10);
+        } else if (strcmp(tok, "window") == 0) {
+            if (parse_window(value, &opts->window) != 0) return -1;
+        } else if (strcmp(tok, "overlap") == 0) {
+            opts->overlap = atof(value);
+        } else if (strcmp(tok, "avg") == 0) {
+            opts->navg = strtoull(value, NULL, 10);
+        } else if (strcmp(tok, "alpha") == 0) {
+            opts->alpha = atof(value);
+        } else if (strcmp(tok, "threads") == 0) {
+            opts->nthreads = atoi(value);
+        } else {
+            return -1;
+        }
+    }
+
+    if (opts->nfft < 2 || (opts->nfft & (opts->nfft - 1)) != 0) return -1;
+    if (opts->overlap < 0.0f || opts->overlap >= 1.0f) return -1;
+    if (opts->navg < 1) return -1;
+    if (opts->alpha <= 0.0f || opts->alpha > 1.0f) return -1;
+    if (opts->nthreads < 1) opts->nthreads = 1;
+    if (opts->nthreads > PSD_MAX_THREADS) opts->nthreads = PSD_MAX_THREADS;
+    return 0;
+}
+
+uint64_t psd_output_size(const PsdOptions* opts, DataType type)
+{
+    return datatype_is_complex(type) ? opts->nfft : opts->nfft / 2;
+}
+
+static uint64_t psd_hop(const PsdOptions* opts)
+{
+    uint64_t hop = (uint64_t)(opts->nfft * (1.0f - opts->overlap) + 0.5f);
+    return hop < 1 ? 1 : hop;
+}
+
+uint64_t psd_input_size(const PsdOptions* opts)
+{
+    return opts->navg * psd_hop(opts);
+}
+
+// Cosine sum windows, sum over k of (-1)^k a[k] cos(2 pi k n / N)
+static void fill_window(float* w, uint64_t n, WindowType type)
+{
+    static const double hann[] = { 0.5, 0.5 };
+    static const double blackman_harris[] = { 0.35875, 0.48829, 0.14128, 0.01168 };
+    static const double flat_top[] = { 0.21557895, 0.41663158, 0.277263158, 0.083578947, 0.006947368 };
+
+    const double* a = NULL;
+    int nterms = 0;
+    switch (type)
+    {
+        case WINDOW_RECT: break;
+        case WINDOW_HANN: a = hann; nterms = 2; break;
+        case WINDOW_BLACKMAN_HARRIS: a = blackman_harris; nterms = 4; break;
+        case WINDOW_FLAT_TOP: a = flat_top; nterms = 5; break;
+    }
+
+    for (uint64_t i = 0; i < n; i++)
+    {
+        double value = (nterms == 0) ? 1.0 : 0.0;
+        for (int k = 0; k < nterms; k++)
+        {
+            double sign = (k % 2 == 0) ? 1.0 : -1.0;
+            value += sign * a[k] * cos(2.0 * M_PI * k * i / n);
+        }
+        w[i] = value;
+    }
+}
+
+// Welch estimate for output frame j of the current batch
+static void compute_frame(Psd* psd, PsdWorker* worker, uint64_t j)
+{
+    uint64_t nfft = psd->opts.nfft;
+    const uint32_t* bitrev = psd->fft.bitrev;
+    const float* w = psd->window;
+    float* re = worker->re;
+    float* im = worker->im;
+    float* out = psd->power + j * psd->nout;
+    memset(out, 0, psd->nout * sizeof(float));
+
+    for (uint64_t s = 0; s < psd->opts.navg; s++)
+    {
+        uint64_t start = j * psd->unit + s * psd->hop;
+        // Window and bit reverse in one pass
+        if (psd->complex_input) {
+            const float* x = psd->samples + 2 * start;
+            for (uint64_t k = 0; k < nfft; k++)
+            {
+                re[bitrev[k]] = w[k] * x[2 * k];
+                im[bitrev[k]] = w[k] * x[2 * k + 1];
+            }
+        } else {
+            const float* x = psd->samples + start;
+            for (uint64_t k = 0; k < nfft; k++)
+            {
+                re[bitrev[k]] = w[k] * x[k];
+                im[bitrev[k]] = 0.0f;
+            }
+        }
+
+        fft_bitrev_input(&psd->fft, re, im);
+
+        if (psd->complex_input) {
+            // fftshift so DC lands in the middle of the frame
+            uint64_t half = nfft / 2;
+            for (uint64_t k = 0; k < half; k++)
+            {
+                out[k + half] += re[k] * re[k] + im[k] * im[k];
+            }
+            for (uint64_t k = half; k < nfft; k++)
+            {
+                out[k - half] += re[k] * re[k] + im[k] * im[k];
+            }
+        } else {
+            for (uint64_t k = 0; k < psd->nout; k++)
+            {
+                out[k] += re[k] * re[k] + im[k] * im[k];
+            }
+        }
+    }
+
+    for (uint64_t k = 0; k < psd->nout; k++)
+    {
+        out[k] *= psd->norm;
+    }
+}
+
+// Exponential average and dB for bins [k0, k1) of every frame in the batch.
+// Each bin's average only depends on its own past, so bins split cleanly.
+static void finish_bins(Psd* psd, uint64_t k0, uint64_t k1)
+{
+    float alpha = psd->opts.alpha;
+    for (uint64_t j = 0; j < psd->batch; j++)
+    {
+        float* p = psd->power + j * psd->nout;
+        if (alpha < 1.0f)
+        {
+            if (psd->have_avg || j > 0) {
+                for (uint64_t k = k0; k < k1; k++)
+                {
+                    psd->avg[k] = alpha * p[k] + (1.0f - alpha) * psd->avg[k];
+                }
+            } else {
+                memcpy(psd->avg + k0, p + k0, (k1 - k0) * sizeof(float));
+            }
+            p = psd->avg;
+        }
+
+        float* out = psd->outputs[j];
+        if (psd->opts.db) {
+            for (uint64_t k = k0; k < k1; k++)
+            {
+                out[k] = 10.0f * log10f(p[k] + 1e-20f);
+            }
+        } else {
+            memcpy(out + k0, p + k0, (k1 - k0) * sizeof(float));
+        }
+    }
+}
+
+static void run_phase(Psd* psd, int phase, int index, int nworkers)
+{
+    if (phase == 0) {
+        for (uint64_t j = index; j < psd->batch; j += nworkers)
+        {
+            compute_frame(psd, &psd->workers[index], j);
+        }
+    } else {
+        uint64_t chunk = (psd->nout + nworkers - 1) / nworkers;
+        uint64_t k0 = index * chunk;
+        uint64_t k1 = k0 + chunk < psd->nout ? k0 + chunk : psd->nout;
+        if (k0 < k1)
+        {
+            finish_bins(psd, k0, k1);
+        }
+    }
+}
+
+static void* psd_worker(void* arg)
+{
+    PsdWorker* worker = (PsdWorker*)arg;
+    Psd* psd = worker->psd;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&psd->lock);
+    while (1)
+    {
+        while (psd->generation == seen && !psd->quit)
+        {
+            pthread_cond_wait(&psd->start, &psd->lock);
+        }
+        if (psd->quit) break;
+        seen = psd->generation;
+        int phase = psd->phase;
+        pthread_mutex_unlock(&psd->lock);
+
+        run_phase(psd, phase, worker->index, psd->opts.nthreads);
+
+        pthread_mutex_lock(&psd->lock);
+        if (--psd->pending == 0)
+        {
+            pthread_cond_signal(&psd->done);
+        }
+    }
+    pthread_mutex_unlock(&psd->lock);
+    return NULL;
+}
+
+// Runs `phase` on every worker and waits for all of them. Single frame
+// batches aren't worth waking the pool for.
+static void dispatch(Psd* psd, int phase)
+{
+    int nworkers = psd->opts.nthreads;
+    if (nworkers == 1 || psd->batch < 2)
+    {
+        run_phase(psd, phase, 0, 1);
+        return;
+    }
+
+    pthread_mutex_lock(&psd->lock);
+    psd->phase = phase;
+    psd->pending = nworkers - 1;
+    psd->generation++;
+    pthread_cond_broadcast(&psd->start);
+    pthread_mutex_unlock(&psd->lock);
+
+    run_phase(psd, phase, 0, nworkers);
+
+    pthread_mutex_lock(&psd->lock);
+    while (psd->pending > 0)
+    {
+        pthread_cond_wait(&psd->done, &psd->lock);
+    }
+    pthread_mutex_unlock(&psd->lock);
+}
+
+static float* alloc_floats(uint64_t n)
+{
+    float* p = (float*)calloc(n, sizeof(float));
+    if (!p)
+    {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+void start_psd(Psd* psd, const PsdOptions* opts, DataType type, int swapped, uint64_t max_batch)
+{
+    psd->opts = *opts;
+    psd->type = type;
+    psd->swapped = swapped;
+    psd->complex_input = datatype_is_complex(type);
+    psd->hop = psd_hop(opts);
+    psd->unit = psd_input_size(opts);
+    psd->history = opts->nfft - psd->hop;
+    psd->nout = psd_output_size(opts, type);
+    psd->max_batch = max_batch;
+    psd->fft = new_fft(opts->nfft);
+
+    psd->window = alloc_floats(opts->nfft);
+    fill_window(psd->window, opts->nfft, opts->window);
+    double sum_squares = 0.0;
+    for (uint64_t k = 0; k < opts->nfft; k++)
+    {
+        sum_squares += (double)psd->window[k] * psd->window[k];
+    }
+    psd->norm = 1.0 / (opts->navg * sum_squares);
+
+    int ncomponents = psd->complex_input ? 2 : 1;
+    psd->samples = alloc_floats(ncomponents * (psd->history + max_batch * psd->unit));
+    psd->power = alloc_floats(max_batch * psd->nout);
+    psd->avg = alloc_floats(psd->nout);
+    psd->have_avg = 0;
+    psd->outputs = NULL;
+    psd->batch = 0;
+    psd->phase = 0;
+
+    pthread_mutex_init(&psd->lock, NULL);
+    pthread_cond_init(&psd->start, NULL);
+    pthread_cond_init(&psd->done, NULL);
+    psd->generation = 0;
+    psd->pending = 0;
+    psd->quit = 0;
+
+    psd->workers = (PsdWorker*)calloc(opts->nthreads, sizeof(PsdWorker));
+    for (int i = 0; i < opts->nthreads; i++)
+    {
+        PsdWorker* worker = &psd->workers[i];
+        worker->psd = psd;
+        worker->index = i;
+        worker->re = alloc_floats(opts->nfft);
+        worker->im = alloc_floats(opts->nfft);
+        if (i > 0)
+        {
+            int err = pthread_create(&worker->thread, NULL, psd_worker, worker);
+            if (err != 0)
+            {
+                fprintf(stderr, "pthread_create() failed: %d\n", err);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+}
+
+void stop_psd(Psd* psd)
+{
+    pthread_mutex_lock(&psd->lock);
+    psd->quit = 1;
+    pthread_cond_broadcast(&psd->start);
+    pthread_mutex_unlock(&psd->lock);
+
+    for (int i = 0; i < psd->opts.nthreads; i++)
+    {
+        if (i > 0)
+        {
+            pthread_join(psd->workers[i].thread, NULL);
+        }
+        free(psd->workers[i].re);
+        free(psd->workers[i].im);
+    }
+    free(psd->workers);
+    psd->workers = NULL;
+
+    pthread_mutex_destroy(&psd->lock);
+    pthread_cond_destroy(&psd->start);
+    pthread_cond_destroy(&psd->done);
+
+    free_fft(&psd->fft);
+    free(psd->window);
+    free(psd->samples);
+    free(psd->power);
+    free(psd->avg);
+}
+
+void reset_psd(Psd* psd)
+{
+    int ncomponents = psd->complex_input ? 2 : 1;
+    memset(psd->samples, 0, ncomponents * psd->history * sizeof(float));
+    psd->have_avg = 0;
+}
+
+void process_psd(Psd* psd, const void* raw, float scale, float offset, uint64_t nframes, float** outputs)
+{
+    int ncomponents = psd->complex_input ? 2 : 1;
+    while (nframes > 0)
+    {
+        uint64_t batch = nframes < psd->max_batch ? nframes : psd->max_batch;
+        uint64_t nelements = ncomponents * batch * psd->unit;
+
+        // New samples go in after the history carried from the last batch
+        float* dst = psd->samples + ncomponents * psd->history;
+        if (psd->swapped) {
+            convert_to_f32_swapped(psd->type, raw, dst, nelements, scale, offset);
+        } else {
+            convert_to_f32(psd->type, raw, dst, nelements, scale, offset);
+        }
+
+        psd->outputs = outputs;
+        psd->batch = batch;
+        dispatch(psd, 0);
+        dispatch(psd, 1);
+        psd->have_avg = 1;
+
+        memmove(psd->samples, psd->samples + nelements, ncomponents * psd->history * sizeof(float));
+
+        raw = (const char*)raw + batch * psd->unit * datatype_size(psd->type);
+        outputs += batch;
+        nframes -= batch;
+    }
+}
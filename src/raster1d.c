@@ -1,5 +1,3 @@
-#include <errno.h>
-#include <fcntl.h>
 #include <float.h>
 #include <math.h>
 #include <stdio.h>
@@ -9,6 +7,7 @@
 
 #include "raylib.h"
 #include "common.h"
+#include "ingest.h"
 
 
 const int NTRACES = 64;
@@ -139,24 +138,41 @@ void draw_raster1d(Raster1d* raster1d)
 int main(int argc, char *argv[])
 {
     SetConfigFlags(FLAG_WINDOW_RESIZABLE);
+    IngestOptions ingest_opts = default_ingest_options(TRACE_WIDTH);
+    int c;
+
+    while ((c = getopt(argc, argv, INGEST_OPTSTRING)) != -1)
+    {
+        if (!parse_ingest_option(c, optarg, &ingest_opts))
+        {
+            abort();
+        }
+    }
+
+    if (optind < argc)
+    {
+        ingest_opts.input = argv[optind];
+    }
+    resolve_ingest_input(&ingest_opts);
+    print_ingest_options(&ingest_opts);
+    int frame_size = ingest_frame_size(&ingest_opts);
 
     // Now set up our GUI
     InitWindow(screen.width, screen.height, "Raster1d");
     screen.width = GetScreenWidth();
     screen.height = GetScreenHeight();
-    Raster1d raster1d = new_raster1d(NTRACES, TRACE_WIDTH, &screen);
+    Raster1d raster1d = new_raster1d(NTRACES, frame_size, &screen);
     screen.zoom_stack[0].logical_width = raster1d.trace_width;
     screen.zoom_stack[0].logical_minx = 0.0f;
     SetTargetFPS(60);
     Font font = LoadFont("resources/fonts/pixelplay.png");
 
-    float* buffer = (float*)calloc(sizeof(float), screen.width);
-
     Vector2 click_start = { 0, 0 };
     Vector2 click_end = { 0, 0 };
     int last_mouse = 0; // 0 - not pressed, 1 - pressed
 
-    fcntl(0, F_SETFL, fcntl(0, F_GETFL) | O_NONBLOCK);
+    Ingest ingest;
+    start_source(&ingest, &ingest_opts);
 
     while (!WindowShouldClose())
     {
@@ -168,36 +184,23 @@ int main(int argc, char *argv[])
             screen.height = GetScreenHeight();
 
             free_raster1d(&raster1d);
-            raster1d = new_raster1d(NTRACES, TRACE_WIDTH, &screen);
+            raster1d = new_raster1d(NTRACES, frame_size, &screen);
             screen.zoom_stack[0].logical_width = raster1d.trace_width;
-
-            free(buffer);
-            buffer = (float*)calloc(sizeof(float), screen.width);
         }
 
-        while (1)
+        // Push every complete frame the reader thread has queued up
+        uint64_t nready = ingest_ready(&ingest);
+        for (uint64_t i = 0; i < nready; i++)
         {
-            // Receive all queued up data and push to Raster1d before rendering frame
-            ssize_t nbytes = read(0, buffer, sizeof(float) * screen.width);
-            if (nbytes == 0)
+            const float* frame = ingest_frame(&ingest, i);
+            if (frame)
             {
-                // EOF
-                break;
-            } else if (nbytes == -1) {
-                // If we don't have data don't block or bail, just allow loop to go
-                // along so UI remains responsive.
-                if (errno != EAGAIN)
-                {
-                    perror("read");
-                }
-                break;
+                push_trace(frame, &raster1d, &screen);
             }
-
-            // This also applies colormap
-            push_trace(buffer, &raster1d, &screen);
             screen.zoom_stack[0].logical_miny = raster1d.min_value;
             screen.zoom_stack[0].logical_height = raster1d.max_value - raster1d.min_value;
         }
+        ingest_consume(&ingest, nready);
 
         // Render all the data we have
         Vector2 mouse_pos = GetMousePosition();
@@ -243,6 +246,7 @@ int main(int argc, char *argv[])
                 active_screen = MAIN;
             }
         }
+        handle_ingest_keys(&ingest);
 
         // Draw
         BeginDrawing();
@@ -255,6 +259,7 @@ int main(int argc, char *argv[])
             DrawText("y   - Clear Tags", 20, 60, 14, WHITE);
             DrawText("Click and Drag to zoom", 20, 80, 14, WHITE);
             DrawText("Esc - Quit", 20, 100, 14, WHITE);
+            draw_ingest_help(&ingest, 130);
 
             DrawText("Tags", screen.width / 2, 10, 20, WHITE);
             for (size_t i = 0; i < ntags; i++)
@@ -280,16 +285,15 @@ int main(int argc, char *argv[])
 
             // Info panel
             draw_info_panel(&screen);
+            draw_ingest_info(&ingest, &screen);
         }
         EndDrawing();
     }
 
-    fcntl(0, F_SETFL, fcntl(0, F_GETFL) | ~O_NONBLOCK);
-
     // Clean up
+    stop_ingest(&ingest);
     free_raster1d(&raster1d);
     CloseWindow();
-    free(buffer);
     UnloadFont(font);
 
     return 0;
@@ -0,0 +1,220 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crc32.h"
+#include "datatype.h"
+#include "filetypes.h"
+#include "record.h"
+
+
+static int write_all(int fd, const char* data, size_t nbytes)
+{
+    while (nbytes > 0)
+    {
+        ssize_t n = write(fd, data, nbytes);
+        if (n == -1)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        nbytes -= n;
+    }
+    return 0;
+}
+
+static void* writer_thread(void* arg)
+{
+    Recorder* rec = (Recorder*)arg;
+
+    pthread_mutex_lock(&rec->lock);
+    while (1)
+    {
+        while (rec->pending < 0 && !rec->quit)
+        {
+            pthread_cond_wait(&rec->cond, &rec->lock);
+        }
+        if (rec->pending < 0) break;
+
+        const char* data = rec->buffers[rec->pending];
+        size_t nbytes = rec->pending_nbytes;
+        pthread_mutex_unlock(&rec->lock);
+
+        // CRC here rather than in record() keeps the producer to a memcpy
+        rec->crc = crc32_update(rec->crc, data, nbytes);
+        if (!atomic_load(&rec->failed) && write_all(rec->fd, data, nbytes) == -1)
+        {
+            perror("write");
+            atomic_store(&rec->failed, 1);
+        }
+        rec->nbytes_data += nbytes;
+        atomic_fetch_add(&rec->written, nbytes);
+
+        pthread_mutex_lock(&rec->lock);
+        rec->pending = -1;
+        pthread_cond_broadcast(&rec->cond);
+    }
+    pthread_mutex_unlock(&rec->lock);
+    return NULL;
+}
+
+// Passes the active buffer to the writer, waiting for it to finish the
+// previous one first.
+static void hand_over(Recorder* rec)
+{
+    pthread_mutex_lock(&rec->lock);
+    if (rec->pending >= 0)
+    {
+        atomic_fetch_add(&rec->stalls, 1);
+        while (rec->pending >= 0)
+        {
+            pthread_cond_wait(&rec->cond, &rec->lock);
+        }
+    }
+    rec->pending = rec->active;
+    rec->pending_nbytes = rec->fill;
+    pthread_cond_broadcast(&rec->cond);
+    pthread_mutex_unlock(&rec->lock);
+
+    rec->active ^= 1;
+    rec->fill = 0;
+}
+
+int finish_dsp_data_file(int fd, DataType type, double sample_rate, uint64_t nbytes_data, uint32_t data_crc, const char* extra_meta)
+{
+    char meta[512];
+    time_t now = time(NULL);
+    struct tm tm;
+    gmtime_r(&now, &tm);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", &tm);
+    int nmeta = snprintf(meta, sizeof(meta), "data_type=%s\nsample_rate=%.17g\nstopped=%s\n%s",
+            datatype_name(type), sample_rate, stamp, extra_meta);
+    if (nmeta >= (int)sizeof(meta))
+    {
+        nmeta = sizeof(meta) - 1;
+    }
+
+    uint8_t header[DSP_DATA_HEADER_SIZE];
+    format_dsp_data_header(header, type, nbytes_data, nmeta);
+    uint32_t crc = crc32_update(0, header, sizeof(header));
+    crc = crc32_combine(crc, data_crc, nbytes_data);
+    crc = crc32_update(crc, meta, nmeta);
+    uint8_t trailer[4] = { crc & 0xff, (crc >> 8) & 0xff, (crc >> 16) & 0xff, crc >> 24 };
+
+    if (write_all(fd, meta, nmeta) == -1
+            || write_all(fd, (const char*)trailer, sizeof(trailer)) == -1
+            || pwrite(fd, header, sizeof(header), 0) != sizeof(header))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+int start_recorder(Recorder* rec, const char* path, DataType type, double sample_rate)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) return -1;
+
+    // Room for the header, written once the sizes are known
+    uint8_t header[DSP_DATA_HEADER_SIZE] = { 0 };
+    if (write_all(fd, (const char*)header, sizeof(header)) == -1)
+    {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    rec->fd = fd;
+    snprintf(rec->path, sizeof(rec->path), "%s", path);
+    rec->type = type;
+    rec->sample_rate = sample_rate;
+    rec->capacity = RECORD_BUFFER_BYTES;
+    rec->buffers[0] = (char*)malloc(rec->capacity);
+    rec->buffers[1] = (char*)malloc(rec->capacity);
+    if (!rec->buffers[0] || !rec->buffers[1])
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    rec->fill = 0;
+    rec->active = 0;
+    pthread_mutex_init(&rec->lock, NULL);
+    pthread_cond_init(&rec->cond, NULL);
+    rec->pending = -1;
+    rec->pending_nbytes = 0;
+    rec->quit = 0;
+    rec->nbytes_data = 0;
+    rec->crc = 0;
+    atomic_init(&rec->queued, 0);
+    atomic_init(&rec->written, 0);
+    atomic_init(&rec->stalls, 0);
+    atomic_init(&rec->failed, 0);
+
+    int err = pthread_create(&rec->thread, NULL, writer_thread, rec);
+    if (err != 0)
+    {
+        fprintf(stderr, "pthread_create() failed: %d\n", err);
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
+
+void record(Recorder* rec, const void* data, size_t nbytes)
+{
+    const char* p = (const char*)data;
+    atomic_fetch_add_explicit(&rec->queued, nbytes, memory_order_relaxed);
+    while (nbytes > 0)
+    {
+        size_t n = rec->capacity - rec->fill;
+        if (n > nbytes) n = nbytes;
+        memcpy(rec->buffers[rec->active] + rec->fill, p, n);
+        rec->fill += n;
+        p += n;
+        nbytes -= n;
+        if (rec->fill == rec->capacity)
+        {
+            hand_over(rec);
+        }
+    }
+}
+
+uint64_t recorder_backlog(Recorder* rec)
+{
+    return atomic_load(&rec->queued) - atomic_load(&rec->written);
+}
+
+void stop_recorder(Recorder* rec)
+{
+    if (rec->fill > 0)
+    {
+        hand_over(rec);
+    }
+    pthread_mutex_lock(&rec->lock);
+    rec->quit = 1;
+    pthread_cond_broadcast(&rec->cond);
+    pthread_mutex_unlock(&rec->lock);
+    pthread_join(rec->thread, NULL);
+
+    if (atomic_load(&rec->failed) || finish_dsp_data_file(rec->fd, rec->type, rec->sample_rate, rec->nbytes_data, rec->crc, "") == -1)
+    {
+        fprintf(stderr, "Recording to %s is incomplete\n", rec->path);
+    }
+    close(rec->fd);
+
+    free(rec->buffers[0]);
+    free(rec->buffers[1]);
+    rec->buffers[0] = NULL;
+    rec->buffers[1] = NULL;
+    pthread_mutex_destroy(&rec->lock);
+    pthread_cond_destroy(&rec->cond);
+}
@@ -0,0 +1,361 @@
+#include <math.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "convert.h"
+#include "datatype.h"
+#include "resample.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RESAMPLE_X86 1
+#endif
+
+#define RESAMPLE_TAP_MULTIPLE 16
+
+
+ResampleOptions default_resample_options(void)
+{
+    ResampleOptions opts = {
+        .up = 1,
+        .down = 1,
+        .atten = 80.0f,
+    };
+    return opts;
+}
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b != 0)
+    {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+int parse_resample_options(const char* spec, ResampleOptions* opts)
+{
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%s", spec);
+
+    char* rest = strchr(buffer, ',');
+    if (rest) *rest++ = '\0';
+    char* slash = strchr(buffer, '/');
+    char* end;
+    long up = 1;
+    if (slash)
+    {
+        *slash = '\0';
+        up = strtol(buffer, &end, 10);
+        if (end == buffer || *end != '\0') return -1;
+    }
+    const char* down_str = slash ? slash + 1 : buffer;
+    long down = strtol(down_str, &end, 10);
+    if (end == down_str || *end != '\0') return -1;
+    if (up < 1 || down < 1 || up > 4096 || down > 65536) return -1;
+    uint32_t g = gcd((uint32_t)up, (uint32_t)down);
+    opts->up = (uint32_t)up / g;
+    opts->down = (uint32_t)down / g;
+
+    for (char* tok = rest ? strtok(rest, ",") : NULL; tok != NULL; tok = strtok(NULL, ","))
+    {
+        if (strncmp(tok, "atten=", 6) != 0) return -1;
+        opts->atten = strtof(tok + 6, &end);
+        if (end == tok + 6 || *end != '\0' || opts->atten < 21.0f) return -1;
+    }
+    return 0;
+}
+
+// Transition band from 80% of the lower Nyquist rate to all of it, in cycles
+// per sample at up times the input rate
+static double transition_width(const ResampleOptions* opts)
+{
+    uint32_t r = opts->up > opts->down ? opts->up : opts->down;
+    return 0.2 * 0.5 / r;
+}
+
+uint32_t resample_taps(const ResampleOptions* opts)
+{
+    // Kaiser's estimate of the length for the attenuation and transition
+    double n = (opts->atten - 8.0) / (2.285 * 2.0 * M_PI * transition_width(opts)) + 1.0;
+    uint32_t ntaps = (uint32_t)ceil(n / opts->up);
+    return (ntaps + RESAMPLE_TAP_MULTIPLE - 1) / RESAMPLE_TAP_MULTIPLE * RESAMPLE_TAP_MULTIPLE;
+}
+
+// Zeroth order modified Bessel function of the first kind
+static double bessel_i0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 64; k++)
+    {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < 1e-12 * sum) break;
+    }
+    return sum;
+}
+
+// Prototype lowpass of ntaps * up taps at up times the input rate, split into
+// its phases. Phase p holds taps p, p + up, p + 2 up..., reversed so that
+// each output is a straight dot product with the oldest input first.
+static void design_taps(const ResampleOptions* opts, uint32_t ntaps, float* taps)
+{
+    uint32_t L = opts->up;
+    uint64_t n = (uint64_t)ntaps * L;
+    double a = opts->atten;
+    double beta = a > 50.0 ? 0.1102 * (a - 8.7) : 0.5842 * pow(a - 21.0, 0.4) + 0.07886 * (a - 21.0);
+    double fc = 0.5 / (L > opts->down ? L : opts->down) - transition_width(opts) / 2.0;
+    double mid = (n - 1) / 2.0;
+
+    double* h = (double*)malloc(n * sizeof(double));
+    if (!h)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    double sum = 0.0;
+    for (uint64_t m = 0; m < n; m++)
+    {
+        double t = m - mid;
+        double sinc = t == 0.0 ? 2.0 * fc : sin(2.0 * M_PI * fc * t) / (M_PI * t);
+        double r = n > 1 ? 2.0 * m / (n - 1) - 1.0 : 0.0;
+        h[m] = sinc * bessel_i0(beta * sqrt(1.0 - r * r)) / bessel_i0(beta);
+        sum += h[m];
+    }
+    // Each phase passes DC at unity gain, which makes the whole filter L
+    for (uint32_t p = 0; p < L; p++)
+    {
+        for (uint32_t k = 0; k < ntaps; k++)
+        {
+            taps[(uint64_t)p * ntaps + (ntaps - 1 - k)] = (float)(h[(uint64_t)k * L + p] * L / sum);
+        }
+    }
+    free(h);
+}
+
+
+// Dot product of `n` floats, n a multiple of RESAMPLE_TAP_MULTIPLE
+typedef float (*DotKernel)(const float* a, const float* b, size_t n);
+
+static float dot_scalar(const float* a, const float* b, size_t n)
+{
+    // Independent sums so the compiler can keep several FMAs in flight
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    for (size_t i = 0; i < n; i += 4)
+    {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+#ifdef RESAMPLE_X86
+
+__attribute__((target("avx2,fma")))
+static float dot_avx2(const float* a, const float* b, size_t n)
+{
+    // Four chains to cover the FMA latency
+    __m256 s0 = _mm256_setzero_ps();
+    __m256 s1 = _mm256_setzero_ps();
+    __m256 s2 = _mm256_setzero_ps();
+    __m256 s3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+        s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), s1);
+        s2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), s2);
+        s3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), s3);
+    }
+    if (i < n)
+    {
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+        s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), s1);
+    }
+    __m256 s = _mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3));
+    __m128 h = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+    h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+    h = _mm_add_ss(h, _mm_movehdup_ps(h));
+    return _mm_cvtss_f32(h);
+}
+
+__attribute__((target("avx512f")))
+static float dot_avx512(const float* a, const float* b, size_t n)
+{
+    __m512 s0 = _mm512_setzero_ps();
+    __m512 s1 = _mm512_setzero_ps();
+    __m512 s2 = _mm512_setzero_ps();
+    __m512 s3 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64)
+    {
+        s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), s0);
+        s1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), s1);
+        s2 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 32), _mm512_loadu_ps(b + i + 32), s2);
+        s3 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 48), _mm512_loadu_ps(b + i + 48), s3);
+    }
+    for (; i < n; i += 16)
+    {
+        s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), s0);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(s0, s1), _mm512_add_ps(s2, s3)));
+}
+
+#endif // RESAMPLE_X86
+
+static DotKernel dot = dot_scalar;
+static const char* dot_isa = "scalar";
+static pthread_once_t dot_once = PTHREAD_ONCE_INIT;
+
+// Same choice as the conversion kernels, RASTER_CONVERT_ISA caps both
+static void init_dot(void)
+{
+#ifdef RESAMPLE_X86
+    const char* cap = getenv("RASTER_CONVERT_ISA");
+    int level = 3;
+    if (cap) {
+        if (strcmp(cap, "scalar") == 0) level = 0;
+        else if (strcmp(cap, "sse2") == 0) level = 1;
+        else if (strcmp(cap, "avx2") == 0) level = 2;
+    }
+
+    __builtin_cpu_init();
+    if (level >= 2 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        dot = dot_avx2;
+        dot_isa = "avx2";
+    }
+    if (level >= 3 && __builtin_cpu_supports("avx512f"))
+    {
+        dot = dot_avx512;
+        dot_isa = "avx512";
+    }
+#endif
+}
+
+const char* resample_isa(void)
+{
+    pthread_once(&dot_once, init_dot);
+    return dot_isa;
+}
+
+
+DataType resampled_type(DataType type)
+{
+    return datatype_is_complex(type) ? Cf32 : F32;
+}
+
+Resampler new_resampler(const ResampleOptions* opts, DataType type, int swapped, uint64_t out_samples, uint64_t max_blocks)
+{
+    pthread_once(&dot_once, init_dot);
+    Resampler r = {
+        .opts = *opts,
+        .type = type,
+        .swapped = swapped,
+        .nchannels = datatype_is_complex(type) ? 2 : 1,
+        .in_samples = out_samples * opts->down / opts->up,
+        .out_samples = out_samples,
+        .max_blocks = max_blocks,
+        .ntaps = resample_taps(opts),
+    };
+    r.taps = (float*)malloc((size_t)opts->up * r.ntaps * sizeof(float));
+    r.iq = (float*)malloc(2 * r.in_samples * sizeof(float));
+    r.out = (float*)malloc(max_blocks * out_samples * r.nchannels * sizeof(float));
+    if (!r.taps || !r.iq || !r.out)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int c = 0; c < 2; c++)
+    {
+        r.planes[c] = NULL;
+        if (c >= r.nchannels) continue;
+        r.planes[c] = (float*)malloc((r.ntaps - 1 + r.in_samples) * sizeof(float));
+        if (!r.planes[c])
+        {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    design_taps(opts, r.ntaps, r.taps);
+    reset_resampler(&r);
+    return r;
+}
+
+void free_resampler(Resampler* r)
+{
+    free(r->taps);
+    free(r->planes[0]);
+    free(r->planes[1]);
+    free(r->iq);
+    free(r->out);
+}
+
+void reset_resampler(Resampler* r)
+{
+    for (int c = 0; c < r->nchannels; c++)
+    {
+        memset(r->planes[c], 0, (r->ntaps - 1) * sizeof(float));
+    }
+}
+
+// Filters the block in plane `c` into every nchannels'th float of `out`
+static void filter_plane(Resampler* r, int c, float* out)
+{
+    const float* x = r->planes[c];
+    uint32_t L = r->opts.up;
+    uint32_t M = r->opts.down;
+    // Output n is at n * M in the upsampled stream, which is phase t % L
+    // of input sample t / L
+    uint64_t i = 0;
+    uint32_t p = 0;
+    for (uint64_t n = 0; n < r->out_samples; n++)
+    {
+        out[n * r->nchannels] = dot(r->taps + (uint64_t)p * r->ntaps, x + i, r->ntaps);
+        p += M;
+        i += p / L;
+        p %= L;
+    }
+    // Keep the tail as history for the next block
+    memmove(r->planes[c], r->planes[c] + r->in_samples, (r->ntaps - 1) * sizeof(float));
+}
+
+const float* resample_blocks(Resampler* r, const void* raw, uint64_t nblocks, float scale, float offset)
+{
+    size_t block_bytes = r->in_samples * datatype_size(r->type);
+    size_t nelements = r->in_samples * r->nchannels;
+    for (uint64_t b = 0; b < nblocks; b++)
+    {
+        const char* in = (const char*)raw + b * block_bytes;
+        float* out = r->out + b * r->out_samples * r->nchannels;
+        float* dst = r->nchannels == 1 ? r->planes[0] + r->ntaps - 1 : r->iq;
+        if (r->swapped) {
+            convert_to_f32_swapped(r->type, in, dst, nelements, scale, offset);
+        } else {
+            convert_to_f32(r->type, in, dst, nelements, scale, offset);
+        }
+        if (r->nchannels == 2)
+        {
+            float* re = r->planes[0] + r->ntaps - 1;
+            float* im = r->planes[1] + r->ntaps - 1;
+            for (uint64_t i = 0; i < r->in_samples; i++)
+            {
+                re[i] = r->iq[2 * i];
+                im[i] = r->iq[2 * i + 1];
+            }
+        }
+        for (int c = 0; c < r->nchannels; c++)
+        {
+            filter_plane(r, c, out + c);
+        }
+    }
+    return r->out;
+}
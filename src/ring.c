@@ -0,0 +1,126 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring.h"
+
+
+FrameRing new_frame_ring(uint64_t nslots, uint64_t frame_size)
+{
+    uint64_t n = 1;
+    while (n < nslots)
+    {
+        n <<= 1;
+    }
+
+    // Pad each slot out to a whole number of cache lines
+    uint64_t floats_per_line = CACHE_LINE_SIZE / sizeof(float);
+    uint64_t stride = (frame_size + floats_per_line - 1) / floats_per_line * floats_per_line;
+
+    float* frames = (float*)aligned_alloc(CACHE_LINE_SIZE, n * stride * sizeof(float));
+    if (!frames)
+    {
+        perror("aligned_alloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(frames, 0, n * stride * sizeof(float));
+
+    FrameRing r = {
+        .cached_tail = 0,
+        .cached_head = 0,
+        .nslots = n,
+        .mask = n - 1,
+        .frame_size = frame_size,
+        .stride = stride,
+        .frames = frames,
+    };
+    atomic_init(&r.head, 0);
+    atomic_init(&r.tail, 0);
+    atomic_init(&r.skip, 0);
+    return r;
+}
+
+void free_frame_ring(FrameRing* ring)
+{
+    if (ring->frames)
+    {
+        free(ring->frames);
+        ring->frames = NULL;
+    }
+}
+
+// Number of empty slots the producer may fill right now.
+uint64_t frame_ring_writable(FrameRing* ring)
+{
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t free_slots = ring->nslots - (head - ring->cached_tail);
+    if (free_slots == 0)
+    {
+        // Looks full, go and get the real tail from the consumer
+        ring->cached_tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        free_slots = ring->nslots - (head - ring->cached_tail);
+    }
+    return free_slots;
+}
+
+// Slot `offset` frames past the current head, caller must have checked
+// frame_ring_writable() first.
+float* frame_ring_write_ptr(FrameRing* ring, uint64_t offset)
+{
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    return ring->frames + ((head + offset) & ring->mask) * ring->stride;
+}
+
+void frame_ring_publish(FrameRing* ring, uint64_t nframes)
+{
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + nframes, memory_order_release);
+}
+
+void frame_ring_request_skip(FrameRing* ring, uint64_t nframes)
+{
+    atomic_store_explicit(&ring->skip, nframes, memory_order_relaxed);
+}
+
+// Number of complete frames waiting for the consumer.
+uint64_t frame_ring_readable(FrameRing* ring)
+{
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t nready = ring->cached_head - tail;
+    if (nready == 0)
+    {
+        // Looks empty, go and get the real head from the producer
+        ring->cached_head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        nready = ring->cached_head - tail;
+    }
+    return nready;
+}
+
+const float* frame_ring_read_ptr(FrameRing* ring, uint64_t offset)
+{
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    return ring->frames + ((tail + offset) & ring->mask) * ring->stride;
+}
+
+void frame_ring_consume(FrameRing* ring, uint64_t nframes)
+{
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + nframes, memory_order_release);
+}
+
+uint64_t frame_ring_skip(FrameRing* ring)
+{
+    if (atomic_load_explicit(&ring->skip, memory_order_relaxed) == 0) return 0;
+    uint64_t nframes = atomic_exchange_explicit(&ring->skip, 0, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    ring->cached_head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t nready = ring->cached_head - tail;
+    if (nframes > nready)
+    {
+        nframes = nready;
+    }
+    frame_ring_consume(ring, nframes);
+    return nframes;
+}
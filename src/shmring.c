@@ -0,0 +1,283 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shmring.h"
+
+
+// shm_open() wants a leading slash, accept names with or without one
+static void shm_name(char* out, size_t size, const char* name)
+{
+    snprintf(out, size, "%s%s", name[0] == '/' ? "" : "/", name);
+}
+
+static uint64_t next_pow2(uint64_t n)
+{
+    uint64_t p = 1;
+    while (p < n)
+    {
+        p <<= 1;
+    }
+    return p;
+}
+
+int parse_shm_slots(const char* arg, uint64_t* nslots)
+{
+    char* end;
+    errno = 0;
+    unsigned long long n = strtoull(arg, &end, 10);
+    // strtoull() takes a minus sign and wraps, which the range check catches
+    if (errno != 0 || end == arg || *end != '\0') return -1;
+    if (n < SHM_RING_MIN_SLOTS || n > SHM_RING_MAX_SLOTS) return -1;
+    *nslots = n;
+    return 0;
+}
+
+int create_shm_ring(ShmRing* ring, const char* name, uint64_t frame_size, DataType type, uint64_t nslots, double sample_rate)
+{
+    if (nslots < SHM_RING_MIN_SLOTS || nslots > SHM_RING_MAX_SLOTS)
+    {
+        // Also keeps next_pow2() from running off the top
+        errno = EINVAL;
+        return -1;
+    }
+    shm_name(ring->name, sizeof(ring->name), name);
+    nslots = next_pow2(nslots);
+    uint64_t frame_bytes = frame_size * datatype_size(type);
+    uint64_t slot_bytes = (frame_bytes + 63) / 64 * 64;
+    size_t nbytes = 2 * SHM_RING_PAGE + nslots * slot_bytes;
+
+    // Start from scratch so readers of an old ring never see a half built one
+    shm_unlink(ring->name);
+    int fd = shm_open(ring->name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd == -1) return -1;
+    if (ftruncate(fd, nbytes) == -1)
+    {
+        int err = errno;
+        close(fd);
+        shm_unlink(ring->name);
+        errno = err;
+        return -1;
+    }
+    char* base = (char*)mmap(NULL, nbytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        int err = errno;
+        close(fd);
+        shm_unlink(ring->name);
+        errno = err;
+        return -1;
+    }
+
+    ShmRingHeader* h = (ShmRingHeader*)base;
+    h->version = SHM_RING_VERSION;
+    h->header_bytes = 2 * SHM_RING_PAGE;
+    h->readers_offset = SHM_RING_PAGE;
+    h->max_readers = SHM_RING_MAX_READERS;
+    h->frame_size = frame_size;
+    h->data_type = type;
+    h->nslots = nslots;
+    h->slot_bytes = slot_bytes;
+    h->sample_rate = sample_rate;
+    atomic_init(&h->write_index, 0);
+    atomic_init(&h->closed, 0);
+    // ftruncate() zeroed the reader table so every entry starts out free.
+    // Magic last, a reader that sees it sees the rest.
+    atomic_thread_fence(memory_order_release);
+    memcpy(h->magic, SHM_RING_MAGIC, 8);
+
+    ring->fd = fd;
+    ring->writable = 1;
+    ring->nbytes = nbytes;
+    ring->header = h;
+    ring->slots = base + h->header_bytes;
+    ring->mask = nslots - 1;
+    ring->frame_bytes = frame_bytes;
+    ring->readers = (ShmReader*)(base + h->readers_offset);
+    ring->self = NULL;
+    return 0;
+}
+
+void* shm_ring_slot(ShmRing* ring, uint64_t index)
+{
+    return ring->slots + (index & ring->mask) * ring->header->slot_bytes;
+}
+
+void* shm_ring_next(ShmRing* ring)
+{
+    uint64_t w = atomic_load_explicit(&ring->header->write_index, memory_order_relaxed);
+    return shm_ring_slot(ring, w);
+}
+
+void shm_ring_publish(ShmRing* ring, uint64_t nframes)
+{
+    atomic_fetch_add_explicit(&ring->header->write_index, nframes, memory_order_release);
+    // Keeps the next frame's writes from being seen before the index that
+    // lets readers know their slot is being reused
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void destroy_shm_ring(ShmRing* ring)
+{
+    atomic_store(&ring->header->closed, 1);
+    munmap(ring->header, ring->nbytes);
+    close(ring->fd);
+    shm_unlink(ring->name);
+}
+
+int reap_shm_readers(ShmRing* ring)
+{
+    int nreaders = 0;
+    for (uint32_t i = 0; i < ring->header->max_readers; i++)
+    {
+        ShmReader* r = &ring->readers[i];
+        uint64_t pid = atomic_load(&r->pid);
+        if (pid == 0) continue;
+        if (kill((pid_t)pid, 0) == -1 && errno == ESRCH) {
+            // Only free it if it's still the same reader
+            atomic_compare_exchange_strong(&r->pid, &pid, 0);
+        } else {
+            nreaders++;
+        }
+    }
+    return nreaders;
+}
+
+int open_shm_ring(ShmRing* ring, const char* name)
+{
+    shm_name(ring->name, sizeof(ring->name), name);
+    int fd = shm_open(ring->name, O_RDONLY, 0);
+    if (fd == -1) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < 2 * SHM_RING_PAGE)
+    {
+        close(fd);
+        errno = EPROTO;
+        return -1;
+    }
+    char* base = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    ShmRingHeader* h = (ShmRingHeader*)base;
+    int ok = memcmp(h->magic, SHM_RING_MAGIC, 8) == 0;
+    atomic_thread_fence(memory_order_acquire);
+    ok = ok && h->version == SHM_RING_VERSION
+            && h->data_type <= Cf64
+            && h->nslots > 0 && (h->nslots & (h->nslots - 1)) == 0
+            && h->slot_bytes >= h->frame_size * datatype_size((DataType)h->data_type)
+            && h->readers_offset % SHM_RING_PAGE == 0
+            && h->max_readers * sizeof(ShmReader) <= SHM_RING_PAGE
+            && (uint64_t)st.st_size >= h->header_bytes + h->nslots * h->slot_bytes;
+    if (!ok)
+    {
+        munmap(base, st.st_size);
+        close(fd);
+        errno = EPROTO;
+        return -1;
+    }
+
+    ring->fd = fd;
+    ring->writable = 0;
+    ring->nbytes = st.st_size;
+    ring->header = h;
+    ring->slots = base + h->header_bytes;
+    ring->mask = h->nslots - 1;
+    ring->frame_bytes = h->frame_size * datatype_size((DataType)h->data_type);
+    ring->readers = NULL;
+    ring->self = NULL;
+    return 0;
+}
+
+int register_shm_reader(ShmRing* ring, uint64_t cursor)
+{
+    // The ring itself stays read-only, just the reader table gets mapped
+    // writable, if the object's permissions allow
+    int fd = shm_open(ring->name, O_RDWR, 0);
+    if (fd == -1) return -1;
+    void* table = mmap(NULL, SHM_RING_PAGE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, ring->header->readers_offset);
+    close(fd);
+    if (table == MAP_FAILED) return -1;
+    ring->readers = (ShmReader*)table;
+
+    uint64_t pid = (uint64_t)getpid();
+    for (uint32_t i = 0; i < ring->header->max_readers; i++)
+    {
+        ShmReader* r = &ring->readers[i];
+        uint64_t free_pid = 0;
+        if (atomic_compare_exchange_strong(&r->pid, &free_pid, pid))
+        {
+            atomic_store(&r->cursor, cursor);
+            atomic_store(&r->dropped, 0);
+            ring->self = r;
+            return 0;
+        }
+    }
+    munmap(table, SHM_RING_PAGE);
+    ring->readers = NULL;
+    errno = ENOSPC;
+    return -1;
+}
+
+void shm_reader_update(ShmRing* ring, uint64_t cursor, uint64_t dropped)
+{
+    if (!ring->self) return;
+    atomic_store_explicit(&ring->self->cursor, cursor, memory_order_relaxed);
+    atomic_store_explicit(&ring->self->dropped, dropped, memory_order_relaxed);
+}
+
+const void* shm_ring_frame(const ShmRing* ring, uint64_t index)
+{
+    return ring->slots + (index & ring->mask) * ring->header->slot_bytes;
+}
+
+uint64_t shm_ring_write_index(const ShmRing* ring)
+{
+    return atomic_load_explicit(&ring->header->write_index, memory_order_acquire);
+}
+
+uint64_t shm_ring_oldest_intact(const ShmRing* ring)
+{
+    // Orders the caller's copy before the index load, as in a seqlock reader
+    atomic_thread_fence(memory_order_acquire);
+    uint64_t w = atomic_load_explicit(&ring->header->write_index, memory_order_relaxed);
+    // Frames up to w + SHM_RING_WRITE_AHEAD - 1 may be going in, each over
+    // the one nslots before it
+    uint64_t lapped = w + SHM_RING_WRITE_AHEAD;
+    return lapped > ring->mask ? lapped - ring->mask - 1 : 0;
+}
+
+int shm_ring_closed(const ShmRing* ring)
+{
+    return atomic_load_explicit(&ring->header->closed, memory_order_acquire) != 0;
+}
+
+void close_shm_ring(ShmRing* ring)
+{
+    if (ring->self)
+    {
+        atomic_store(&ring->self->pid, 0);
+        ring->self = NULL;
+    }
+    if (ring->readers)
+    {
+        munmap(ring->readers, SHM_RING_PAGE);
+        ring->readers = NULL;
+    }
+    munmap(ring->header, ring->nbytes);
+    close(ring->fd);
+}
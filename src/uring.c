@@ -0,0 +1,552 @@
+#define _GNU_SOURCE // syscall(), MAP_POPULATE
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include "uring.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+
+// user_data of cancel requests, whose completions don't belong to a block
+#define CANCEL_TAG UINT64_MAX
+#define CLOSE_WAIT_MS 100
+
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, const void* arg, size_t argsz)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nargs)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+}
+
+static void unmap_ring(UringReader* r)
+{
+    if (r->sqes) munmap(r->sqes, r->sqes_bytes);
+    if (r->cq_map && r->cq_map != r->sq_map) munmap(r->cq_map, r->cq_map_bytes);
+    if (r->sq_map) munmap(r->sq_map, r->sq_map_bytes);
+    if (r->ring_fd != -1) close(r->ring_fd);
+    r->sqes = NULL;
+    r->cq_map = NULL;
+    r->sq_map = NULL;
+    r->ring_fd = -1;
+}
+
+static void* map_ring(int fd, size_t nbytes, off_t offset)
+{
+    void* addr = mmap(NULL, nbytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    return addr == MAP_FAILED ? NULL : addr;
+}
+
+// Creates the ring and maps its queues, the reader's buffers are separate
+static int setup_ring(UringReader* r, unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    r->ring_fd = sys_io_uring_setup(entries, &p);
+    if (r->ring_fd == -1) return -1;
+    // Waits with a timeout need IORING_ENTER_EXT_ARG, 5.11 on
+    if (!(p.features & IORING_FEAT_EXT_ARG))
+    {
+        unmap_ring(r);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    r->sq_map_bytes = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_bytes = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && r->cq_map_bytes > r->sq_map_bytes)
+    {
+        r->sq_map_bytes = r->cq_map_bytes;
+    }
+    r->sqes_bytes = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sq_map = map_ring(r->ring_fd, r->sq_map_bytes, IORING_OFF_SQ_RING);
+    r->cq_map = single ? r->sq_map : map_ring(r->ring_fd, r->cq_map_bytes, IORING_OFF_CQ_RING);
+    r->sqes = map_ring(r->ring_fd, r->sqes_bytes, IORING_OFF_SQES);
+    if (!r->sq_map || !r->cq_map || !r->sqes)
+    {
+        int err = errno;
+        unmap_ring(r);
+        errno = err;
+        return -1;
+    }
+
+    char* sq = (char*)r->sq_map;
+    r->sq_head = (_Atomic unsigned*)(sq + p.sq_off.head);
+    r->sq_tail = (_Atomic unsigned*)(sq + p.sq_off.tail);
+    r->sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned*)(sq + p.sq_off.array);
+    char* cq = (char*)r->cq_map;
+    r->cq_head = (_Atomic unsigned*)(cq + p.cq_off.head);
+    r->cq_tail = (_Atomic unsigned*)(cq + p.cq_off.tail);
+    r->cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    r->cqes = cq + p.cq_off.cqes;
+    return 0;
+}
+
+// Only this thread touches the submission queue, so the tail just needs
+// publishing after the entry is written
+static struct io_uring_sqe* next_sqe(UringReader* r)
+{
+    unsigned tail = atomic_load_explicit(r->sq_tail, memory_order_relaxed);
+    unsigned idx = tail & r->sq_mask;
+    struct io_uring_sqe* sqe = &((struct io_uring_sqe*)r->sqes)[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    r->queued++;
+    return sqe;
+}
+
+static void push_sqe(UringReader* r)
+{
+    unsigned tail = atomic_load_explicit(r->sq_tail, memory_order_relaxed);
+    atomic_store_explicit(r->sq_tail, tail + 1, memory_order_release);
+}
+
+static void queue_read(UringReader* r, void* dst, size_t nbytes, uint64_t offset, uint64_t tag, int fixed)
+{
+    struct io_uring_sqe* sqe = next_sqe(r);
+    sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = r->fd;
+    sqe->addr = (uint64_t)(uintptr_t)dst;
+    sqe->len = (uint32_t)nbytes;
+    sqe->off = offset;
+    sqe->buf_index = 0;
+    sqe->user_data = tag;
+    push_sqe(r);
+}
+
+// Hands the kernel whatever is queued and waits up to `timeout_ms` for
+// `wait_nr` completions. Returns -1 with errno ETIME on a timeout.
+static int submit_and_wait(UringReader* r, unsigned wait_nr, int timeout_ms)
+{
+    struct __kernel_timespec ts = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_nsec = (long long)(timeout_ms % 1000) * 1000000,
+    };
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = timeout_ms >= 0 ? (uint64_t)(uintptr_t)&ts : 0;
+    unsigned flags = IORING_ENTER_EXT_ARG | (wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0);
+    int ret = sys_io_uring_enter(r->ring_fd, r->queued, wait_nr, flags, &arg, sizeof(arg));
+    if (ret > 0)
+    {
+        // Anything the kernel didn't take stays in the queue for next time
+        r->queued -= (unsigned)ret < r->queued ? (unsigned)ret : r->queued;
+    }
+    return ret;
+}
+
+// Notes the result of every finished block
+static void reap(UringReader* r)
+{
+    unsigned head = atomic_load_explicit(r->cq_head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(r->cq_tail, memory_order_acquire);
+    for (; head != tail; head++)
+    {
+        const struct io_uring_cqe* cqe = &((const struct io_uring_cqe*)r->cqes)[head & r->cq_mask];
+        if (cqe->user_data == CANCEL_TAG) continue;
+        unsigned slot = cqe->user_data % r->nbuf;
+        r->results[slot] = cqe->res;
+        r->done[slot] = 1;
+        r->completed++;
+    }
+    atomic_store_explicit(r->cq_head, head, memory_order_release);
+}
+
+static char* block_ptr(UringReader* r, uint64_t seq)
+{
+    return r->blocks + (seq % r->nbuf) * r->block_bytes;
+}
+
+// Keeps every free buffer busy for a file, just one read going for a stream
+static void refill(UringReader* r)
+{
+    uint64_t max_inflight = r->seekable ? r->nbuf : 1;
+    while (!r->ended && r->submitted - r->delivered < r->nbuf && r->submitted - r->completed < max_inflight)
+    {
+        uint64_t offset = r->base_offset + r->submitted * r->block_bytes;
+        if (r->seekable && offset >= r->size) break;
+        uint64_t seq = r->submitted++;
+        r->done[seq % r->nbuf] = 0;
+        queue_read(r, block_ptr(r, seq), r->block_bytes, r->seekable ? offset : (uint64_t)-1, seq, r->fixed);
+    }
+}
+
+// Waits for everything in flight. Reads from a file always finish, one
+// waiting on a quiet pipe has to be cancelled, which gets `timeout_ms`.
+// Returns 0 once nothing is in flight.
+static int drain(UringReader* r, int cancel, int timeout_ms)
+{
+    if (cancel && r->completed != r->submitted)
+    {
+        struct io_uring_sqe* sqe = next_sqe(r);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = r->fd;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        sqe->user_data = CANCEL_TAG;
+        push_sqe(r);
+    }
+    while (r->completed != r->submitted || r->queued > 0)
+    {
+        int ret = submit_and_wait(r, (unsigned)(r->submitted - r->completed), timeout_ms);
+        if (ret == -1 && errno != EINTR && errno != ETIME) return -1;
+        reap(r);
+        if (ret == -1 && errno == ETIME) break;
+    }
+    return r->completed == r->submitted ? 0 : -1;
+}
+
+int uring_available(void)
+{
+    static int available = -1;
+    if (available == -1)
+    {
+        UringReader r;
+        memset(&r, 0, sizeof(r));
+        r.ring_fd = -1;
+        available = setup_ring(&r, 1) == 0;
+        unmap_ring(&r);
+    }
+    return available;
+}
+
+int open_uring_reader(UringReader* r, int fd, uint64_t offset, size_t block_bytes, unsigned depth)
+{
+    memset(r, 0, sizeof(*r));
+    r->ring_fd = -1;
+    r->fd = fd;
+    struct stat st;
+    if (fstat(fd, &st) == -1) return -1;
+    r->seekable = S_ISREG(st.st_mode) || S_ISBLK(st.st_mode);
+    if (r->seekable)
+    {
+        // st_size is 0 for a block device
+        off_t end = lseek(fd, 0, SEEK_END);
+        if (end == -1) return -1;
+        r->size = (uint64_t)end;
+    }
+    r->block_bytes = (block_bytes + URING_ALIGN - 1) / URING_ALIGN * URING_ALIGN;
+    r->nbuf = depth > 0 ? depth : 1;
+
+    if (setup_ring(r, r->nbuf + 1) != 0) return -1;
+    size_t nbytes = r->nbuf * r->block_bytes;
+    void* blocks = mmap(NULL, nbytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    r->results = (int32_t*)calloc(r->nbuf, sizeof(int32_t));
+    r->done = (uint8_t*)calloc(r->nbuf, 1);
+    if (blocks == MAP_FAILED || !r->results || !r->done)
+    {
+        int err = errno;
+        if (blocks != MAP_FAILED) munmap(blocks, nbytes);
+        free(r->results);
+        free(r->done);
+        unmap_ring(r);
+        errno = err;
+        return -1;
+    }
+    r->blocks = (char*)blocks;
+
+    // Pinning the buffers saves mapping them on every read, but counts
+    // against RLIMIT_MEMLOCK. Plain reads do if that's too tight.
+    struct iovec iov = { .iov_base = r->blocks, .iov_len = nbytes };
+    r->fixed = sys_io_uring_register(r->ring_fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+
+    if (r->seekable)
+    {
+        uring_reader_seek(r, offset);
+    }
+    return 0;
+}
+
+void uring_reader_seek(UringReader* r, uint64_t offset)
+{
+    if (!r->seekable) return;
+    // Buffers can't be reused until the reads into them land
+    drain(r, 0, -1);
+    r->submitted = 0;
+    r->completed = 0;
+    r->delivered = 0;
+    r->holding = 0;
+    r->ended = 0;
+    r->base_offset = offset / URING_ALIGN * URING_ALIGN;
+    r->lead = offset - r->base_offset;
+    memset(r->done, 0, r->nbuf);
+}
+
+ssize_t uring_reader_next(UringReader* r, const char** data, int timeout_ms)
+{
+    if (r->holding)
+    {
+        r->delivered++;
+        r->holding = 0;
+    }
+    refill(r);
+
+    uint64_t seq = r->delivered;
+    unsigned slot = seq % r->nbuf;
+    // Past the end of a file, or a stream that already ended
+    if (seq == r->submitted) return 0;
+    while (!r->done[slot])
+    {
+        if (submit_and_wait(r, 1, timeout_ms) == -1) return -1;
+        reap(r);
+    }
+    // Get the next read going before the caller gets busy with this one
+    refill(r);
+    if (r->queued > 0)
+    {
+        submit_and_wait(r, 0, 0);
+    }
+
+    int32_t res = r->results[slot];
+    if (res < 0)
+    {
+        r->ended = 1;
+        r->delivered++;
+        errno = -res;
+        return -1;
+    }
+    if (res == 0)
+    {
+        r->ended = 1;
+        r->delivered++;
+        return 0;
+    }
+    if (r->seekable && (size_t)res < r->block_bytes
+            && r->base_offset + seq * r->block_bytes + res < r->size)
+    {
+        // Files only come up short at the end
+        r->ended = 1;
+        r->delivered++;
+        errno = EIO;
+        return -1;
+    }
+
+    size_t skip = seq == 0 ? r->lead : 0;
+    if ((size_t)res <= skip)
+    {
+        r->delivered++;
+        return 0;
+    }
+    r->holding = 1;
+    *data = block_ptr(r, seq) + skip;
+    return res - (ssize_t)skip;
+}
+
+void close_uring_reader(UringReader* r)
+{
+    if (r->ring_fd == -1) return;
+    int idle = drain(r, !r->seekable, CLOSE_WAIT_MS) == 0;
+    unmap_ring(r);
+    // A read the kernel still holds might land in them after all, unless they
+    // were pinned, so they're better leaked
+    if (r->blocks && (idle || r->fixed))
+    {
+        munmap(r->blocks, r->nbuf * r->block_bytes);
+    }
+    free(r->results);
+    free(r->done);
+    r->blocks = NULL;
+}
+
+int open_uring_batch(UringReader* r)
+{
+    memset(r, 0, sizeof(*r));
+    r->ring_fd = -1;
+    r->fd = -1;
+    return setup_ring(r, URING_DEPTH);
+}
+
+// Takes back reads queued but not yet handed to the kernel, so they don't
+// go out with the next batch
+static void unqueue(UringReader* r)
+{
+    unsigned tail = atomic_load_explicit(r->sq_tail, memory_order_relaxed);
+    atomic_store_explicit(r->sq_tail, tail - r->queued, memory_order_release);
+    r->queued = 0;
+}
+
+int uring_read_into(UringReader* r, int fd, void* dst, uint64_t nbytes, uint64_t offset)
+{
+    r->fd = fd;
+
+    // Each read in flight covers a piece of dst, finishing it off if it
+    // comes back short
+    struct { uint64_t pos, end; } pieces[URING_DEPTH];
+    int busy[URING_DEPTH] = { 0 };
+    unsigned nbusy = 0;
+    uint64_t next = 0;
+    int err = 0;
+    while (nbusy > 0 || (next < nbytes && !err))
+    {
+        for (unsigned i = 0; i < URING_DEPTH && next < nbytes && !err; i++)
+        {
+            if (busy[i]) continue;
+            uint64_t len = nbytes - next < URING_BLOCK_BYTES ? nbytes - next : URING_BLOCK_BYTES;
+            pieces[i].pos = next;
+            pieces[i].end = next + len;
+            busy[i] = 1;
+            nbusy++;
+            queue_read(r, (char*)dst + next, len, offset + next, i, 0);
+            next += len;
+        }
+        if (submit_and_wait(r, 1, -1) == -1)
+        {
+            if (errno == EINTR) continue;
+            if (!err)
+            {
+                err = errno;
+            }
+            if (nbusy == r->queued)
+            {
+                // The kernel has none of them, so dst is the caller's again
+                unqueue(r);
+                break;
+            }
+            if (errno != EAGAIN && errno != EBUSY)
+            {
+                // Reads into dst are still going and there's no way left to
+                // wait for them, so it can't be handed back
+                perror("io_uring_enter");
+                exit(EXIT_FAILURE);
+            }
+            // Out of resources for now, what's in flight finishes anyway
+        }
+
+        unsigned head = atomic_load_explicit(r->cq_head, memory_order_relaxed);
+        unsigned tail = atomic_load_explicit(r->cq_tail, memory_order_acquire);
+        for (; head != tail; head++)
+        {
+            const struct io_uring_cqe* cqe = &((const struct io_uring_cqe*)r->cqes)[head & r->cq_mask];
+            unsigned i = (unsigned)cqe->user_data;
+            if (cqe->res > 0) {
+                pieces[i].pos += cqe->res;
+            } else if (cqe->res != -EINTR && cqe->res != -EAGAIN) {
+                // 0 means the file is shorter than asked for
+                err = cqe->res == 0 ? EIO : -cqe->res;
+                pieces[i].pos = pieces[i].end;
+            }
+            if (pieces[i].pos < pieces[i].end && !err) {
+                queue_read(r, (char*)dst + pieces[i].pos, pieces[i].end - pieces[i].pos, offset + pieces[i].pos, i, 0);
+            } else {
+                // Once something failed the rest just get waited for
+                busy[i] = 0;
+                nbusy--;
+            }
+        }
+        atomic_store_explicit(r->cq_head, head, memory_order_release);
+    }
+
+    if (err)
+    {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+int uring_read_all(int fd, void* dst, uint64_t nbytes, uint64_t offset)
+{
+    UringReader r;
+    if (open_uring_batch(&r) != 0) return -1;
+    int ret = uring_read_into(&r, fd, dst, nbytes, offset);
+    int err = errno;
+    close_uring_reader(&r);
+    errno = err;
+    return ret;
+}
+
+#else
+
+int uring_available(void)
+{
+    return 0;
+}
+
+int open_uring_reader(UringReader* r, int fd, uint64_t offset, size_t block_bytes, unsigned depth)
+{
+    (void)fd;
+    (void)offset;
+    (void)block_bytes;
+    (void)depth;
+    memset(r, 0, sizeof(*r));
+    r->ring_fd = -1;
+    errno = ENOSYS;
+    return -1;
+}
+
+void uring_reader_seek(UringReader* r, uint64_t offset)
+{
+    (void)r;
+    (void)offset;
+}
+
+ssize_t uring_reader_next(UringReader* r, const char** data, int timeout_ms)
+{
+    (void)r;
+    (void)data;
+    (void)timeout_ms;
+    errno = ENOSYS;
+    return -1;
+}
+
+void close_uring_reader(UringReader* r)
+{
+    (void)r;
+}
+
+int open_uring_batch(UringReader* r)
+{
+    memset(r, 0, sizeof(*r));
+    r->ring_fd = -1;
+    errno = ENOSYS;
+    return -1;
+}
+
+int uring_read_into(UringReader* r, int fd, void* dst, uint64_t nbytes, uint64_t offset)
+{
+    (void)r;
+    (void)fd;
+    (void)dst;
+    (void)nbytes;
+    (void)offset;
+    errno = ENOSYS;
+    return -1;
+}
+
+int uring_read_all(int fd, void* dst, uint64_t nbytes, uint64_t offset)
+{
+    (void)fd;
+    (void)dst;
+    (void)nbytes;
+    (void)offset;
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif
@@ -1,15 +1,17 @@
-#include <errno.h>
-#include <fcntl.h>
 #include <float.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/ioctl.h>
 
 #include "raylib.h"
+#include "rlgl.h"
+#include "accumulate.h"
+#include "binning.h"
+#include "colorize.h"
 #include "common.h"
+#include "ingest.h"
 #include "grayscale_colormap.h"
 #include "inferno_colormap.h"
 #include "viridis_colormap.h"
@@ -43,137 +45,640 @@ size_t ntags = 0;
 ActiveScreen active_screen = MAIN;
 
 
-// TODO: Implement zoom on actual waterfall/texture
+typedef struct Colormap {
+    const char* name;
+    float (*table)[3];
+    uint32_t lut[COLORMAP_SIZE];    // table packed as Colors by build_colormap_luts()
+} Colormap;
+
+static Colormap colormaps[] = {
+    { .name = "inferno", .table = inferno_srgb_floats },
+    { .name = "viridis", .table = viridis_srgb_floats },
+    { .name = "turbo", .table = turbo_srgb_floats },
+    { .name = "grey", .table = grayscale_srgb_floats },
+};
+#define NCOLORMAPS (int)(sizeof(colormaps) / sizeof(colormaps[0]))
+
+// Once at startup, everything after that just points at the tables
+static void build_colormap_luts(void)
+{
+    for (int i = 0; i < NCOLORMAPS; i++)
+    {
+        build_colormap_lut(colormaps[i].table, colormaps[i].lut);
+    }
+}
+
+// Looks each colormap index up in a 256 entry palette texture. The index
+// texture sampled from texture0 is single channel, so its red is the index
+// over 255.
+static const char* palette_fs_330 =
+    "#version 330\n"
+    "in vec2 fragTexCoord;\n"
+    "in vec4 fragColor;\n"
+    "uniform sampler2D texture0;\n"
+    "uniform sampler2D palette;\n"
+    "uniform vec4 colDiffuse;\n"
+    "out vec4 finalColor;\n"
+    "void main()\n"
+    "{\n"
+    "    float index = texture(texture0, fragTexCoord).r;\n"
+    "    finalColor = texture(palette, vec2((index * 255.0 + 0.5) / 256.0, 0.5)) * colDiffuse * fragColor;\n"
+    "}\n";
+
+// Same for OpenGL 2.1 and ES 2.0
+static const char* palette_fs_100 =
+    "#ifdef GL_ES\n"
+    "precision mediump float;\n"
+    "#endif\n"
+    "varying vec2 fragTexCoord;\n"
+    "varying vec4 fragColor;\n"
+    "uniform sampler2D texture0;\n"
+    "uniform sampler2D palette;\n"
+    "uniform vec4 colDiffuse;\n"
+    "void main()\n"
+    "{\n"
+    "    float index = texture2D(texture0, fragTexCoord).r;\n"
+    "    gl_FragColor = texture2D(palette, vec2((index * 255.0 + 0.5) / 256.0, 0.5)) * colDiffuse * fragColor;\n"
+    "}\n";
+
+// Turns colormap indices into colors when the waterfall is drawn, so a new
+// colormap recolors the whole history at once. Without shaders (OpenGL 1.1)
+// the waterfall's rows get colored on the CPU as they're uploaded instead.
+typedef struct Palette {
+    const uint32_t* lut;    // the colormap's, 256 Colors
+    int on_gpu;
+    Shader shader;
+    int palette_loc;
+    Texture2D texture;  // 256x1, only on_gpu
+} Palette;
+
+Palette new_palette(const Colormap* colormap)
+{
+    Palette p = { .lut = colormap->lut, .on_gpu = 0, .palette_loc = -1 };
+    int version = rlGetVersion();
+    if (version == RL_OPENGL_33 || version == RL_OPENGL_43) {
+        p.shader = LoadShaderFromMemory(NULL, palette_fs_330);
+    } else if (version != RL_OPENGL_11) {
+        p.shader = LoadShaderFromMemory(NULL, palette_fs_100);
+    }
+    if (version != RL_OPENGL_11)
+    {
+        // A shader that failed to build comes back as the default, which
+        // has no palette
+        p.palette_loc = GetShaderLocation(p.shader, "palette");
+    }
+    if (p.palette_loc != -1) {
+        p.on_gpu = 1;
+        Image image = {
+            .data = (void*)p.lut,
+            .width = COLORMAP_SIZE,
+            .height = 1,
+            .mipmaps = 1,
+            .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
+        };
+        p.texture = LoadTextureFromImage(image);
+        SetTextureFilter(p.texture, TEXTURE_FILTER_POINT);
+    } else {
+        fprintf(stderr, "No palette shader, colormapping on the CPU\n");
+        if (version != RL_OPENGL_11)
+        {
+            UnloadShader(p.shader);
+        }
+    }
+    return p;
+}
+
+void free_palette(Palette* p)
+{
+    if (p->on_gpu)
+    {
+        UnloadTexture(p->texture);
+        UnloadShader(p->shader);
+    }
+}
+
+void set_palette_colormap(Palette* p, const Colormap* colormap)
+{
+    p->lut = colormap->lut;
+    if (p->on_gpu)
+    {
+        UpdateTexture(p->texture, p->lut);
+    }
+}
+
 typedef struct Waterfall {
-    int width;
+    int width;      // bins in each row of history
+    int columns;    // pixels across the texture, the window's width
     int height;
-    float min_value;
-    float max_value;
     int yidx;
-    Color* pixels;
+    int nrows;      // rows pushed so far, up to height
+    // Every row as it came in, so new color limits or a new range of bins
+    // can be applied to the whole history rather than just new rows
+    float* history;
+    // The history at halved resolutions down to a few entries per column,
+    // so binning costs the same however many bins are in view
+    BinPyramid pyramid;
+    // Bins [first_bin, first_bin + nbins) of each row reduced to columns by
+    // bin_mode, which is what gets colormapped
+    BinMode bin_mode;
+    uint64_t first_bin;
+    uint64_t nbins;
+    float* binned;
+    // Extremes of each binned row, for the auto limits
+    float* row_min;
+    float* row_max;
+    // Values at the bottom and top of the colormap, which follow the data
+    // while auto_limits is set. Not valid until hi > lo.
+    float lo;
+    float hi;
+    int auto_limits;
+    int stale;      // limits or bins changed since indices were last worked out
+    // Colormap index of each pixel, which is what goes to the GPU when
+    // there's a palette shader
+    unsigned char* indices;
+    // Rows pushed since the last upload, dirty_start onwards wrapping round
+    // the bottom, so only those need to go to the GPU
+    int dirty_start;
+    int ndirty;
+    // Without one, each pixel's Color and the colormap to find it in
+    uint32_t* colors;
+    const uint32_t* lut;
+    Texture2D texture;
 } Waterfall;
 
-// Allocates Color*, up to user to free
-Waterfall new_waterfall(int width, int height)
+// Allocates the history, indices or colors and the texture, up to user to
+// free. Starts with every bin spread over the columns.
+Waterfall new_waterfall(int width, int columns, int height, BinMode bin_mode, const Palette* palette)
 {
-    int buffer_size = width * height;
-    Color* pixels = (Color*)calloc(sizeof(Color), buffer_size);
-    int idx;
-    for (int y = 0; y < height; y++)
+    // A pixel shows one value, so the envelope is just its top
+    if (bin_mode == BIN_ENVELOPE)
     {
-        for (int x = 0; x < width; x++)
-        {
-            idx = (y * width + x) % buffer_size;
-            pixels[idx] = BLACK;
-        }
+        bin_mode = BIN_MAX;
     }
+    float* history = (float*)calloc((size_t)width * height, sizeof(float));
+    float* binned = (float*)calloc((size_t)columns * height, sizeof(float));
+    float* row_min = (float*)calloc(height, sizeof(float));
+    float* row_max = (float*)calloc(height, sizeof(float));
+    unsigned char* indices = NULL;
+    uint32_t* colors = NULL;
+    if (palette->on_gpu) {
+        indices = (unsigned char*)calloc(columns * height, 1);
+    } else {
+        colors = (uint32_t*)calloc(sizeof(uint32_t), columns * height);
+    }
+    if (!history || !binned || !row_min || !row_max || (!indices && !colors))
+    {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    Image image = {
+        .data = palette->on_gpu ? (void*)indices : (void*)colors,
+        .width = columns,
+        .height = height,
+        .mipmaps = 1,
+        .format = palette->on_gpu ? PIXELFORMAT_UNCOMPRESSED_GRAYSCALE : PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
+    };
+    Texture2D texture = LoadTextureFromImage(image);
+    // Blending neighbouring indices would land on unrelated colors
+    SetTextureFilter(texture, TEXTURE_FILTER_POINT);
 
     Waterfall r = {
         .width = width,   
+        .columns = columns,
         .height = height,   
-        .min_value = FLT_MAX,
-        .max_value = FLT_MIN,
         .yidx = 0,   
-        .pixels = pixels
+        .nrows = 0,
+        .history = history,
+        .pyramid = new_bin_pyramid(width, height, BIN_PYRAMID_MIN_ENTRIES * columns, bin_mode),
+        .bin_mode = bin_mode,
+        .first_bin = 0,
+        .nbins = width,
+        .binned = binned,
+        .row_min = row_min,
+        .row_max = row_max,
+        .lo = FLT_MAX,
+        .hi = -FLT_MAX,
+        .auto_limits = 1,
+        .stale = 0,
+        .indices = indices,
+        // Index 0 is the bottom of the colormap rather than black, so
+        // everything goes up first time
+        .dirty_start = 0,
+        .ndirty = height,
+        .colors = colors,
+        .lut = palette->on_gpu ? NULL : palette->lut,
+        .texture = texture,
     };
     return r;
 }
 
 void free_waterfall(Waterfall* r)
 {
-    free(r->pixels);
+    UnloadTexture(r->texture);
+    free(r->history);
+    free_bin_pyramid(&r->pyramid);
+    free(r->binned);
+    free(r->row_min);
+    free(r->row_max);
+    free(r->indices);
+    free(r->colors);
+}
+
+static void set_limits(Waterfall* waterfall, float lo, float hi)
+{
+    if (lo == waterfall->lo && hi == waterfall->hi) return;
+    waterfall->lo = lo;
+    waterfall->hi = hi;
+    waterfall->stale = 1;
 }
 
-// Updates `pixels` by pushing a horizontal line of width pixels
-void push_line(const float* line_of_pixels, Waterfall* waterfall, float* colormap)
+// Fits the limits to the rows in the history. They only move once the data
+// goes outside them or shrinks to under 2/3 of them, and then leave 1/16 of
+// the data's range spare each side, so they don't chase every row. An
+// outlier stops counting once its row scrolls out.
+static void update_auto_limits(Waterfall* waterfall)
 {
-    for (int x = 0; x < waterfall->width; x++)
+    float lo = FLT_MAX;
+    float hi = -FLT_MAX;
+    for (int i = 0; i < waterfall->nrows; i++)
     {
-        float value = line_of_pixels[x];
-        if (value > waterfall->max_value)
-        {
-            waterfall->max_value = value;
-        }
-        if (value < waterfall->min_value)
+        lo = waterfall->row_min[i] < lo ? waterfall->row_min[i] : lo;
+        hi = waterfall->row_max[i] > hi ? waterfall->row_max[i] : hi;
+    }
+    if (lo > hi) return; // nothing but NaNs so far
+
+    float span = hi - lo;
+    if (lo >= waterfall->lo && hi <= waterfall->hi && 3.0f * span >= 2.0f * (waterfall->hi - waterfall->lo))
+    {
+        return;
+    }
+    float pad = span / 16.0f;
+    if (pad == 0.0f)
+    {
+        // Flat so far, give it a range to sit in the middle of
+        pad = fabsf(hi) > 1.0f ? 1e-3f * fabsf(hi) : 1e-3f;
+    }
+    set_limits(waterfall, lo - pad, hi + pad);
+}
+
+// Fixes the limits where they are until auto_waterfall_limits(). hi must be
+// above lo.
+void set_waterfall_limits(Waterfall* waterfall, float lo, float hi)
+{
+    waterfall->auto_limits = 0;
+    set_limits(waterfall, lo, hi);
+}
+
+// Goes back to fitting the limits to the data, starting afresh
+void auto_waterfall_limits(Waterfall* waterfall)
+{
+    waterfall->auto_limits = 1;
+    float lo = waterfall->lo;
+    float hi = waterfall->hi;
+    waterfall->lo = FLT_MAX;
+    waterfall->hi = -FLT_MAX;
+    update_auto_limits(waterfall);
+    if (waterfall->lo > waterfall->hi)
+    {
+        // No data to fit yet, keep the old ones till there is
+        waterfall->lo = lo;
+        waterfall->hi = hi;
+    }
+}
+
+// Reduces the bins in view of history row `y` to the columns, from
+// whichever level of the pyramid has about one entry per column, and notes
+// the row's extremes
+static void bin_row(Waterfall* waterfall, int y)
+{
+    const float* raw = waterfall->history + (size_t)y * waterfall->width;
+    float* row = waterfall->binned + (size_t)y * waterfall->columns;
+    bin_pyramid_row(&waterfall->pyramid, y, raw, waterfall->first_bin, waterfall->nbins,
+            waterfall->columns, row);
+    float lo = FLT_MAX;
+    float hi = -FLT_MAX;
+    for (int x = 0; x < waterfall->columns; x++)
+    {
+        lo = row[x] < lo ? row[x] : lo;
+        hi = row[x] > hi ? row[x] : hi;
+    }
+    waterfall->row_min[y] = lo;
+    waterfall->row_max[y] = hi;
+}
+
+// Spreads bins [first_bin, first_bin + nbins) over the columns from now on,
+// redoing every row in the history. That costs about two reads per pixel
+// of the texture however many bins are in view, unless the mode changed
+// and the pyramid has to be rebuilt.
+void set_waterfall_view(Waterfall* waterfall, uint64_t first_bin, uint64_t nbins, BinMode bin_mode)
+{
+    if (bin_mode == BIN_ENVELOPE)
+    {
+        bin_mode = BIN_MAX;
+    }
+    if (first_bin == waterfall->first_bin && nbins == waterfall->nbins && bin_mode == waterfall->bin_mode)
+    {
+        return;
+    }
+    if (bin_mode != waterfall->bin_mode)
+    {
+        waterfall->pyramid.mode = bin_mode;
+        for (int y = 0; y < waterfall->nrows; y++)
         {
-            waterfall->min_value = value;
+            build_pyramid_row(&waterfall->pyramid, y, waterfall->history + (size_t)y * waterfall->width);
         }
     }
+    waterfall->first_bin = first_bin;
+    waterfall->nbins = nbins;
+    waterfall->bin_mode = bin_mode;
+    for (int y = 0; y < waterfall->nrows; y++)
+    {
+        bin_row(waterfall, y);
+    }
+    if (waterfall->auto_limits)
+    {
+        update_auto_limits(waterfall);
+    }
+    waterfall->stale = waterfall->hi > waterfall->lo;
+}
 
-    float range = waterfall->max_value - waterfall->min_value;
-    for (int x = 0; x < waterfall->width; x++)
+// Stores a horizontal line of width values in the history and works out the
+// colormap indices, or colors, of the bins in view. When it moves the limits
+// they're left for requantize_waterfall() to redo all at once.
+void push_line(const float* line_of_pixels, Waterfall* waterfall)
+{
+    float* raw = waterfall->history + (size_t)waterfall->yidx * waterfall->width;
+    memcpy(raw, line_of_pixels, waterfall->width * sizeof(float));
+    build_pyramid_row(&waterfall->pyramid, waterfall->yidx, raw);
+    bin_row(waterfall, waterfall->yidx);
+    if (waterfall->nrows < waterfall->height)
     {
-        float value = line_of_pixels[x];
-        // Apply colormap here
-        int idx = (int)(230.0 * ((value - waterfall->min_value) / (range + 1e-6)));
-        Color c = {
-            255 * colormap[3 * idx],
-            255 * colormap[3 * idx + 1],
-            255 * colormap[3 * idx + 2],
-            255
-        };
-        idx = (waterfall->yidx * waterfall->width + x);
-        waterfall->pixels[idx] = c;
+        waterfall->nrows++;
+    }
+    if (waterfall->auto_limits)
+    {
+        update_auto_limits(waterfall);
+    }
+
+    int columns = waterfall->columns;
+    size_t offset = (size_t)waterfall->yidx * columns;
+    const float* row = waterfall->binned + offset;
+    if (waterfall->hi <= waterfall->lo) {
+        if (waterfall->indices) {
+            memset(waterfall->indices + offset, 0, columns);
+        } else {
+            memset(waterfall->colors + offset, 0, columns * sizeof(uint32_t));
+        }
+    } else if (!waterfall->stale) {
+        if (waterfall->indices) {
+            quantize_row(row, waterfall->indices + offset, columns, waterfall->lo, waterfall->hi);
+        } else {
+            colorize_row(row, waterfall->colors + offset, columns, waterfall->lo, waterfall->hi, waterfall->lut);
+        }
+    }
+    if (waterfall->ndirty == 0)
+    {
+        waterfall->dirty_start = waterfall->yidx;
+    }
+    if (waterfall->ndirty < waterfall->height)
+    {
+        waterfall->ndirty++;
     }
     (waterfall->yidx)++;
     waterfall->yidx %= waterfall->height;
 }
 
+// Works out every row's indices or colors again after the limits, the bins
+// in view or the colormap changed, spread over the quantizer's threads, and
+// marks them all for upload
+void requantize_waterfall(Waterfall* waterfall, Quantizer* quantizer)
+{
+    if (!waterfall->stale) return;
+    if (waterfall->indices) {
+        quantize_rows(quantizer, waterfall->binned, waterfall->indices,
+                waterfall->nrows, waterfall->columns, waterfall->lo, waterfall->hi);
+    } else {
+        colorize_rows(quantizer, waterfall->binned, waterfall->colors,
+                waterfall->nrows, waterfall->columns, waterfall->lo, waterfall->hi, waterfall->lut);
+    }
+    waterfall->stale = 0;
+    waterfall->dirty_start = 0;
+    waterfall->ndirty = waterfall->height;
+}
+
+// Limits in the bottom left corner
+void draw_limits(const Waterfall* waterfall)
+{
+    char text[64];
+    if (waterfall->hi > waterfall->lo) {
+        snprintf(text, 64, "%g .. %g %s", waterfall->lo, waterfall->hi,
+                waterfall->auto_limits ? "auto" : "fixed");
+    } else {
+        snprintf(text, 64, "no data");
+    }
+    int y = screen.height - 20;
+    DrawRectangle(0, y, MeasureText(text, 10) + 20, 20, Fade(WHITE, 0.7f));
+    DrawText(text, 10, y + 5, 10, BLACK);
+}
+
+// Uploads rows [first, first + n)
+static void upload_rows(Waterfall* waterfall, int first, int n)
+{
+    int width = waterfall->columns;
+    Rectangle rows = { 0, first, width, n };
+    if (waterfall->indices) {
+        UpdateTextureRec(waterfall->texture, rows, waterfall->indices + first * width);
+    } else {
+        UpdateTextureRec(waterfall->texture, rows, waterfall->colors + first * width);
+    }
+}
+
+// Uploads just the rows pushed since the last call. A run of rows that
+// wraps past the bottom of the texture goes up as two rectangles.
+void upload_waterfall(Waterfall* waterfall)
+{
+    if (waterfall->ndirty == 0) return;
+    int first = waterfall->dirty_start;
+    int n = waterfall->ndirty;
+    if (n == waterfall->height)
+    {
+        // Every row, wherever the run started
+        first = 0;
+    }
+    int nfirst = n < waterfall->height - first ? n : waterfall->height - first;
+    upload_rows(waterfall, first, nfirst);
+    if (n > nfirst)
+    {
+        upload_rows(waterfall, 0, n - nfirst);
+    }
+    waterfall->ndirty = 0;
+}
+
+// Switches colormap. On the GPU that's just the palette, otherwise every
+// row needs coloring again.
+void set_waterfall_colormap(Waterfall* waterfall, Palette* palette, const Colormap* colormap)
+{
+    set_palette_colormap(palette, colormap);
+    if (!palette->on_gpu)
+    {
+        waterfall->lut = palette->lut;
+        waterfall->stale = waterfall->hi > waterfall->lo;
+    }
+}
+
+// Draws the texture's `source` rectangle over `dest` through the palette
+void draw_waterfall(const Waterfall* waterfall, const Palette* palette, Rectangle source, Rectangle dest)
+{
+    if (palette->on_gpu)
+    {
+        BeginShaderMode(palette->shader);
+        SetShaderValueTexture(palette->shader, palette->palette_loc, palette->texture);
+    }
+    NPatchInfo patch_info = {
+        source, 0, 0, 0, 0, NPATCH_NINE_PATCH
+    };
+    DrawTextureNPatch(waterfall->texture, patch_info, dest, (Vector2){ 0.0f, 0.0f }, 0.0f, WHITE);
+    if (palette->on_gpu)
+    {
+        EndShaderMode();
+    }
+}
+
+// The part of the whole frame and history the current zoom spans, as
+// fractions of it from the left and top. zoom_stack[0] spans everything.
+static Rectangle zoom_fraction(const Screen* screen)
+{
+    Zoom z0 = screen->zoom_stack[0];
+    Zoom z = screen->zoom_stack[screen->zlevel];
+    Rectangle r = {
+        (z.logical_minx - z0.logical_minx) / z0.logical_width,
+        // Logical y goes up the screen, texture rows down it
+        1.0f - (z.logical_miny + z.logical_height - z0.logical_miny) / z0.logical_height,
+        z.logical_width / z0.logical_width,
+        z.logical_height / z0.logical_height,
+    };
+    return r;
+}
+
+static double clamp01(double x)
+{
+    return x < 0.0 ? 0.0 : (x > 1.0 ? 1.0 : x);
+}
+
 int main(int argc, char *argv[])
 {
     SetConfigFlags(FLAG_WINDOW_RESIZABLE);
-    int frame_size = 1024;
+    IngestOptions ingest_opts = default_ingest_options(1024);
     int c;
-    float* colormap = (float*)inferno_srgb_floats;
-    char* color_choice = NULL;
-
-    while ((c = getopt(argc, argv, "f:c:")) != -1)
+    int colormap = 0;
+    Reducer reducer = REDUCE_MEAN;
+    BinMode bin_mode = BIN_MAX;
+    int frames_per_row = 1;
+    int fixed_limits = 0;
+    float lo = 0.0f;
+    float hi = 0.0f;
+
+    while ((c = getopt(argc, argv, INGEST_OPTSTRING "c:a:n:l:B:")) != -1)
     {
+        if (parse_ingest_option(c, optarg, &ingest_opts)) continue;
         switch (c)
         {
-            case 'f':
-                frame_size = atoi(optarg);
             case 'c':
-                color_choice = optarg;
-                if (strncmp(color_choice, "inferno", 7) == 0) {
-                    colormap = (float*)inferno_srgb_floats;
-                } else if (strncmp(color_choice, "viridis", 7) == 0) {
-                    colormap = (float*)viridis_srgb_floats;
-                } else if (strncmp(color_choice, "turbo", 5) == 0) {
-                    colormap = (float*)turbo_srgb_floats;
-                } else if (strncmp(color_choice, "gray", 4) == 0) {
-                    colormap = (float*)grayscale_srgb_floats;
-                } else if (strncmp(color_choice, "grey", 4) == 0) {
-                    colormap = (float*)grayscale_srgb_floats;
+                if (strncmp(optarg, "inferno", 7) == 0) {
+                    colormap = 0;
+                } else if (strncmp(optarg, "viridis", 7) == 0) {
+                    colormap = 1;
+                } else if (strncmp(optarg, "turbo", 5) == 0) {
+                    colormap = 2;
+                } else if (strncmp(optarg, "gray", 4) == 0) {
+                    colormap = 3;
+                } else if (strncmp(optarg, "grey", 4) == 0) {
+                    colormap = 3;
                 }
                 break;
+            case 'a':
+                if (parse_reducer(optarg, &reducer) != 0)
+                {
+                    fprintf(stderr, "Unknown reducer: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'n':
+                frames_per_row = atoi(optarg);
+                if (frames_per_row < 0)
+                {
+                    fprintf(stderr, "Bad frames per row: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'B':
+                if (parse_bin_mode(optarg, &bin_mode) != 0)
+                {
+                    fprintf(stderr, "Unknown bin mode: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                if (bin_mode == BIN_ENVELOPE)
+                {
+                    // One value per pixel, so the top of the envelope
+                    bin_mode = BIN_MAX;
+                }
+                break;
+            case 'l':
+                if (sscanf(optarg, "%f,%f", &lo, &hi) != 2 || !(hi > lo))
+                {
+                    fprintf(stderr, "Bad color limits: %s, want <lo>,<hi>\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                fixed_limits = 1;
+                break;
             default:
                 abort();
         }
     }
 
-    printf("frame size     : %d\n", frame_size);
-    printf("colormap choice: %s\n", color_choice);
+    if (optind < argc)
+    {
+        ingest_opts.input = argv[optind];
+    }
+    resolve_ingest_input(&ingest_opts);
+    print_ingest_options(&ingest_opts);
+    int frame_size = ingest_frame_size(&ingest_opts);
+    printf("colormap choice: %s\n", colormaps[colormap].name);
+    printf("row reducer    : %s\n", reducer_name(reducer));
+    printf("colorize       : %s\n", colorize_isa());
+    printf("frames per row : %d\n", frames_per_row);
+    printf("column binning : %s (%s)\n", bin_mode_name(bin_mode), binning_isa());
+    if (fixed_limits) {
+        printf("color limits   : %g,%g\n", lo, hi);
+    } else {
+        printf("color limits   : auto\n");
+    }
 
     // Now set up our GUI
     InitWindow(screen.width, screen.height, "Waterfall");
     screen.width = GetScreenWidth();
     screen.height = GetScreenHeight();
-    Waterfall waterfall = new_waterfall(frame_size, screen.height);
+    build_colormap_luts();
+    Palette palette = new_palette(&colormaps[colormap]);
+    Waterfall waterfall = new_waterfall(frame_size, screen.width, screen.height, bin_mode, &palette);
+    if (fixed_limits)
+    {
+        set_waterfall_limits(&waterfall, lo, hi);
+    }
+    Quantizer quantizer;
+    start_quantizer(&quantizer, 0);
     SetTargetFPS(120);
     Font font = LoadFont("resources/fonts/pixelplay.png");
 
-    float* buffer = (float*)calloc(sizeof(float), 16 * frame_size);
-
-    RenderTexture2D rtex = LoadRenderTexture(frame_size, screen.height);
-    Color* line_of_pixels = (Color*)calloc(sizeof(Color), waterfall.width);
     Vector2 click_start = { 0, 0 };
     Vector2 click_end = { 0, 0 };
     int last_mouse = 0; // 0 - not pressed, 1 - pressed
 
-    fcntl(0, F_SETFL, fcntl(0, F_GETFL) | O_NONBLOCK);
+    RowAccumulator row = new_row_accumulator(frame_size, reducer);
+
+    Ingest ingest;
+    start_source(&ingest, &ingest_opts);
 
-    Vector2 origin = { 0.0f, 0.0f };
     while (!WindowShouldClose())
     {
         // Update
@@ -183,49 +688,56 @@ int main(int argc, char *argv[])
             screen.width = GetScreenWidth();
             screen.height = GetScreenHeight();
 
+            // Fixed limits outlive the history
+            int auto_limits = waterfall.auto_limits;
+            lo = waterfall.lo;
+            hi = waterfall.hi;
             free_waterfall(&waterfall);
-            waterfall = new_waterfall(frame_size, screen.height);
-
-            rtex = LoadRenderTexture(frame_size, screen.height);
-
-            free(line_of_pixels);
-            line_of_pixels = (Color*)calloc(sizeof(Color), waterfall.width);
-
-            free(buffer);
-            buffer = (float*)calloc(sizeof(float), 16 * frame_size);
-        }
-
-        int nbytes_ready = 0;
-        // Receive all queued up data and push to Waterfall before rendering frame
-        if (ioctl(0, FIONREAD, &nbytes_ready) == -1)
-        {
-            perror("ioctl[FIONREAD]");
-            break;
+            waterfall = new_waterfall(frame_size, screen.width, screen.height, bin_mode, &palette);
+            if (!auto_limits)
+            {
+                set_waterfall_limits(&waterfall, lo, hi);
+            }
         }
 
-        if (nbytes_ready < sizeof(float)*frame_size) continue;
-
-        ssize_t nbytes = read(0, buffer, 16*sizeof(float)*frame_size);
-        if (nbytes == 0)
+        // The bins under the zoom get spread across the window, rounded out
+        // to whole bins, and the texture is drawn from wherever the zoom's
+        // edges land in them
+        Rectangle view = zoom_fraction(&screen);
+        double x0 = clamp01(view.x) * frame_size;
+        double x1 = clamp01(view.x + view.width) * frame_size;
+        uint64_t first_bin = (uint64_t)floor(x0);
+        uint64_t last_bin = (uint64_t)ceil(x1);
+        if (first_bin >= (uint64_t)frame_size) first_bin = frame_size - 1;
+        if (last_bin <= first_bin) last_bin = first_bin + 1;
+        set_waterfall_view(&waterfall, first_bin, last_bin - first_bin, bin_mode);
+
+        // Fold every complete frame the reader thread has queued up since the
+        // last draw into rows, this never waits on stdin. With frames_per_row
+        // of 0 everything that arrived during this draw becomes one row.
+        uint64_t nready = ingest_ready(&ingest);
+        for (uint64_t i = 0; i < nready; i++)
         {
-            // EOF
-            break;
-        } else if (nbytes == -1) {
-            // If we don't have data don't block or bail, just allow loop to go
-            // along so UI remains responsive.
-            if (errno != EAGAIN)
+            const float* frame = ingest_frame(&ingest, i);
+            if (frame)
+            {
+                accumulate_row(&row, frame);
+            }
+            if (frames_per_row > 0 && row.count >= (uint64_t)frames_per_row)
             {
-                perror("read");
+                push_line(finish_row(&row), &waterfall);
             }
-            break;
+        }
+        ingest_consume(&ingest, nready);
+        if (frames_per_row == 0 && row.count > 0)
+        {
+            push_line(finish_row(&row), &waterfall);
         }
 
-        // This also applies colormap
-        push_line(buffer, &waterfall, colormap);
-
-        // Render all the data we have
-        Color* pixels = waterfall.pixels;
-        UpdateTexture(rtex.texture, pixels);
+        // Limits that moved apply to every row, then only the new rows go to
+        // the GPU
+        requantize_waterfall(&waterfall, &quantizer);
+        upload_waterfall(&waterfall);
 
         Vector2 mouse_pos = GetMousePosition();
         if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
@@ -263,6 +775,14 @@ int main(int argc, char *argv[])
             ntags++;
         } else if (IsKeyPressed(KEY_Y)) {
             ntags = 0;
+        } else if (IsKeyPressed(KEY_M)) {
+            colormap = (colormap + 1) % NCOLORMAPS;
+            set_waterfall_colormap(&waterfall, &palette, &colormaps[colormap]);
+        } else if (IsKeyPressed(KEY_B)) {
+            // Max, min, mean, the envelope has no meaning for one pixel
+            bin_mode = bin_mode == BIN_MAX ? BIN_MIN : (bin_mode == BIN_MIN ? BIN_MEAN : BIN_MAX);
+        } else if (IsKeyPressed(KEY_A)) {
+            auto_waterfall_limits(&waterfall);
         } else if (IsKeyPressed(KEY_SPACE)) {
             if (active_screen == MAIN) {
                 active_screen = HELP;
@@ -270,6 +790,26 @@ int main(int argc, char *argv[])
                 active_screen = MAIN;
             }
         }
+        handle_ingest_keys(&ingest);
+
+        // Wheel moves the top color limit, shift+wheel the bottom one, by
+        // 5% of the range a notch, and fixes them there
+        float wheel = GetMouseWheelMove();
+        if (wheel != 0.0f && active_screen == MAIN && waterfall.hi > waterfall.lo)
+        {
+            float step = 0.05f * (waterfall.hi - waterfall.lo) * wheel;
+            lo = waterfall.lo;
+            hi = waterfall.hi;
+            if (IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT)) {
+                lo += step;
+            } else {
+                hi += step;
+            }
+            if (hi > lo)
+            {
+                set_waterfall_limits(&waterfall, lo, hi);
+            }
+        }
 
         // Draw
         BeginDrawing();
@@ -280,8 +820,13 @@ int main(int argc, char *argv[])
             DrawText("Controls", 20, 10, 20, WHITE);
             DrawText("t   - Draw Tag", 20, 40, 14, WHITE);
             DrawText("y   - Clear Tags", 20, 60, 14, WHITE);
-            DrawText("Click and Drag to zoom", 20, 80, 14, WHITE);
-            DrawText("Esc - Quit", 20, 100, 14, WHITE);
+            DrawText("m   - Next colormap", 20, 80, 14, WHITE);
+            DrawText("Wheel/Shift+Wheel - Top/Bottom color limit", 20, 100, 14, WHITE);
+            DrawText("a   - Auto color limits", 20, 120, 14, WHITE);
+            DrawText("b   - Next column binning", 20, 140, 14, WHITE);
+            DrawText("Click and Drag to zoom", 20, 160, 14, WHITE);
+            DrawText("Esc - Quit", 20, 180, 14, WHITE);
+            draw_ingest_help(&ingest, 210);
 
             DrawText("Tags", screen.width / 2, 10, 20, WHITE);
             for (size_t i = 0; i < ntags; i++)
@@ -290,33 +835,20 @@ int main(int argc, char *argv[])
                 DrawTextEx(font, global_tags[i].label, tpos, 14, 4.0f, WHITE);
             }
         } else {
-            // Actual waterfall
-            if (screen.zlevel > 0)
-            {
-                // Some zoom to be applied
-                Zoom z0 = screen.zoom_stack[0];
-                Zoom z1 = screen.zoom_stack[screen.zlevel];
-                Vector2 xy = to_pixels((Vector2){ z1.logical_minx, z1.logical_miny }, &screen);
-                float wratio = z1.logical_width / z0.logical_width;
-                float hratio = z1.logical_height / z0.logical_height;
-                Rectangle texture_patch = { xy.x, xy.y, screen.width * wratio, screen.height * hratio };
-                NPatchInfo patch_info = {
-                    texture_patch, 0, 0, 0, 0, NPATCH_NINE_PATCH
-                };
-                DrawTextureNPatch(
-                        rtex.texture,
-                        patch_info,
-                        (Rectangle) { 0.0f, 0.0f, screen.width, screen.height },
-                        origin,
-                        0.0f,
-                        WHITE
-                );
-                float y = waterfall.yidx / hratio;
-                DrawLine(0, y, screen.width, y, YELLOW);
-            } else {
-                DrawTexture(rtex.texture, 0, 0, WHITE);
-                DrawLine(0, waterfall.yidx, screen.width, waterfall.yidx, YELLOW);
-            }
+            // Actual waterfall. Columns already hold just the bins in view,
+            // and rows are one per pixel, so a zoom shows whole rows and
+            // bins rather than blurring pixels.
+            double nbins = (double)(last_bin - first_bin);
+            Rectangle source = {
+                (x0 - first_bin) / nbins * waterfall.columns,
+                view.y * waterfall.height,
+                (x1 - x0) / nbins * waterfall.columns,
+                view.height * waterfall.height,
+            };
+            draw_waterfall(&waterfall, &palette, source,
+                    (Rectangle) { 0.0f, 0.0f, screen.width, screen.height });
+            float y = (waterfall.yidx - source.y) * screen.height / source.height;
+            DrawLine(0, y, screen.width, y, YELLOW);
 
             // Draw tagged positions
             draw_tags(global_tags, ntags, &screen);
@@ -332,18 +864,19 @@ int main(int argc, char *argv[])
 
             // Info panel
             draw_info_panel(&screen);
+            draw_ingest_info(&ingest, &screen);
+            draw_limits(&waterfall);
         }
         EndDrawing();
     }
 
-    fcntl(0, F_SETFL, fcntl(0, F_GETFL) | ~O_NONBLOCK);
-
     // Clean up
-    free(line_of_pixels);
+    stop_ingest(&ingest);
+    free_row_accumulator(&row);
+    stop_quantizer(&quantizer);
     free_waterfall(&waterfall);
-    UnloadRenderTexture(rtex);
+    free_palette(&palette);
     CloseWindow();
-    free(buffer);
     UnloadFont(font);
 
     return 0;